@@ -0,0 +1,172 @@
+#pragma once
+
+#include "trace.h"
+
+#include <algorithm>
+
+// One ray of an adaptive fan, t is position between fan start (0) and end (1)
+class FanSample {
+public:
+	float t;
+	uint64_t signature;      // hash of hit fixture/child sequence and end wall
+	bool absorbed;
+};
+
+// Traced segment of an adaptive fan ray
+class FanSegment {
+public:
+	float t;
+	b2Vec2 source;
+	b2Vec2 point;
+};
+
+// Parallel ray fan which starts coarse and inserts rays only between neighbours whose
+// wall sequences or end containers differ, until their distance drops below tolerance.
+// Boundaries are refined level by level, so when maximumRayCasts runs out in a chaotic
+// region all of them are resolved to about the same width.
+class AdaptiveFan {
+public:
+	int coarseRays = 16;
+	float tolerance = 0.000001f;
+	int maximumReflections = 300;
+	int maximumRayCasts = 1000000;    // budget of one trace()
+
+	std::vector<FanSample> samples;   // sorted by t after trace()
+	int rayCasts = 0;
+	int unresolved = 0;               // boundaries left wider than tolerance when the budget ran out
+	float traceTime = 0;              // ms of last update() which retraced
+
+	std::vector<FanSegment> segments; // of last update()
+
+	// traces fan into segments only when scene version, fan or settings changed, true if retraced
+	template <typename World>
+	bool update(World m_world, uint32 sceneVersion, RayFan fan) {
+		if (sceneVersion == version && fan.start == tracedFan.start && fan.end == tracedFan.end && fan.angle == tracedFan.angle &&
+			coarseRays == tracedCoarseRays && tolerance == tracedTolerance && maximumReflections == tracedReflections && maximumRayCasts == tracedBudget) {
+			return false;
+		}
+
+		b2Timer timer;
+		segments.clear();
+		trace(m_world, fan.start, fan.end, fan.angle, [&](float t, b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			FanSegment segment;
+			segment.t = t;
+			segment.source = source;
+			segment.point = callback.m_point;
+			segments.push_back(segment);
+		});
+		traceTime = timer.GetMilliseconds();
+
+		version = sceneVersion;
+		tracedFan = fan;
+		tracedCoarseRays = coarseRays;
+		tracedTolerance = tolerance;
+		tracedReflections = maximumReflections;
+		tracedBudget = maximumRayCasts;
+		return true;
+	}
+
+	// visit(t, source, callback, reflection) is called for every traced segment
+	template <typename World, typename Visitor>
+	void trace(World m_world, b2Vec2 start, b2Vec2 end, float angle, Visitor visit) {
+		samples.clear();
+		rayCasts = 0;
+		unresolved = 0;
+
+		for (int i = 0;i < coarseRays;i++) {
+			samples.push_back(sample(m_world, start, end, angle, (float)i / (coarseRays - 1), visit));
+		}
+
+		// neighbour pairs of the current level
+		std::vector<FanSample> pending;
+		std::vector<FanSample> next;
+		for (int i = 0;i + 1 < coarseRays;i++) {
+			pending.push_back(samples[i]);
+			pending.push_back(samples[i + 1]);
+		}
+
+		while (!pending.empty()) {
+			next.clear();
+			for (int i = 0;i < pending.size();i += 2) {
+				const FanSample& a = pending[i];
+				const FanSample& b = pending[i + 1];
+				if (a.signature == b.signature || b.t - a.t <= tolerance) {
+					continue;
+				}
+				if (rayCasts >= maximumRayCasts) {
+					unresolved++;
+					continue;
+				}
+
+				FanSample middle = sample(m_world, start, end, angle, (a.t + b.t) / 2, visit);
+				samples.push_back(middle);
+				next.push_back(a);
+				next.push_back(middle);
+				next.push_back(middle);
+				next.push_back(b);
+			}
+			pending.swap(next);
+		}
+
+		std::sort(samples.begin(), samples.end(), [](const FanSample& a, const FanSample& b) {
+			return a.t < b.t;
+		});
+	}
+
+	// number of neighbour pairs with different paths, every one is a boundary resolved to tolerance
+	int boundaries() const {
+		int count = 0;
+		for (int i = 0;i + 1 < samples.size();i++) {
+			if (samples[i].signature != samples[i + 1].signature) {
+				count++;
+			}
+		}
+		return count;
+	}
+
+	// part of fan width ending in absorbing walls, boundary intervals are split in half
+	float absorbedFraction() const {
+		float fraction = 0;
+		for (int i = 0;i + 1 < samples.size();i++) {
+			float width = samples[i + 1].t - samples[i].t;
+			fraction += width * ((samples[i].absorbed ? 0.5f : 0) + (samples[i + 1].absorbed ? 0.5f : 0));
+		}
+		return fraction;
+	}
+
+private:
+	template <typename World, typename Visitor>
+	FanSample sample(World m_world, b2Vec2 start, b2Vec2 end, float angle, float t, Visitor visit) {
+		FanSample result;
+		result.t = t;
+		result.signature = 14695981039346656037ull;
+		result.absorbed = false;
+
+		int hits = 0;
+		traceRay(m_world, Ray(start + t * (end - start), 100, angle, maximumReflections), [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			// FNV-1a over fixture and chain edge of every bounce
+			uint64_t key = (uint64_t)(uintptr_t)callback.m_fixture ^ ((uint64_t)callback.m_childIndex << 48);
+			for (int i = 0;i < 8;i++) {
+				result.signature = (result.signature ^ ((key >> (8 * i)) & 0xff)) * 1099511628211ull;
+			}
+			result.absorbed = materials[callback.m_material].absorb;
+			hits++;
+			visit(t, source, callback, reflection);
+		});
+
+		// last cast missed unless ray was absorbed or ran out of reflections
+		rayCasts += hits;
+		if (!result.absorbed && hits <= maximumReflections) {
+			rayCasts++;
+		}
+		return result;
+	}
+
+	// inputs of last update()
+	uint32 version = 0;
+	RayFan tracedFan = { b2Vec2(0, 0), b2Vec2(0, 0), 0 };
+	int tracedCoarseRays = 0;
+	float tracedTolerance = 0;
+	int tracedReflections = 0;
+	int tracedBudget = 0;
+};
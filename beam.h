@@ -0,0 +1,300 @@
+#pragma once
+
+#include "tools.h"
+#include "segments.h"
+
+#include <algorithm>
+
+// Part of a wall lit by one sub-beam, u0 and u1 are parameters along the segment
+class LitInterval {
+public:
+	int segment;
+	float u0;
+	float u1;
+	float width;          // beam cross-section width carried to the wall
+	int reflection;
+};
+
+// Parallel beam: every point of origin segment a-b emits a ray in direction
+class Beam {
+public:
+	b2Vec2 a;
+	b2Vec2 b;
+	b2Vec2 direction;
+	int reflection;
+	int fromSegment;      // segment the beam was reflected from, -1 for source beam
+};
+
+// Propagates a whole parallel ray fan as polygonal beams. Beam is clipped against all walls in
+// its own coordinates (s across the beam, t along it), split at wall vertices and every
+// sub-beam is reflected as a new parallel beam. Work depends on the number of distinct wall
+// sequences, not on the number of rays.
+class BeamTracer {
+public:
+	const SegmentTable* segments;
+	int maximumReflections = 300;
+	int maximumBeams = 100000;
+	float minimumWidth = 0.00001f;
+	float length = 100;
+
+	std::vector<LitInterval> lit;
+	std::vector<Beam> escaped;       // sub-beams which left the scene, direction is kept
+	int beams = 0;                   // traced sub-beams
+	float sourceWidth = 0;
+	float absorbedWidth = 0;
+	float truncatedWidth = 0;        // of sub-beams left untraced when maximumBeams was reached
+
+	BeamTracer(const SegmentTable* _segments) {
+		segments = _segments;
+	}
+
+	// visit(origin0, origin1, hit1, hit0, reflection) is called for every sub-beam polygon
+	template <typename Visitor>
+	void trace(b2Vec2 start, b2Vec2 end, float angle, Visitor visit) {
+		lit.clear();
+		escaped.clear();
+		beams = 0;
+		absorbedWidth = 0;
+		truncatedWidth = 0;
+
+		Beam source;
+		source.a = start;
+		source.b = end;
+		source.direction = b2Vec2(cos(angle), sin(angle));
+		source.reflection = 0;
+		source.fromSegment = -1;
+		sourceWidth = fabs(b2Cross(source.direction, end - start));
+
+		std::vector<Beam> stack;
+		stack.push_back(source);
+
+		while (!stack.empty() && beams < maximumBeams) {
+			Beam beam = stack.back();
+			stack.pop_back();
+			split(beam, stack, visit);
+		}
+		for (int i = 0;i < stack.size();i++) {
+			truncatedWidth += fabs(b2Cross(stack[i].direction, stack[i].b - stack[i].a));
+		}
+	}
+
+	// sum of lit width on segment i
+	float litWidth(int segment) const {
+		float width = 0;
+		for (int i = 0;i < lit.size();i++) {
+			if (lit[i].segment == segment) {
+				width += lit[i].width;
+			}
+		}
+		return width;
+	}
+
+private:
+	class Candidate {
+	public:
+		int segment;
+		float s0, t0;
+		float s1, t1;
+
+		float t(float s) const {
+			return t0 + (s - s0) * (t1 - t0) / (s1 - s0);
+		}
+	};
+
+	template <typename Visitor>
+	void split(const Beam& beam, std::vector<Beam>& stack, Visitor visit) {
+		beams++;
+
+		b2Vec2 d = beam.direction;
+		b2Vec2 n = b2Vec2(-d.y, d.x);
+		b2Vec2 a = beam.a;
+		b2Vec2 b = beam.b;
+
+		float sb = b2Dot(b - a, n);
+		if (sb < 0) {
+			std::swap(a, b);
+			sb = -sb;
+		}
+		if (sb < minimumWidth) {
+			return;
+		}
+		float tb = b2Dot(b - a, d);
+
+		// origin segment in beam coordinates
+		auto originT = [&](float s) {
+			return tb * s / sb;
+		};
+
+		std::vector<Candidate> candidates;
+		std::vector<float> breaks;
+		breaks.push_back(0);
+		breaks.push_back(sb);
+
+		for (int i = 0;i < segments->count;i++) {
+			if (i == beam.fromSegment) {
+				continue;
+			}
+
+			b2Vec2 v1 = segments->start(i) - a;
+			b2Vec2 v2 = segments->end(i) - a;
+
+			Candidate candidate;
+			candidate.segment = i;
+			candidate.s0 = b2Dot(v1, n);
+			candidate.t0 = b2Dot(v1, d);
+			candidate.s1 = b2Dot(v2, n);
+			candidate.t1 = b2Dot(v2, d);
+
+			if (candidate.s0 > candidate.s1) {
+				std::swap(candidate.s0, candidate.s1);
+				std::swap(candidate.t0, candidate.t1);
+			}
+
+			// parallel to rays or outside of the beam
+			if (candidate.s1 - candidate.s0 < minimumWidth || candidate.s1 <= 0 || candidate.s0 >= sb) {
+				continue;
+			}
+			// completely behind origin
+			if (candidate.t0 <= originT(candidate.s0) && candidate.t1 <= originT(candidate.s1)) {
+				continue;
+			}
+
+			candidates.push_back(candidate);
+			if (candidate.s0 > 0) {
+				breaks.push_back(candidate.s0);
+			}
+			if (candidate.s1 < sb) {
+				breaks.push_back(candidate.s1);
+			}
+
+			// segment crosses origin line inside the beam
+			float slope = (candidate.t1 - candidate.t0) / (candidate.s1 - candidate.s0) - tb / sb;
+			if (slope != 0) {
+				float s = (originT(candidate.s0) - candidate.t0) / slope + candidate.s0;
+				if (s > 0 && s < sb && s > candidate.s0 && s < candidate.s1) {
+					breaks.push_back(s);
+				}
+			}
+		}
+
+		std::sort(breaks.begin(), breaks.end());
+
+		// closest wall is constant between breaks as walls do not cross, neighbour intervals
+		// with the same wall are merged into one sub-beam
+		int currentSegment = -2;
+		const Candidate* current = nullptr;
+		float currentS = 0;
+
+		for (int k = 0;k + 1 < breaks.size();k++) {
+			float s0 = breaks[k];
+			float s1 = breaks[k + 1];
+			if (s1 - s0 < minimumWidth) {
+				continue;
+			}
+
+			float s = (s0 + s1) / 2;
+			float ts = originT(s) + 0.0001f;
+			const Candidate* closest = nullptr;
+			float closestT = 0;
+
+			for (int j = 0;j < candidates.size();j++) {
+				const Candidate& candidate = candidates[j];
+				if (s < candidate.s0 || s > candidate.s1) {
+					continue;
+				}
+				float t = candidate.t(s);
+				if (t > ts && (closest == nullptr || t < closestT)) {
+					closest = &candidate;
+					closestT = t;
+				}
+			}
+
+			int segment = closest ? closest->segment : -1;
+			if (segment != currentSegment) {
+				if (currentSegment != -2) {
+					emit(beam, a, d, n, tb / sb, current, currentS, s0, stack, visit);
+				}
+				currentSegment = segment;
+				current = closest;
+				currentS = s0;
+			}
+		}
+
+		if (currentSegment != -2) {
+			emit(beam, a, d, n, tb / sb, current, currentS, sb, stack, visit);
+		}
+	}
+
+	template <typename Visitor>
+	void emit(const Beam& beam, b2Vec2 a, b2Vec2 d, b2Vec2 n, float originSlope, const Candidate* wall, float s0, float s1, std::vector<Beam>& stack, Visitor visit) {
+		b2Vec2 o0 = a + s0 * n + (originSlope * s0) * d;
+		b2Vec2 o1 = a + s1 * n + (originSlope * s1) * d;
+
+		if (wall == nullptr) {
+			visit(o0, o1, o1 + length * d, o0 + length * d, beam.reflection);
+
+			Beam out;
+			out.a = o0;
+			out.b = o1;
+			out.direction = d;
+			out.reflection = beam.reflection;
+			out.fromSegment = -1;
+			escaped.push_back(out);
+			return;
+		}
+
+		b2Vec2 h0 = a + s0 * n + wall->t(s0) * d;
+		b2Vec2 h1 = a + s1 * n + wall->t(s1) * d;
+		visit(o0, o1, h1, h0, beam.reflection);
+
+		int i = wall->segment;
+		b2Vec2 v = segments->end(i) - segments->start(i);
+		float vv = b2Dot(v, v);
+
+		LitInterval interval;
+		interval.segment = i;
+		interval.u0 = b2Dot(h0 - segments->start(i), v) / vv;
+		interval.u1 = b2Dot(h1 - segments->start(i), v) / vv;
+		interval.width = s1 - s0;
+		interval.reflection = beam.reflection;
+		lit.push_back(interval);
+
+		if (materials[segments->material[i]].absorb) {
+			absorbedWidth += s1 - s0;
+			return;
+		}
+
+		if (beam.reflection < maximumReflections) {
+			Beam reflected;
+			reflected.a = h0;
+			reflected.b = h1;
+			reflected.direction = reflect(d, segments->normal(i, d));
+			reflected.reflection = beam.reflection + 1;
+			reflected.fromSegment = i;
+			stack.push_back(reflected);
+		}
+	}
+};
+
+// beam counterpart of drawRainbowRay, draws sub-beams and lit wall intervals
+inline void drawBeam(BeamTracer* tracer, b2Vec2 start, b2Vec2 end, float angle) {
+	tracer->trace(start, end, angle, [&](b2Vec2 o0, b2Vec2 o1, b2Vec2 h1, b2Vec2 h0, int reflection) {
+		float k = 5.0f * reflection / 6;
+		b2Color color = b2Color(
+			0.5f + cos(k) / 2,
+			0.5f + cos(k + 2 * PI / 3) / 2,
+			0.5f + cos(k + 4 * PI / 3) / 2
+		);
+		b2Vec2 polygon[4] = { o0, o1, h1, h0 };
+		g_debugDraw.DrawSolidPolygon(polygon, 4, color);
+	});
+
+	const SegmentTable* segments = tracer->segments;
+	for (int i = 0;i < tracer->lit.size();i++) {
+		const LitInterval& interval = tracer->lit[i];
+		b2Vec2 v = segments->end(interval.segment) - segments->start(interval.segment);
+		b2Vec2 p1 = segments->start(interval.segment) + interval.u0 * v;
+		b2Vec2 p2 = segments->start(interval.segment) + interval.u1 * v;
+		g_debugDraw.DrawSegment(p1, p2, b2Color(1, 1, 0));
+	}
+}
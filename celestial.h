@@ -0,0 +1,359 @@
+#pragma once
+
+#include <thread>
+#include <cstdint>
+
+#include "trace.h"
+
+#define GIZA_LATITUDE                      29.9792       // degrees north
+#define DESCENDING_CORRIDOR_WIDTH          1.055f        // east-west width, Petrie 41.53 inches
+#define TROPICAL_YEAR                      365.2422
+
+// bright star at J2000 with proper motion
+class CatalogStar {
+public:
+	const char* name;
+	double ra;           // degrees
+	double dec;
+	double pmRa;         // milliarcseconds per year, multiplied by cos(dec)
+	double pmDec;
+};
+
+const CatalogStar catalogStars[] = {
+	{ "Thuban",    211.0973,  64.3758,    -56.52,     17.19 },
+	{ "Polaris",    37.9545,  89.2641,     44.48,    -11.85 },
+	{ "Kochab",    222.6764,  74.1555,    -32.61,     11.42 },
+	{ "Dubhe",     165.9320,  61.7510,   -134.11,    -34.70 },
+	{ "Mizar",     200.9814,  54.9254,    121.23,    -22.01 },
+	{ "Vega",      279.2347,  38.7837,    200.94,    286.23 },
+	{ "Deneb",     310.3580,  45.2803,      2.01,      1.85 },
+	{ "Capella",    79.1723,  45.9980,     75.25,   -426.89 },
+	{ "Arcturus",  213.9153,  19.1824,  -1093.39,  -2000.06 },
+	{ "Alcyone",    56.8712,  24.1051,     19.34,    -43.67 },
+	{ "Alnitak",    85.1897,  -1.9426,      3.19,      2.03 },
+	{ "Sirius",    101.2872, -16.7161,   -546.01,  -1223.07 }
+};
+const int catalogStarsCount = sizeof(catalogStars) / sizeof(catalogStars[0]);
+
+// Long term precession: J2000 ecliptic longitudes advance by general precession and are turned back to
+// equator with obliquity of date (Laskar 1986). Motion of the ecliptic itself is ignored, which keeps the
+// error below about a degree over 5000 years; proper motion is linear on the sphere.
+class Ephemeris {
+public:
+	static double radians(double degrees) {
+		return degrees * PI / 180;
+	}
+
+	static double degrees(double radians) {
+		return radians * 180 / PI;
+	}
+
+	// degrees, valid for +-10000 years around J2000
+	static double obliquity(double year) {
+		double u = (year - 2000) / 10000;
+		double terms[] = { 84381.448, -4680.93, -1.55, 1999.25, -51.38, -249.67, -39.05, 7.12, 27.87, 5.79, 2.45 };
+		double arcseconds = 0;
+		for (int i = 10;i >= 0;i--) {
+			arcseconds = arcseconds * u + terms[i];
+		}
+		return arcseconds / 3600;
+	}
+
+	// general precession in longitude since J2000, degrees
+	static double precession(double year) {
+		double t = (year - 2000) / 100;
+		return (5028.796195 * t + 1.1054348 * t * t) / 3600;
+	}
+
+	// unit vector in equator and equinox of date, year is astronomical (0 is 1 BC)
+	static void star(const CatalogStar& s, double year, double* ra, double* dec) {
+		double a = radians(s.ra);
+		double d = radians(s.dec);
+		double years = year - 2000;
+		double motionRa = radians(s.pmRa / 3.6e6) * years;
+		double motionDec = radians(s.pmDec / 3.6e6) * years;
+
+		// position plus proper motion along tangent directions of ra and dec
+		double x = cos(d) * cos(a) - motionRa * sin(a) - motionDec * sin(d) * cos(a);
+		double y = cos(d) * sin(a) + motionRa * cos(a) - motionDec * sin(d) * sin(a);
+		double z = sin(d) + motionDec * cos(d);
+
+		double e0 = radians(obliquity(2000));
+		double ey = y * cos(e0) + z * sin(e0);
+		double ez = -y * sin(e0) + z * cos(e0);
+
+		double p = radians(precession(year));
+		double ex = x * cos(p) - ey * sin(p);
+		ey = x * sin(p) + ey * cos(p);
+
+		double e = radians(obliquity(year));
+		toEquatorial(ex, ey * cos(e) - ez * sin(e), ey * sin(e) + ez * cos(e), ra, dec);
+	}
+
+	// mean sun on circular orbit, day 0 is vernal equinox
+	static void sun(double day, double year, double* ra, double* dec) {
+		double longitude = 2 * PI * day / TROPICAL_YEAR;
+		double e = radians(obliquity(year));
+		toEquatorial(cos(longitude), sin(longitude) * cos(e), sin(longitude) * sin(e), ra, dec);
+	}
+
+	// direction to object from observer at latitude, hour angle and declination in degrees
+	static void horizon(double hourAngle, double dec, double latitude, double* north, double* east, double* up) {
+		double h = radians(hourAngle);
+		double d = radians(dec);
+		double f = radians(latitude);
+		*up = sin(f) * sin(d) + cos(f) * cos(d) * cos(h);
+		*north = cos(f) * sin(d) - sin(f) * cos(d) * cos(h);
+		*east = -cos(d) * sin(h);
+	}
+
+private:
+	static void toEquatorial(double x, double y, double z, double* ra, double* dec) {
+		*ra = degrees(atan2(y, x));
+		if (*ra < 0) {
+			*ra += 360;
+		}
+		*dec = degrees(asin(b2Clamp(z / sqrt(x * x + y * y + z * z), -1.0, 1.0)));
+	}
+};
+
+// Which stars and sun positions shine down the descending corridor, by epoch.
+// Pyramid section is the meridian plane with north along +x, so light from in-plane elevation e
+// travels at angle PI + e. Light enters through aperture (corridor entrance in north face) and is
+// transmitted when it crosses target line (corridor bottom, gallery entrance) within maximumReflections.
+// Walls do not move with epochs, so in-plane transmission is traced once for a table of elevations
+// (in batch, all threads), and every (object, epoch) pair becomes analytic: precession gives the
+// direction over a day, the table gives the in-plane part and east-west tilt is cut by corridor side
+// walls, which the section does not have: a beam shifted sideways by s over a corridor of width w
+// keeps 1 - s / w of its light.
+class CelestialAlignment {
+public:
+	// transmission of one object at one epoch
+	class Sample {
+	public:
+		float peak = 0;          // highest transmitted fraction during the day (year for sun)
+		float daily = 0;         // transmitted fraction averaged over the day (year for sun)
+		float elevation = 0;     // in-plane elevation of the peak, degrees
+	};
+
+	b2Vec2 targetStart;                         // light is transmitted when it crosses this line
+	b2Vec2 targetEnd;
+	double firstYear = -3500;
+	double lastYear = 2000;
+	int epochs = 551;
+	bool sun = true;
+	int sunDays = 73;                           // sampled days of year
+	int hourSamples = 64;                       // around every meridian crossing
+	int rays = 200;                             // per table elevation
+	int maximumReflections = 0;                 // 0 is direct line of sight
+	float elevationStep = 0.02f;                // degrees
+	float corridorWidth = DESCENDING_CORRIDOR_WIDTH;
+	double latitude = GIZA_LATITUDE;
+	int threads = 1;
+
+	// in-plane table by elevation 0..90 degrees
+	std::vector<float> transmitted;
+	std::vector<float> pathLength;              // mean in-plane length of transmitted rays
+	int64_t rayCasts = 0;
+
+	std::vector<Sample> samples;                // [object * epochs + epoch]
+
+	CelestialAlignment() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	int objects() const {
+		return catalogStarsCount + (sun ? 1 : 0);
+	}
+
+	const char* objectName(int object) const {
+		return object < catalogStarsCount ? catalogStars[object].name : "Sun";
+	}
+
+	double year(int epoch) const {
+		return epochs > 1 ? firstYear + (lastYear - firstYear) * epoch / (epochs - 1) : firstYear;
+	}
+
+	const Sample& sample(int object, int epoch) const {
+		return samples[object * epochs + epoch];
+	}
+
+	int64_t pairs() const {
+		return (int64_t)objects() * epochs;
+	}
+
+	// traces elevation table from aperture line and evaluates all pairs
+	template <typename World>
+	void run(World m_world, b2Vec2 apertureStart, b2Vec2 apertureEnd) {
+		traceTable(m_world, apertureStart, apertureEnd);
+
+		samples.assign(pairs(), Sample());
+		std::vector<std::thread> workers;
+		for (int k = 0;k < threads;k++) {
+			workers.push_back(std::thread([&, k]() {
+				for (int64_t i = k;i < pairs();i += threads) {
+					evaluate((int)(i / epochs), (int)(i % epochs), &samples[i]);
+				}
+			}));
+		}
+		for (int k = 0;k < threads;k++) {
+			workers[k].join();
+		}
+	}
+
+	// transmitted fraction of parallel light coming from direction (north, east, up)
+	float transmission(double north, double east, double up, float* elevation) const {
+		*elevation = (float)Ephemeris::degrees(atan2(up, north));
+		if (up <= 0 || north <= 0 || transmitted.empty()) {
+			return 0;
+		}
+
+		float position = *elevation / elevationStep;
+		int i = b2Min((int)position, (int)transmitted.size() - 2);
+		float t = position - i;
+		float inPlane = (1 - t) * transmitted[i] + t * transmitted[i + 1];
+		if (inPlane <= 0) {
+			return 0;
+		}
+		float length = transmitted[i] > 0 && transmitted[i + 1] > 0 ? (1 - t) * pathLength[i] + t * pathLength[i + 1] : b2Max(pathLength[i], pathLength[i + 1]);
+		float sideways = length * (float)(fabs(east) / sqrt(north * north + up * up));
+		return inPlane * b2Max(0.0f, 1 - sideways / corridorWidth);
+	}
+
+	// in-plane elevation of object crossing northern meridian above pole at epoch, false when it does not rise there
+	bool northernTransit(int object, double year, float* elevation) const {
+		double ra, dec;
+		Ephemeris::star(catalogStars[object], year, &ra, &dec);
+		double north, east, up;
+		Ephemeris::horizon(180, dec, latitude, &north, &east, &up);
+		*elevation = (float)Ephemeris::degrees(atan2(up, north));
+		return up > 0 && north > 0;
+	}
+
+private:
+	template <typename World>
+	void traceTable(World m_world, b2Vec2 apertureStart, b2Vec2 apertureEnd) {
+		int count = (int)(90 / elevationStep) + 2;
+		transmitted.assign(count, 0);
+		pathLength.assign(count, 0);
+		std::vector<int64_t> casts(threads, 0);
+
+		std::vector<std::thread> workers;
+		for (int k = 0;k < threads;k++) {
+			workers.push_back(std::thread([&, k]() {
+				for (int i = k;i < count;i += threads) {
+					float angle = PI + (float)Ephemeris::radians(b2Min(90.0f, i * elevationStep));
+					int contained = 0;
+					float length = 0;
+
+					for (int j = 0;j < rays;j++) {
+						b2Vec2 point = apertureStart + ((j + 0.5f) / rays) * (apertureEnd - apertureStart);
+						float distance = 0;
+						bool crossed = false;
+						int hits = 0;
+						traceRay(m_world, Ray(point, 200, angle, maximumReflections), [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+							float t;
+							if (!crossed && crossesTarget(source, callback.m_point, &t)) {
+								crossed = true;
+								distance += t * (callback.m_point - source).Length();
+							}
+							if (!crossed) {
+								distance += (callback.m_point - source).Length();
+							}
+							hits++;
+						});
+						casts[k] += b2Min(hits + 1, maximumReflections + 1);
+
+						if (crossed) {
+							contained++;
+							length += distance;
+						}
+					}
+					transmitted[i] = (float)contained / rays;
+					pathLength[i] = contained > 0 ? length / contained : 0;
+				}
+			}));
+		}
+		for (int k = 0;k < threads;k++) {
+			workers[k].join();
+		}
+
+		rayCasts = 0;
+		for (int k = 0;k < threads;k++) {
+			rayCasts += casts[k];
+		}
+		shortestPath = 0;
+		for (int i = 0;i < count;i++) {
+			if (transmitted[i] > 0 && (shortestPath == 0 || pathLength[i] < shortestPath)) {
+				shortestPath = pathLength[i];
+			}
+		}
+	}
+
+	float shortestPath = 0;
+
+	// p1 -> p2 crosses target line at fraction t
+	bool crossesTarget(b2Vec2 p1, b2Vec2 p2, float* t) const {
+		b2Vec2 r = p2 - p1;
+		b2Vec2 s = targetEnd - targetStart;
+		float denominator = b2Cross(r, s);
+		if (denominator == 0) {
+			return false;
+		}
+		b2Vec2 w = targetStart - p1;
+		*t = b2Cross(w, s) / denominator;
+		float u = b2Cross(w, r) / denominator;
+		return *t >= 0 && *t <= 1 && u >= 0 && u <= 1;
+	}
+
+	void evaluate(int object, int epoch, Sample* result) const {
+		double y = year(epoch);
+		if (object < catalogStarsCount) {
+			double ra, dec;
+			Ephemeris::star(catalogStars[object], y, &ra, &dec);
+			*result = day(dec);
+			return;
+		}
+
+		// sun: days of year, daily fractions are averaged over the year
+		for (int d = 0;d < sunDays;d++) {
+			double ra, dec;
+			Ephemeris::sun((d + 0.5) * TROPICAL_YEAR / sunDays, y, &ra, &dec);
+			Sample one = day(dec);
+			if (one.peak > result->peak) {
+				result->peak = one.peak;
+				result->elevation = one.elevation;
+			}
+			result->daily += one.daily / sunDays;
+		}
+	}
+
+	// integrates one day of object with declination, light passes only close to meridian crossings
+	Sample day(double dec) const {
+		Sample result;
+		if (shortestPath <= 0) {
+			return result;
+		}
+
+		// sideways tilt |east| = cos(dec) |sin(hour angle)| must stay below corridorWidth / shortestPath
+		double limit = corridorWidth / shortestPath / b2Max(1e-9, cos(Ephemeris::radians(dec)));
+		double halfWindow = limit >= 1 ? 90 : Ephemeris::degrees(asin(limit));
+
+		for (int crossing = 0;crossing < 2;crossing++) {
+			double center = crossing * 180;
+			double step = 2 * halfWindow / hourSamples;
+			for (int i = 0;i < hourSamples;i++) {
+				double north, east, up;
+				Ephemeris::horizon(center - halfWindow + (i + 0.5) * step, dec, latitude, &north, &east, &up);
+				float elevation;
+				float fraction = transmission(north, east, up, &elevation);
+				result.daily += (float)(fraction * step / 360);
+				if (fraction > result.peak) {
+					result.peak = fraction;
+					result.elevation = elevation;
+				}
+			}
+		}
+		return result;
+	}
+};
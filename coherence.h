@@ -0,0 +1,100 @@
+#pragma once
+
+#include "snapshot.h"
+
+// Wall sequence of every ray of a fan from the previous trace. While a slider is dragged or an
+// animation moves, rays mostly hit the same walls in the same order, so a bounce first tests the
+// predicted segment alone and then only asks whether anything is in front of that hit: an any hit
+// query cut at the hit, which stops early and needs no divisions. A wrong or missing hint falls back
+// to the full closest hit query, and so do the remaining bounces of that ray. Equal hits count as
+// occluders, so the result is always the one of the full query over the same walls. Hints are
+// segment indices, they stay valid across rebuilds which produce the same number of walls and are
+// dropped otherwise.
+//   hints.prepare(rays, maximumReflections, segments.count);
+//   HintedScene hinted = hints.scene(&segments, &tree, i);
+//   traceRay(&hinted, ray, visitor);
+class CoherenceHints;
+
+// Walls of one ray traced with its hints, a cursor over them advances with every cast. traceRay()
+// over it gives the same visits and distance as over the segments alone.
+class HintedScene {
+public:
+	CoherenceHints* hints;
+	const SegmentTable* segments;
+	const SegmentTree* tree;                 // null for brute force
+	int* hint;                               // of the ray's first bounce
+	int bounce = 0;
+	bool following = true;                   // after the first wrong hint the path has left the old one
+};
+
+class CoherenceHints {
+public:
+	int rays = 0;
+	int bounces = 0;                         // maximumReflections + 1
+	int walls = 0;                           // segments count hints were recorded with
+	std::vector<int> hints;                  // [ray * bounces + bounce], segment hit, -1 is no hit
+
+	int64_t predicted = 0;                   // casts answered by hint since prepare()
+	int64_t fallbacks = 0;                   // full queries after wrong or missing hint
+
+	// keeps hints of previous trace when fan size and walls count did not change
+	void prepare(int fanRays, int maximumReflections, int segmentsCount) {
+		if (fanRays != rays || maximumReflections + 1 != bounces || segmentsCount != walls) {
+			rays = fanRays;
+			bounces = maximumReflections + 1;
+			walls = segmentsCount;
+			hints.assign((size_t)rays * bounces, -1);
+		}
+		predicted = 0;
+		fallbacks = 0;
+	}
+
+	// world for traceRay() of ray, tree is null for brute force
+	HintedScene scene(const SegmentTable* segments, const SegmentTree* tree, int ray) {
+		HintedScene hinted;
+		hinted.hints = this;
+		hinted.segments = segments;
+		hinted.tree = tree;
+		hinted.hint = &hints[(size_t)ray * bounces];
+		return hinted;
+	}
+
+	HintedScene scene(const SceneSnapshot* snapshot, int ray) {
+		return scene(&snapshot->segments, snapshot->bruteForce ? nullptr : &snapshot->tree, ray);
+	}
+
+	// part of casts answered by hints in the last trace
+	float hitRate() const {
+		return predicted + fallbacks > 0 ? (float)predicted / (predicted + fallbacks) : 0;
+	}
+};
+
+// tests the hint of the next bounce alone and then whether anything is in front of it, full query after
+// a wrong hint or past the bounces hints were prepared for
+inline void rayCastClosest(HintedScene* hinted, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	const SegmentTable* segments = hinted->segments;
+	const SegmentTree* tree = hinted->tree;
+	CoherenceHints* hints = hinted->hints;
+	int* hint = hinted->bounce < hints->bounces ? &hinted->hint[hinted->bounce] : nullptr;
+	hinted->bounce++;
+
+	int segment = -1;
+	float fraction = 1.0f;
+	bool crosses = hinted->following && hint && *hint >= 0 &&
+		(tree ? segments->rayCastSegment(*hint, point1, point2 - point1, &fraction) : segments->rayCastOne(*hint, point1, point2, &fraction));
+	if (crosses && !(tree ? tree->occluded(segments, point1, point2, fraction, *hint) : segments->occluded(point1, point2, fraction, *hint))) {
+		segment = *hint;
+		hints->predicted++;
+	}
+	else {
+		hinted->following = false;
+		segment = tree ? tree->rayCast(segments, point1, point2, 1.0f, &fraction) : segments->rayCast(point1, point2, 1.0f, &fraction);
+		hints->fallbacks++;
+	}
+	if (hint) {
+		*hint = segment;
+	}
+	if (segment >= 0) {
+		reportSegment(segments, segment, fraction, callback, point1, point2);
+	}
+}
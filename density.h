@@ -0,0 +1,216 @@
+#pragma once
+
+#include "glad/gl.h"
+
+#include <thread>
+#include <algorithm>
+
+#include "tools.h"
+
+// Ray density accumulated over the current view and drawn as a single texture.
+// Traced segments are splatted bilinearly (anti-aliased) into a float buffer. Rasterization
+// is split into horizontal tiles, one per thread, so threads never write the same pixel.
+class DensityBuffer {
+public:
+	int width = 0;
+	int height = 0;
+	b2Vec2 lower;                   // world rectangle covered by the buffer
+	b2Vec2 upper;
+	float exposure = 10.0f;
+
+	std::vector<float> density;
+	std::vector<uint32> pixels;     // tone-mapped RGBA
+
+	int threads = 1;
+	int chunkRays = 1024;           // per thread between rasterizations, bounds memory of traced segments
+
+	DensityBuffer() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	~DensityBuffer() {
+		if (texture) {
+			glDeleteTextures(1, &texture);
+		}
+	}
+
+	// covers whole testbed view
+	void fitView() {
+		resize(g_camera.m_width, g_camera.m_height,
+			g_camera.ConvertScreenToWorld(b2Vec2(0, (float)g_camera.m_height)),
+			g_camera.ConvertScreenToWorld(b2Vec2((float)g_camera.m_width, 0)));
+	}
+
+	void resize(int _width, int _height, b2Vec2 _lower, b2Vec2 _upper) {
+		width = b2Max(1, _width);
+		height = b2Max(1, _height);
+		lower = _lower;
+		upper = _upper;
+		density.assign(width * height, 0);
+		pixels.assign(width * height, 0);
+	}
+
+	void clear() {
+		std::fill(density.begin(), density.end(), 0.0f);
+	}
+
+	// traces rays of parallel fan on all threads and accumulates their segments, chunkRays per thread
+	// at a time so that memory does not grow with rays
+	template <typename World>
+	void accumulateFan(World m_world, b2Vec2 start, b2Vec2 end, float angle, int rays, int maximumReflections) {
+		std::vector<std::vector<b2Vec2>> segments(threads);
+		int chunk = chunkRays * threads;
+
+		for (int first = 0;first < rays;first += chunk) {
+			int last = b2Min(rays, first + chunk);
+			std::vector<std::thread> workers;
+			for (int k = 0;k < threads;k++) {
+				segments[k].clear();
+				workers.push_back(std::thread([&, k]() {
+					for (int i = first + k;i < last;i += threads) {
+						b2Vec2 point = start + ((i + 0.5f) / rays) * (end - start);
+						traceRay(m_world, Ray(point, 100, angle, maximumReflections), [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+							segments[k].push_back(source);
+							segments[k].push_back(callback.m_point);
+						});
+					}
+				}));
+			}
+			for (int k = 0;k < threads;k++) {
+				workers[k].join();
+			}
+
+			rasterize(segments, 1.0f / rays);
+		}
+	}
+
+	// segments are point pairs, every thread owns its band of rows
+	void rasterize(const std::vector<std::vector<b2Vec2>>& segments, float weight) {
+		std::vector<std::thread> workers;
+		int rows = (height + threads - 1) / threads;
+
+		for (int k = 0;k < threads;k++) {
+			int rowBegin = k * rows;
+			int rowEnd = b2Min(height, rowBegin + rows);
+
+			workers.push_back(std::thread([&, rowBegin, rowEnd]() {
+				for (int list = 0;list < segments.size();list++) {
+					for (int i = 0;i + 1 < segments[list].size();i += 2) {
+						addSegment(segments[list][i], segments[list][i + 1], weight, rowBegin, rowEnd);
+					}
+				}
+			}));
+		}
+		for (int k = 0;k < threads;k++) {
+			workers[k].join();
+		}
+	}
+
+	// bilinear splats along the segment with one pixel step, only rows [rowBegin, rowEnd) are written
+	void addSegment(b2Vec2 p1, b2Vec2 p2, float weight, int rowBegin, int rowEnd) {
+		float scaleX = width / (upper.x - lower.x);
+		float scaleY = height / (upper.y - lower.y);
+
+		float x1 = (p1.x - lower.x) * scaleX;
+		float y1 = (upper.y - p1.y) * scaleY;
+		float dx = (p2.x - lower.x) * scaleX - x1;
+		float dy = (upper.y - p2.y) * scaleY - y1;
+
+		float t0 = 0;
+		float t1 = 1;
+		clip(y1, dy, rowBegin - 1.0f, (float)rowEnd, &t0, &t1);
+		clip(x1, dx, -1.0f, (float)width, &t0, &t1);
+		if (t0 > t1) {
+			return;
+		}
+
+		float steps = b2Max(1.0f, b2Max(fabsf(dx), fabsf(dy)));
+		float w = weight * sqrtf(dx * dx + dy * dy) / steps;
+
+		int k0 = (int)ceilf(t0 * steps);
+		int k1 = (int)floorf(t1 * steps);
+
+		for (int k = k0;k <= k1;k++) {
+			float x = x1 + dx * k / steps;
+			float y = y1 + dy * k / steps;
+			int ix = (int)floorf(x);
+			int iy = (int)floorf(y);
+			float fx = x - ix;
+			float fy = y - iy;
+
+			splat(ix, iy, (1 - fx) * (1 - fy) * w, rowBegin, rowEnd);
+			splat(ix + 1, iy, fx * (1 - fy) * w, rowBegin, rowEnd);
+			splat(ix, iy + 1, (1 - fx) * fy * w, rowBegin, rowEnd);
+			splat(ix + 1, iy + 1, fx * fy * w, rowBegin, rowEnd);
+		}
+	}
+
+	// logarithmic tone mapping into heat colors, alpha follows intensity so walls stay visible
+	void toneMap() {
+		float maximum = 0;
+		for (int i = 0;i < density.size();i++) {
+			maximum = b2Max(maximum, density[i]);
+		}
+		if (maximum == 0) {
+			std::fill(pixels.begin(), pixels.end(), 0);
+			return;
+		}
+
+		float norm = 1.0f / logf(1 + exposure * maximum);
+		for (int i = 0;i < density.size();i++) {
+			float v = logf(1 + exposure * density[i]) * norm;
+			uint32 r = (uint32)(255 * b2Min(1.0f, 3 * v));
+			uint32 g = (uint32)(255 * b2Clamp(3 * v - 1, 0.0f, 1.0f));
+			uint32 b = (uint32)(255 * b2Clamp(3 * v - 2, 0.0f, 1.0f));
+			uint32 a = (uint32)(255 * b2Min(1.0f, 2 * v));
+			pixels[i] = r | (g << 8) | (b << 16) | (a << 24);
+		}
+	}
+
+	// uploads tone-mapped pixels and draws them over the view in one quad
+	void draw() {
+		if (texture == 0) {
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		b2Vec2 p1 = g_camera.ConvertWorldToScreen(b2Vec2(lower.x, upper.y));
+		b2Vec2 p2 = g_camera.ConvertWorldToScreen(b2Vec2(upper.x, lower.y));
+		ImGui::GetBackgroundDrawList()->AddImage((ImTextureID)(intptr_t)texture, ImVec2(p1.x, p1.y), ImVec2(p2.x, p2.y));
+	}
+
+private:
+	GLuint texture = 0;
+
+	void splat(int x, int y, float value, int rowBegin, int rowEnd) {
+		if (x >= 0 && x < width && y >= rowBegin && y < rowEnd) {
+			density[y * width + x] += value;
+		}
+	}
+
+	// Liang-Barsky clip of p + t * d to [minimum, maximum]
+	static void clip(float p, float d, float minimum, float maximum, float* t0, float* t1) {
+		if (d == 0) {
+			if (p < minimum || p > maximum) {
+				*t0 = 1;
+				*t1 = 0;
+			}
+			return;
+		}
+		float ta = (minimum - p) / d;
+		float tb = (maximum - p) / d;
+		if (ta > tb) {
+			std::swap(ta, tb);
+		}
+		*t0 = b2Max(*t0, ta);
+		*t1 = b2Min(*t1, tb);
+	}
+};
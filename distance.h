@@ -0,0 +1,416 @@
+#pragma once
+
+#include <thread>
+#include <algorithm>
+
+#include "snapshot.h"
+
+// Signed distance to the walls of a snapshot baked into a two level grid, positive on the left of the
+// closest wall (side 0 of VisibleSets). Coarse cells far from walls keep distances at their corners
+// only, cells crossed by a wall get a brick with brickSamples x brickSamples distance samples and
+// brickCells x brickCells fine cells listing the walls which cross them. distance() interpolates
+// magnitudes at corners of the coarse or sample cell a point is in, so it is off by up to about half a
+// cell where the closest wall changes. rayCast() sphere traces: in empty cells the ray jumps by the distance bound from the
+// nearest corner or to the cell border, whichever is further, in listed cells it casts the listed walls
+// from the original ray start and takes a hit inside the cell. Hits are the ones of the same walls cast
+// by SegmentTable, bit for bit, except exact ties of two walls which may resolve to the other wall.
+// Baked once per snapshot version on all threads.
+//   field.update(snapshot);
+//   float clearance = fabsf(field.distance(point));
+//   traceRay(&field, ray, visitor);
+class DistanceField {
+public:
+	float cellSize = 4.0f;                   // coarse cell, m
+	int brickCells = 2;                      // fine cells along brick side, wall lists of about 8 walls are cast at once
+	int brickSamples = 16;                   // distance samples along brick side
+	uint32 version = 0;                      // of snapshot the field was baked for
+	int threads = 1;
+
+	const SegmentTable* table = nullptr;     // walls of last build
+	b2Vec2 origin = b2Vec2(0, 0);            // lower corner of grid
+	int columns = 0;                         // coarse cells
+	int rows = 0;
+	std::vector<float> coarse;               // distance at coarse corner x + y * (columns + 1)
+	std::vector<int> brick;                  // of coarse cell x + y * columns, -1 for cells no wall crosses
+	std::vector<float> fine;                 // (brickSamples + 1)^2 sample corners per brick
+	SegmentTable cellWalls;                  // walls crossing fine cell k of brick b copied and padded to 8, ascending,
+	std::vector<int> cellStart;              // rows cellStart[b * brickCells^2 + k] .. next
+	std::vector<int> segment;                // cellWalls row -> segment index
+	int bricks = 0;
+	float buildTime = 0;                     // ms
+
+	DistanceField() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	// rebakes field when snapshot is of another version, true if rebaked
+	bool update(const SceneSnapshot* snapshot) {
+		if (snapshot->version == version && table == &snapshot->segments) {
+			return false;
+		}
+		build(&snapshot->segments, &snapshot->tree);
+		version = snapshot->version;
+		return true;
+	}
+
+	void build(const SegmentTable* segments, const SegmentTree* tree) {
+		b2Timer timer;
+		table = segments;
+		coarse.clear();
+		brick.clear();
+		fine.clear();
+		cellWalls.clear();
+		cellStart.clear();
+		segment.clear();
+		bricks = 0;
+		columns = 0;
+		rows = 0;
+
+		b2AABB bounds;
+		bounds.lowerBound = b2Vec2(b2_maxFloat, b2_maxFloat);
+		bounds.upperBound = b2Vec2(-b2_maxFloat, -b2_maxFloat);
+		for (int i = 0;i < segments->count;i++) {
+			bounds.lowerBound = b2Min(bounds.lowerBound, b2Min(segments->start(i), segments->end(i)));
+			bounds.upperBound = b2Max(bounds.upperBound, b2Max(segments->start(i), segments->end(i)));
+		}
+		if (segments->count == 0) {
+			buildTime = timer.GetMilliseconds();
+			return;
+		}
+
+		// one empty cell around walls, so that every ray entering the grid starts far from them
+		origin = bounds.lowerBound - b2Vec2(cellSize, cellSize);
+		columns = (int)ceilf((bounds.upperBound.x - origin.x) / cellSize) + 1;
+		rows = (int)ceilf((bounds.upperBound.y - origin.y) / cellSize) + 1;
+
+		float fineSize = cellSize / brickCells;
+		float sampleSize = cellSize / brickSamples;
+		float coarseReach = reach(cellSize);
+		brick.assign(columns * rows, -1);
+		std::vector<int> near;
+		for (int y = 0;y < rows;y++) {
+			for (int x = 0;x < columns;x++) {
+				b2Vec2 center = corner(x, y) + b2Vec2(0.5f * cellSize, 0.5f * cellSize);
+				query(tree, center, coarseReach, &near);
+				for (int k = 0;k < near.size();k++) {
+					if (segmentDistance(center, near[k]) <= coarseReach) {
+						brick[x + y * columns] = bricks++;
+						break;
+					}
+				}
+			}
+		}
+
+		int corners = brickSamples + 1;
+		int cells = brickCells * brickCells;
+		coarse.assign((columns + 1) * (rows + 1), 0);
+		fine.assign(bricks * corners * corners, 0);
+		std::vector<std::vector<int>> walls(bricks * cells);
+
+		std::vector<std::thread> workers;
+		for (int t = 0;t < threads;t++) {
+			workers.push_back(std::thread([&, t]() {
+				std::vector<int> candidates;
+				for (int y = t;y <= rows;y += threads) {
+					for (int x = 0;x <= columns;x++) {
+						coarse[x + y * (columns + 1)] = nearest(tree, corner(x, y));
+					}
+				}
+
+				// closest wall of a sample corner is at most a brick diagonal from it, so within 3 reaches of center
+				for (int cell = t;cell < columns * rows;cell += threads) {
+					int b = brick[cell];
+					if (b < 0) {
+						continue;
+					}
+					b2Vec2 lower = corner(cell % columns, cell / columns);
+					b2Vec2 half = b2Vec2(0.5f * cellSize, 0.5f * cellSize);
+					query(tree, lower + half, 3 * coarseReach, &candidates);
+					for (int j = 0;j < corners;j++) {
+						for (int i = 0;i < corners;i++) {
+							fine[b * corners * corners + i + j * corners] = signedDistance(lower + b2Vec2(i * sampleSize, j * sampleSize), candidates.data(), (int)candidates.size());
+						}
+					}
+					for (int j = 0;j < brickCells;j++) {
+						for (int i = 0;i < brickCells;i++) {
+							b2Vec2 center = lower + b2Vec2((i + 0.5f) * fineSize, (j + 0.5f) * fineSize);
+							std::vector<int>& list = walls[b * cells + i + j * brickCells];
+							for (int k = 0;k < candidates.size();k++) {
+								if (segmentDistance(center, candidates[k]) <= reach(fineSize)) {
+									list.push_back(candidates[k]);
+								}
+							}
+							std::sort(list.begin(), list.end());
+						}
+					}
+				}
+			}));
+		}
+		for (int t = 0;t < threads;t++) {
+			workers[t].join();
+		}
+
+		// exact copies of x0, y0, dx, dy, so lanes compute the same fractions as over segments
+		cellStart.resize(bricks * cells + 1);
+		for (int k = 0;k < bricks * cells;k++) {
+			cellStart[k] = cellWalls.count;
+			for (int i = 0;i < walls[k].size();i++) {
+				int j = walls[k][i];
+				cellWalls.add(segments->start(j), segments->end(j), segments->material[j], segments->fixture[j], segments->childIndex[j]);
+				cellWalls.dx.back() = segments->dx[j];
+				cellWalls.dy.back() = segments->dy[j];
+				segment.push_back(j);
+			}
+			while (cellWalls.count % 8) {
+				cellWalls.add(b2Vec2_zero, b2Vec2_zero, ReflectWall, nullptr, -1);
+				segment.push_back(-1);
+			}
+		}
+		cellStart[bricks * cells] = cellWalls.count;
+		cellWalls.pad();
+		buildTime = timer.GetMilliseconds();
+	}
+
+	// signed distance to the closest wall, interpolated between corners of coarse or sample cell
+	float distance(b2Vec2 point) const {
+		if (columns == 0) {
+			return b2_maxFloat;
+		}
+		b2Vec2 local = (1 / cellSize) * (point - origin);
+		int x = b2Clamp((int)floorf(local.x), 0, columns - 1);
+		int y = b2Clamp((int)floorf(local.y), 0, rows - 1);
+		local -= b2Vec2((float)x, (float)y);
+		int b = brick[x + y * columns];
+		if (b < 0) {
+			const float* value = &coarse[x + y * (columns + 1)];
+			return bilinear(value[0], value[1], value[columns + 1], value[columns + 2], local.x, local.y);
+		}
+
+		int corners = brickSamples + 1;
+		b2Vec2 sample = (float)brickSamples * local;
+		int si = b2Clamp((int)floorf(sample.x), 0, brickSamples - 1);
+		int sj = b2Clamp((int)floorf(sample.y), 0, brickSamples - 1);
+		const float* value = &fine[b * corners * corners + si + sj * corners];
+		return bilinear(value[0], value[1], value[corners], value[corners + 1], sample.x - si, sample.y - sj);
+	}
+
+	// closest wall crossed by p1->p2 within maxFraction, returns -1 if nothing is hit. Neighbour cells are
+	// stepped by index, so no cell along the ray is skipped by rounding of fractions.
+	int rayCast(b2Vec2 p1, b2Vec2 p2, float maxFraction, float* fraction) const {
+		*fraction = maxFraction;
+		b2Vec2 r = p2 - p1;
+		float length = r.Length();
+		float t, last;
+		if (columns == 0 || length == 0 || !clip(p1, r, maxFraction, &t, &last)) {
+			return -1;
+		}
+
+		float fineSize = cellSize / brickCells;
+		float sampleSize = cellSize / brickSamples;
+		int corners = brickSamples + 1;
+		int stepX = r.x > 0 ? 1 : -1;
+		int stepY = r.y > 0 ? 1 : -1;
+		int x, y, i, j;
+		locate(p1 + t * r, &x, &y, &i, &j);
+		while (t <= last) {
+			b2Vec2 point = p1 + t * r;
+			b2Vec2 lower = corner(x, y);
+			int b = brick[x + y * columns];
+			float bound = 0;
+			float size = b < 0 ? cellSize : fineSize;
+			float exitX, exitY;
+			if (b < 0) {
+				exits(lower, cellSize, p1, r, &exitX, &exitY);
+				int cx = b2Clamp((int)floorf((point.x - lower.x) / cellSize + 0.5f), 0, 1);
+				int cy = b2Clamp((int)floorf((point.y - lower.y) / cellSize + 0.5f), 0, 1);
+				bound = fabsf(coarse[x + cx + (y + cy) * (columns + 1)]) - b2Distance(point, corner(x + cx, y + cy));
+			}
+			else {
+				b2Vec2 fineLower = lower + b2Vec2(i * fineSize, j * fineSize);
+				exits(fineLower, fineSize, p1, r, &exitX, &exitY);
+				int index = b * brickCells * brickCells + i + j * brickCells;
+				if (cellStart[index] < cellStart[index + 1]) {
+					// walls crossing the cell may be hit outside of it, behind the border a wall not listed here may be closer
+					float best;
+					int k = cellWalls.rayCast(p1, p2, maxFraction, &best, cellStart[index], cellStart[index + 1]);
+					if (k >= 0 && best <= b2Min(exitX, exitY)) {
+						*fraction = best;
+						return segment[k];
+					}
+				}
+				else {
+					int si = b2Clamp((int)floorf((point.x - lower.x) / sampleSize + 0.5f), 0, brickSamples);
+					int sj = b2Clamp((int)floorf((point.y - lower.y) / sampleSize + 0.5f), 0, brickSamples);
+					bound = fabsf(fine[b * corners * corners + si + sj * corners]) - b2Distance(point, lower + b2Vec2(si * sampleSize, sj * sampleSize));
+				}
+			}
+
+			// sphere tracing step when it passes the border by half a cell at least, no wall is closer than bound
+			if (bound > (b2Min(exitX, exitY) - t) * length + 0.5f * size) {
+				t += bound / length;
+				locate(p1 + t * r, &x, &y, &i, &j);
+				continue;
+			}
+
+			// neighbour across the border crossed first
+			bool alongX = exitX < exitY;
+			t = b2Max(t, b2Min(exitX, exitY));
+			if (b >= 0) {
+				if (alongX) {
+					i += stepX;
+				}
+				else {
+					j += stepY;
+				}
+				if (i >= 0 && i < brickCells && j >= 0 && j < brickCells) {
+					continue;
+				}
+			}
+			if (alongX) {
+				x += stepX;
+			}
+			else {
+				y += stepY;
+			}
+			if (x < 0 || x >= columns || y < 0 || y >= rows) {
+				return -1;
+			}
+			if (brick[x + y * columns] >= 0) {
+				// entered at the border crossed, other fine coordinate from the crossing point
+				b2Vec2 cell = (1 / fineSize) * (p1 + t * r - corner(x, y));
+				i = alongX ? (stepX > 0 ? 0 : brickCells - 1) : b2Clamp((int)floorf(cell.x), 0, brickCells - 1);
+				j = alongX ? b2Clamp((int)floorf(cell.y), 0, brickCells - 1) : (stepY > 0 ? 0 : brickCells - 1);
+			}
+		}
+		return -1;
+	}
+
+	int64_t memory() const {
+		return (int64_t)(coarse.size() + fine.size() + 4 * cellWalls.x0.size()) * sizeof(float) + (int64_t)(brick.size() + cellStart.size() + segment.size()) * sizeof(int);
+	}
+
+private:
+	b2Vec2 corner(int x, int y) const {
+		return origin + b2Vec2(x * cellSize, y * cellSize);
+	}
+
+	// walls crossing a square cell are within half diagonal of its center
+	static float reach(float size) {
+		return 0.7072f * size + 0.00001f;
+	}
+
+	// magnitudes are interpolated, sign flips where the closest wall changes and is taken from the nearest corner
+	static float bilinear(float c00, float c10, float c01, float c11, float u, float v) {
+		float d = (1 - v) * ((1 - u) * fabsf(c00) + u * fabsf(c10)) + v * ((1 - u) * fabsf(c01) + u * fabsf(c11));
+		float nearest = v < 0.5f ? (u < 0.5f ? c00 : c10) : (u < 0.5f ? c01 : c11);
+		return nearest < 0 ? -d : d;
+	}
+
+	// walls whose leaf boxes overlap square of radius around point
+	static void query(const SegmentTree* tree, b2Vec2 point, float radius, std::vector<int>* walls) {
+		walls->clear();
+		b2AABB box;
+		box.lowerBound = point - b2Vec2(radius, radius);
+		box.upperBound = point + b2Vec2(radius, radius);
+		tree->query(box, [&](int i) {
+			walls->push_back(i);
+		});
+	}
+
+	// signed distance to the closest wall, search square grows until it holds the closest one
+	float nearest(const SegmentTree* tree, b2Vec2 point) const {
+		std::vector<int> walls;
+		for (float radius = cellSize;;radius *= 2) {
+			query(tree, point, radius, &walls);
+			float d = signedDistance(point, walls.data(), (int)walls.size());
+			if (fabsf(d) <= radius || walls.size() == table->count) {
+				return d;
+			}
+		}
+	}
+
+	float segmentDistance(b2Vec2 point, int i) const {
+		b2Vec2 a = table->start(i);
+		b2Vec2 e = b2Vec2(table->dx[i], table->dy[i]);
+		float lengthSquared = e.LengthSquared();
+		if (lengthSquared == 0) {
+			return b2_maxFloat;
+		}
+		float u = b2Clamp(b2Dot(point - a, e) / lengthSquared, 0.0f, 1.0f);
+		return b2Distance(point, a + u * e);
+	}
+
+	// sign is the side of the closest wall, at a shared end the wall whose line is further decides
+	float signedDistance(b2Vec2 point, const int* walls, int count) const {
+		float best = b2_maxFloat;
+		float bestLine = -1;
+		float sign = 1;
+		for (int k = 0;k < count;k++) {
+			int i = walls[k];
+			float d = segmentDistance(point, i);
+			if (d == b2_maxFloat || d > best + 0.000001f) {
+				continue;
+			}
+			b2Vec2 e = b2Vec2(table->dx[i], table->dy[i]);
+			float cross = b2Cross(e, point - table->start(i));
+			float line = fabsf(cross) / e.Length();
+			if (d < best - 0.000001f || line > bestLine) {
+				best = b2Min(best, d);
+				bestLine = line;
+				sign = cross >= 0 ? 1.0f : -1.0f;
+			}
+		}
+		return sign * best;
+	}
+
+	// fractions where p1 + t * r leaves square cell through its vertical and horizontal borders
+	static void exits(b2Vec2 lower, float size, b2Vec2 p1, b2Vec2 r, float* exitX, float* exitY) {
+		*exitX = r.x > 0 ? (lower.x + size - p1.x) / r.x : r.x < 0 ? (lower.x - p1.x) / r.x : b2_maxFloat;
+		*exitY = r.y > 0 ? (lower.y + size - p1.y) / r.y : r.y < 0 ? (lower.y - p1.y) / r.y : b2_maxFloat;
+	}
+
+	// coarse cell of point and fine cell in its brick
+	void locate(b2Vec2 point, int* x, int* y, int* i, int* j) const {
+		b2Vec2 local = (1 / cellSize) * (point - origin);
+		*x = b2Clamp((int)floorf(local.x), 0, columns - 1);
+		*y = b2Clamp((int)floorf(local.y), 0, rows - 1);
+		b2Vec2 cell = (float)brickCells * (local - b2Vec2((float)*x, (float)*y));
+		*i = b2Clamp((int)floorf(cell.x), 0, brickCells - 1);
+		*j = b2Clamp((int)floorf(cell.y), 0, brickCells - 1);
+	}
+
+	// part [t0, t1] of p1 + t * r for t in [0, maxFraction] inside grid
+	bool clip(b2Vec2 p1, b2Vec2 r, float maxFraction, float* t0, float* t1) const {
+		*t0 = 0;
+		*t1 = maxFraction;
+		b2Vec2 upper = corner(columns, rows);
+		for (int axis = 0;axis < 2;axis++) {
+			float o = axis == 0 ? p1.x : p1.y;
+			float d = axis == 0 ? r.x : r.y;
+			float lo = axis == 0 ? origin.x : origin.y;
+			float hi = axis == 0 ? upper.x : upper.y;
+			if (d == 0) {
+				if (o < lo || o > hi) {
+					return false;
+				}
+				continue;
+			}
+			float near = (lo - o) / d;
+			float far = (hi - o) / d;
+			if (near > far) {
+				std::swap(near, far);
+			}
+			*t0 = b2Max(*t0, near);
+			*t1 = b2Min(*t1, far);
+		}
+		return *t0 <= *t1;
+	}
+};
+
+inline void rayCastClosest(const DistanceField* field, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	float fraction;
+	int i = field->rayCast(point1, point2, 1.0f, &fraction);
+	if (i >= 0) {
+		reportSegment(field->table, i, fraction, callback, point1, point2);
+	}
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <thread>
+#include <random>
+#include <cstdint>
+
+#include "trace.h"
+
+// Monte Carlo estimate of the part of a ray fan ending in every absorb container.
+//
+// Walls are partially diffuse: a reflecting wall scatters a ray into a cosine (Lambertian)
+// distribution with probability `diffuse` (or the diffuse part of its material when that is
+// larger), otherwise it mirrors it. With next-event estimation every bounce also casts one
+// shadow ray to a random point of every container opening and scores the probability that
+// the diffuse lobe lands there; a path which then reaches a container by diffuse scattering
+// scores nothing, so both modes estimate the same quantity.
+// Pure mirrors (both diffuse parts 0) leave nothing for next-event estimation to sample.
+class ContainerEstimator {
+public:
+	std::vector<AbsorbContainer> containers;
+	float diffuse = 0.3f;
+	bool nextEvent = true;
+	int maximumReflections = 300;
+	float length = 100;
+	int threads = 1;
+
+	std::vector<double> mean;            // part of fan energy reaching every container
+	std::vector<double> standardError;
+	int64_t rayCasts = 0;
+	int64_t shadowRays = 0;
+
+	ContainerEstimator() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	template <typename World>
+	void trace(World m_world, RayFan fan, int rays, uint32_t seed) {
+		int count = (int)containers.size();
+		std::vector<std::vector<double>> sum(threads, std::vector<double>(count, 0.0));
+		std::vector<std::vector<double>> sumSquares(threads, std::vector<double>(count, 0.0));
+		std::vector<int64_t> casts(threads, 0);
+		std::vector<int64_t> shadows(threads, 0);
+		std::vector<std::thread> workers;
+
+		for (int k = 0;k < threads;k++) {
+			workers.push_back(std::thread([&, k]() {
+				std::mt19937 random = std::mt19937(seed * 7919 + k);
+				std::vector<double> score(count);
+
+				for (int i = k;i < rays;i += threads) {
+					std::fill(score.begin(), score.end(), 0.0);
+					b2Vec2 point = fan.start + ((i + 0.5f) / rays) * (fan.end - fan.start);
+					path(m_world, point, b2Vec2(cos(fan.angle), sin(fan.angle)), random, score.data(), &casts[k], &shadows[k]);
+
+					for (int j = 0;j < count;j++) {
+						sum[k][j] += score[j];
+						sumSquares[k][j] += score[j] * score[j];
+					}
+				}
+			}));
+		}
+		for (int k = 0;k < threads;k++) {
+			workers[k].join();
+		}
+
+		mean.assign(count, 0.0);
+		standardError.assign(count, 0.0);
+		rayCasts = 0;
+		shadowRays = 0;
+		for (int k = 0;k < threads;k++) {
+			for (int j = 0;j < count;j++) {
+				mean[j] += sum[k][j];
+				standardError[j] += sumSquares[k][j];
+			}
+			rayCasts += casts[k];
+			shadowRays += shadows[k];
+		}
+		for (int j = 0;j < count;j++) {
+			mean[j] /= rays;
+			double variance = b2Max(0.0, standardError[j] / rays - mean[j] * mean[j]);
+			standardError[j] = sqrt(variance / rays);
+		}
+	}
+
+	// index of container whose pocket contains point, -1 for other absorbing walls
+	int containerAt(b2Vec2 point) const {
+		for (int i = 0;i < containers.size();i++) {
+			if (containers[i].contains(point)) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+private:
+	template <typename World>
+	void path(World m_world, b2Vec2 point, b2Vec2 direction, std::mt19937& random, double* score, int64_t* casts, int64_t* shadows) const {
+		std::uniform_real_distribution<float> uniform = std::uniform_real_distribution<float>(0.0f, 1.0f);
+		b2Vec2 source = point + 0.01f * direction;
+		bool diffuseBounce = false;
+
+		for (int bounce = 0;bounce <= maximumReflections;bounce++) {
+			RayCastClosestCallback callback = RayCastClosestCallback();
+			rayCastClosest(m_world, &callback, source, source + length * direction);
+			(*casts)++;
+
+			if (!callback.m_hit) {
+				return;
+			}
+
+			b2Vec2 x = callback.m_point;
+			if (materials[callback.m_material].absorb) {
+				int container = containerAt(x);
+				if (container >= 0 && !(nextEvent && diffuseBounce)) {
+					score[container] += 1;
+				}
+				return;
+			}
+
+			b2Vec2 n = callback.m_normal;
+			if (b2Dot(n, direction) > 0) {
+				n = -n;
+			}
+
+			float scatter = b2Max(diffuse, materials[callback.m_material].diffuse);
+			if (nextEvent && scatter > 0) {
+				for (int j = 0;j < containers.size();j++) {
+					score[j] += scatter * connect(m_world, x, n, containers[j], uniform(random), shadows);
+				}
+			}
+
+			if (uniform(random) < scatter) {
+				// cosine distributed direction, sin of angle to normal is uniform in 2D
+				float s = 2 * uniform(random) - 1;
+				b2Vec2 t = b2Vec2(-n.y, n.x);
+				direction = sqrtf(1 - s * s) * n + s * t;
+				diffuseBounce = true;
+			}
+			else {
+				direction = reflect(direction, n);
+				diffuseBounce = false;
+			}
+			source = x + 0.0001f * direction;
+		}
+	}
+
+	// probability that diffuse lobe at x hits container, estimated with one shadow ray to
+	// uniform point y of the opening: length * cos(x) * cos(y) / (2 * distance)
+	template <typename World>
+	float connect(World m_world, b2Vec2 x, b2Vec2 n, const AbsorbContainer& container, float u, int64_t* shadows) const {
+		b2Vec2 y = container.start + u * (container.end - container.start);
+		b2Vec2 r = y - x;
+		float distance = r.Length();
+		if (distance < 0.0001f) {
+			return 0;
+		}
+		float cosX = b2Dot(r, n) / distance;
+		float cosY = -b2Dot(r, container.normal()) / distance;
+		if (cosX <= 0 || cosY <= 0) {
+			return 0;
+		}
+
+		(*shadows)++;
+		RayCastClosestCallback callback = RayCastClosestCallback();
+		rayCastClosest(m_world, &callback, x + 0.0001f * n, y - (0.0001f / distance) * r);
+		if (callback.m_hit) {
+			return 0;
+		}
+		return (container.end - container.start).Length() * cosX * cosY / (2 * distance);
+	}
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
+
+#include "snapshot.h"
+
+// Rays of a fan hitting the same walls in the same order
+class PathFamily {
+public:
+	uint64_t hash;
+	std::vector<int> walls;                  // snapshot segment indices in hit order
+	bool absorbed;                           // last wall absorbs
+	bool trapped;                            // still reflecting after maximumReflections
+	int64_t count = 0;                       // rays
+	float firstT = 1;                        // position range along fan, 0 start .. 1 end
+	float lastT = 0;
+	float minimumAngle = b2_maxFloat;        // range of ray directions
+	float maximumAngle = -b2_maxFloat;
+	int run = 0;                             // longest run of neighbouring rays, representative is its middle ray
+	float representativeT = 0;
+	std::vector<b2Vec2> representative;      // ray start, every hit and escape direction end
+};
+
+// Traced rays grouped into families by wall sequence, memory grows with families and not with rays.
+// Threads trace contiguous blocks of rays and merge runs of neighbours with equal sequences before
+// touching the map, so most rays only compare their sequence with the previous one. The map is split
+// into shards by sequence hash, each with own lock, families with equal hash and other walls share
+// a bucket. Families of more fans or angles accumulate until clear().
+//   families.clear();
+//   families.traceFan(snapshot, fan, rays);        // or families.update(snapshot, fan, rays) every frame
+//   std::vector<const PathFamily*> list = families.sorted();
+class PathFamilies {
+public:
+	int maximumReflections = 300;
+	int threads = 1;
+
+	int64_t rays = 0;                        // since clear()
+	int64_t rayCasts = 0;
+	float traceTime = 0;                     // ms of last traceFan()
+
+	uint32 version = 0;                      // snapshot, fan and rays of last update()
+	RayFan tracedFan = { b2Vec2(0, 0), b2Vec2(0, 0), 0 };
+	int tracedRays = 0;
+
+	PathFamilies() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	void clear() {
+		for (int i = 0;i < shardsCount;i++) {
+			shards[i].buckets.clear();
+			shards[i].families = 0;
+		}
+		rays = 0;
+		rayCasts = 0;
+	}
+
+	// families of fan alone, retraced only when snapshot, fan or rays changed, true if retraced
+	bool update(const SceneSnapshot* snapshot, RayFan fan, int fanRays) {
+		if (snapshot->version == version && fanRays == tracedRays && fan.start == tracedFan.start && fan.end == tracedFan.end && fan.angle == tracedFan.angle) {
+			return false;
+		}
+		clear();
+		traceFan(snapshot, fan, fanRays);
+		version = snapshot->version;
+		tracedFan = fan;
+		tracedRays = fanRays;
+		return true;
+	}
+
+	void traceFan(const SceneSnapshot* snapshot, RayFan fan, int fanRays) {
+		b2Timer timer;
+		std::vector<int64_t> casts(threads, 0);
+		std::vector<std::thread> workers;
+		for (int t = 0;t < threads;t++) {
+			workers.push_back(std::thread([&, t]() {
+				int first = (int)((int64_t)fanRays * t / threads);
+				int last = (int)((int64_t)fanRays * (t + 1) / threads);
+				std::vector<int> walls;
+				std::vector<int> runWalls;
+				std::vector<int> middleWalls;
+				int runFirst = first;
+				for (int i = first;i < last;i++) {
+					casts[t] += path(snapshot, ray(fan, i, fanRays), &walls, nullptr);
+					if (i > first && walls != runWalls) {
+						add(snapshot, fan, fanRays, runWalls, runFirst, i, &middleWalls);
+						runFirst = i;
+					}
+					runWalls.swap(walls);
+				}
+				if (last > first) {
+					add(snapshot, fan, fanRays, runWalls, runFirst, last, &middleWalls);
+				}
+			}));
+		}
+		for (int t = 0;t < threads;t++) {
+			workers[t].join();
+			rayCasts += casts[t];
+		}
+		rays += fanRays;
+		traceTime = timer.GetMilliseconds();
+	}
+
+	int size() const {
+		int count = 0;
+		for (int i = 0;i < shardsCount;i++) {
+			count += shards[i].families;
+		}
+		return count;
+	}
+
+	// largest families first, equal ones by position along fan
+	std::vector<const PathFamily*> sorted() const {
+		std::vector<const PathFamily*> list;
+		for (int i = 0;i < shardsCount;i++) {
+			for (auto it = shards[i].buckets.begin();it != shards[i].buckets.end();it++) {
+				for (int k = 0;k < it->second.size();k++) {
+					list.push_back(&it->second[k]);
+				}
+			}
+		}
+		std::sort(list.begin(), list.end(), [](const PathFamily* a, const PathFamily* b) {
+			return a->count != b->count ? a->count > b->count : a->firstT < b->firstT;
+		});
+		return list;
+	}
+
+	const char* outcome(const PathFamily* family) const {
+		return family->absorbed ? "absorbed" : family->trapped ? "trapped" : "escaped";
+	}
+
+private:
+	static const int shardsCount = 64;
+
+	class Shard {
+	public:
+		std::mutex mutex;
+		std::unordered_map<uint64_t, std::vector<PathFamily>> buckets;
+		int families = 0;
+	};
+
+	Shard shards[shardsCount];
+
+	static Ray ray(RayFan fan, int i, int fanRays) {
+		return Ray(fan.start + ((i + 0.5f) / fanRays) * (fan.end - fan.start), 100, fan.angle);
+	}
+
+	// wall sequence of ray and its polyline when points is not null, returns ray casts
+	int path(const SceneSnapshot* snapshot, Ray r, std::vector<int>* walls, std::vector<b2Vec2>* points) const {
+		walls->clear();
+		r.maximumReflections = maximumReflections;
+		b2Vec2 last = r.from;
+		b2Vec2 exit = b2Vec2(cos(r.angle), sin(r.angle));
+		bool absorbed = false;
+		if (points) {
+			points->assign(1, r.from);
+		}
+		traceRay(snapshot, r, [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			walls->push_back(callback.m_childIndex);
+			absorbed = materials[callback.m_material].absorb;
+			exit = reflect(callback.m_point - source, callback.m_normal);
+			last = callback.m_point;
+			if (points) {
+				points->push_back(callback.m_point);
+			}
+		});
+		bool escaped = !absorbed && (int)walls->size() <= maximumReflections;
+		if (points && escaped) {
+			exit.Normalize();
+			points->push_back(last + r.length * exit);
+		}
+		return (int)walls->size() + escaped;
+	}
+
+	static uint64_t hashOf(const std::vector<int>& walls) {
+		// FNV-1a over bytes of segment indices
+		uint64_t hash = 14695981039346656037ull;
+		for (int k = 0;k < walls.size();k++) {
+			for (int i = 0;i < 4;i++) {
+				hash = (hash ^ (((uint32_t)walls[k] >> (8 * i)) & 0xff)) * 1099511628211ull;
+			}
+		}
+		return hash;
+	}
+
+	// rays first .. last - 1 of fan share walls, middle ray is retraced for its polyline only when the
+	// run beats the representative of the family, under the shard lock into the family's own points
+	void add(const SceneSnapshot* snapshot, RayFan fan, int fanRays, const std::vector<int>& walls, int first, int last, std::vector<int>* middleWalls) {
+		uint64_t hash = hashOf(walls);
+		int middle = (first + last) / 2;
+		float middleT = (middle + 0.5f) / fanRays;
+
+		Shard& shard = shards[hash >> 58];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		std::vector<PathFamily>& bucket = shard.buckets[hash];
+		PathFamily* family = nullptr;
+		for (int k = 0;k < bucket.size();k++) {
+			if (bucket[k].walls == walls) {
+				family = &bucket[k];
+				break;
+			}
+		}
+		if (!family) {
+			bucket.push_back(PathFamily());
+			family = &bucket.back();
+			family->hash = hash;
+			family->walls = walls;
+			family->absorbed = !walls.empty() && materials[snapshot->segments.material[walls.back()]].absorb;
+			family->trapped = !family->absorbed && (int)walls.size() > maximumReflections;
+			shard.families++;
+		}
+
+		family->count += last - first;
+		family->firstT = b2Min(family->firstT, (first + 0.5f) / fanRays);
+		family->lastT = b2Max(family->lastT, (last - 0.5f) / fanRays);
+		family->minimumAngle = b2Min(family->minimumAngle, fan.angle);
+		family->maximumAngle = b2Max(family->maximumAngle, fan.angle);
+		if (last - first > family->run || (last - first == family->run && middleT < family->representativeT)) {
+			family->run = last - first;
+			family->representativeT = middleT;
+			path(snapshot, ray(fan, middle, fanRays), middleWalls, &family->representative);
+		}
+	}
+};
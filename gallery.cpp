@@ -110,7 +110,7 @@ public:
 			*/
 
 			Ray ray = Ray(p[5 + i * 2], 100, goldenAngle(p[5 + i * 2], p[6 + i * 2]), 1);
-			float d = drawRay(m_world, ray, b2Color(0.0, 0.8f, 0));
+			float d = drawBounces<1>(m_world, ray, b2Color(0.0, 0.8f, 0));
 
 			char name[16];
 			snprintf(name, sizeof(name), "%f", d);
@@ -140,42 +140,42 @@ private:
 
 		p[0] = b2Vec2(0,0);
 
-
-		drawLine(body, p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2, 0), p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2, 0));
-
-		
-		drawAbsorbLine(body, p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2, 0), p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2, cubit));
-		drawAbsorbLine(body, p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2, 0), p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2, cubit));
-
 		p[1] = p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2 - cubit, 0);
 		p[2] = p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2 + cubit, 0);
 
-		p[3] = drawAbsorbLine(body, p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2, cubit), p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2 - cubit, cubit));
-		p[4] = drawAbsorbLine(body, p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2, cubit), p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2+cubit, cubit));
-		
-
-		b2Vec2 p0_1 = p[3];
-		b2Vec2 p0_2 = p[4];
+		p[3] = p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2 - cubit, cubit);
+		p[4] = p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2 + cubit, cubit);
 
 		for (int i = 0;i < 8;i++) {
-			
-			b2Vec2 p1 = p[1] + b2Vec2(i * GALLERY_STEP_WIDTH, galleryWallsVertical[i]);
-			b2Vec2 p2 = p[2] + b2Vec2(-i * GALLERY_STEP_WIDTH, galleryWallsVertical[i]);
+			p[5 + i * 2] = p[1] + b2Vec2(i * GALLERY_STEP_WIDTH, galleryWallsVertical[i]);
+			p[6 + i * 2] = p[2] + b2Vec2(-i * GALLERY_STEP_WIDTH, galleryWallsVertical[i]);
+		}
 
-			p[5 + i * 2] = p1;
-			p[6 + i * 2] = p2;
-			
-			drawLine(body, p0_1, p1);
-			drawLine(body, p0_2, p2);
+		// whole section is one closed wall: right corbels up, ceiling, left corbels down and floor
+		ChainPath wall = ChainPath(p[4]);
 
-			if (i < 7) {
-				p0_1 = drawLine(body, p1, p1 + b2Vec2(GALLERY_STEP_WIDTH, 0));
-				p0_2 = drawLine(body, p2, p2 + b2Vec2(-GALLERY_STEP_WIDTH, 0));
+		for (int i = 0;i < 8;i++) {
+			if (i > 0) {
+				wall.lineTo(p[6 + (i - 1) * 2] + b2Vec2(-GALLERY_STEP_WIDTH, 0));
 			}
+			wall.lineTo(p[6 + i * 2]);
+		}
+
+		wall.lineTo(p[19]);
 
+		for (int i = 7;i > 0;i--) {
+			wall.lineTo(p[5 + (i - 1) * 2] + b2Vec2(GALLERY_STEP_WIDTH, 0));
+			wall.lineTo(p[5 + (i - 1) * 2]);
 		}
-		drawLine(body, p[19], p[20]);
 
+		wall.lineTo(p[3]);
+		wall.absorbLineTo(p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2, cubit));
+		wall.absorbLineTo(p[0] + b2Vec2(-GALLERY_FLOOR_WIDTH / 2, 0));
+		wall.lineTo(p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2, 0));
+		wall.absorbLineTo(p[0] + b2Vec2(GALLERY_FLOOR_WIDTH / 2, cubit));
+		wall.absorbLineTo(p[4]);
+
+		wall.draw(body);
 	}
 	
 };
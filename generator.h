@@ -0,0 +1,106 @@
+#pragma once
+
+#include "trace.h"
+
+// Procedural corbelled gallery (longitudinal section) for scaling studies.
+// Floor ascends from origin with beam cutouts, both end walls are corbelled
+// staircases and the ceiling is made of inclined slabs like in Piramid::buildPyramid.
+class CorbelledGallery {
+public:
+	int levels = 7;                        // corbel levels on every end wall
+	int ceilingSteps = 36;                 // ceiling slabs
+	int cutouts = 14;                      // beam cutouts along the floor
+
+	float angle = 0.470322600181172f;      // floor ascending angle
+	float length = 46.12f;                 // floor length
+	float height = 8.74f;                  // vertical height from floor to ceiling
+	float levelOverhang = 0.08f;           // horizontal corbel step of one level
+	float ceilingOffset = 0.3f;            // vertical drop of one ceiling slab
+	float cutoutWidth = 0.18f;
+	float cutoutDepth = 0.18f;
+
+	b2Vec2 origin = b2Vec2(0, 0);          // lower end of the floor
+
+	b2Vec2 floorDirection() const {
+		return b2Vec2(cos(angle), sin(angle));
+	}
+
+	b2Vec2 floorEnd() const {
+		return origin + length * floorDirection();
+	}
+
+	// point inside gallery above the floor middle, used as fan source
+	b2Vec2 center() const {
+		return origin + (length / 2) * floorDirection() + b2Vec2(0, height / 2);
+	}
+
+	// number of edges of the outline, build() creates fewer when levels or cutouts get shorter than b2_linearSlop
+	int edgesCount() const {
+		return 1 + 4 * cutouts + 4 * levels + 2 * ceilingSteps;
+	}
+
+	// creates gallery walls on body (b2Body* or any target of ChainPath::draw()), returns number of created edges,
+	// compare with edgesCount() to see if some features merged.
+	// Cutouts and ceiling slabs are repeated shapes, instancing targets store each of them once.
+	template <typename Body>
+	int build(Body* body) const {
+		int edges = 0;
+		b2Vec2 f = floorDirection();
+		b2Vec2 down = b2Vec2(sin(angle), -cos(angle));
+		b2Vec2 end = floorEnd();
+
+		float levelHeight = height / levels;
+		// corbels of both walls must not overlap
+		float overhang = b2Min(levelOverhang, (end.x - origin.x) / (4 * levels));
+		b2Vec2 upperTop;
+
+		// floor with beam cutouts continued by upper wall, cutout bottoms absorb like gallery beams in Absorb mode
+		{
+			float stepSize = length / (cutouts + 1);
+			float width = b2Min(cutoutWidth, stepSize / 2);
+			ChainPath floor = ChainPath(origin);
+
+			// cutout followed by floor up to the next one
+			b2Vec2 cutout[4] = { cutoutDepth * down, width * f, -cutoutDepth * down, (stepSize - width) * f };
+			int cutoutMaterials[4] = { ReflectWall, AbsorbWall, ReflectWall, ReflectWall };
+
+			if (cutouts > 0) {
+				floor.lineTo(origin + (stepSize - width / 2) * f);
+				floor.repeat(cutout, cutoutMaterials, 4, cutouts - 1);
+				floor.repeat(cutout, cutoutMaterials, 3, 1);
+			}
+			floor.lineTo(end);
+
+			// corbels step towards lower end
+			for (int i = 0;i < levels;i++) {
+				b2Vec2 p1 = floor.lineTo(floor.current() + b2Vec2(0, levelHeight));
+				floor.lineTo(p1 + b2Vec2(-overhang, 0));
+			}
+			upperTop = floor.current();
+			edges += floor.draw(body);
+		}
+
+		// lower wall, corbels step towards upper end, continued by ceiling slabs
+		{
+			ChainPath wall = ChainPath(origin);
+			for (int i = 0;i < levels;i++) {
+				b2Vec2 p1 = wall.lineTo(wall.current() + b2Vec2(0, levelHeight));
+				wall.lineTo(p1 + b2Vec2(overhang, 0));
+			}
+
+			// every slab drops by ceilingOffset and next one starts from a riser
+			b2Vec2 lowerTop = wall.current();
+			b2Vec2 d = upperTop - lowerTop;
+			float run = b2Dot(d, f) / ceilingSteps;
+			float rise = -b2Dot(d, down) / ceilingSteps;
+
+			b2Vec2 slab[2] = { run * f + ceilingOffset * down, -(ceilingOffset + rise) * down };
+			wall.repeat(slab, nullptr, 2, ceilingSteps - 1);
+			wall.lineTo(wall.current() + slab[0]);
+			wall.lineTo(upperTop);
+			edges += wall.draw(body);
+		}
+
+		return edges;
+	}
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <unordered_map>
+#include <cstdint>
+
+#include "trace.h"
+
+// One traced ray touching a wall
+class HitRecord {
+public:
+	int32 ray;             // index into HitIndex::rays
+	int32 bounce;          // 0 for the first wall hit by the ray
+	float pathLength;      // from ray start to hit point
+};
+
+// One wall: chain edge of fixture, or null fixture and segment index for SceneSnapshot hits
+class WallKey {
+public:
+	const b2Fixture* fixture;
+	int32 childIndex;
+
+	bool operator==(const WallKey& other) const {
+		return fixture == other.fixture && childIndex == other.childIndex;
+	}
+};
+
+class WallKeyHash {
+public:
+	size_t operator()(const WallKey& key) const {
+		return std::hash<uint64_t>()((uint64_t)(uintptr_t)key.fixture ^ ((uint64_t)(uint32_t)key.childIndex * 0x9e3779b97f4a7c15ull));
+	}
+};
+
+// Index from wall to every recorded hit, filled while rays are traced so "which rays hit this wall"
+// never rescans paths or other edges of the same chain. Records of one wall are kept in ray order,
+// 12 bytes each.
+class HitIndex {
+public:
+	std::vector<Ray> rays;
+	std::unordered_map<WallKey, std::vector<HitRecord>, WallKeyHash> hits;
+	int64_t records = 0;
+
+	// forgets all rays, keeps allocated record arrays for the next frame
+	void clear() {
+		rays.clear();
+		for (auto& entry : hits) {
+			entry.second.clear();
+		}
+		records = 0;
+	}
+
+	// traceRay() which records every hit, returns ray index
+	template <typename World, typename Visitor>
+	int trace(World m_world, Ray ray, Visitor visit) {
+		int index = (int)rays.size();
+		rays.push_back(ray);
+
+		float length = 0;
+		traceRay(m_world, ray, [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			length += (callback.m_point - source).Length();
+			add(callback.m_fixture, callback.m_childIndex, index, reflection, length);
+			visit(source, callback, reflection);
+		});
+		return index;
+	}
+
+	void add(const b2Fixture* fixture, int childIndex, int ray, int bounce, float pathLength) {
+		HitRecord record;
+		record.ray = ray;
+		record.bounce = bounce;
+		record.pathLength = pathLength;
+		hits[WallKey{ fixture, childIndex }].push_back(record);
+		records++;
+	}
+
+	// records of chain edge childIndex of fixture, of segment childIndex for SceneSnapshot hits
+	const std::vector<HitRecord>& hitsOf(const b2Fixture* fixture, int childIndex) const {
+		static const std::vector<HitRecord> none;
+		auto found = hits.find(WallKey{ fixture, childIndex });
+		return found == hits.end() ? none : found->second;
+	}
+
+	// rays with at least one hit of the wall, in increasing order
+	std::vector<int> raysHitting(const b2Fixture* fixture, int childIndex) const {
+		std::vector<int> result;
+		const std::vector<HitRecord>& records = hitsOf(fixture, childIndex);
+		for (int i = 0;i < records.size();i++) {
+			if (result.empty() || result.back() != records[i].ray) {
+				result.push_back(records[i].ray);
+			}
+		}
+		return result;
+	}
+
+	int64_t memory() const {
+		int64_t bytes = (int64_t)rays.capacity() * sizeof(Ray);
+		for (auto& entry : hits) {
+			bytes += (int64_t)entry.second.capacity() * sizeof(HitRecord);
+		}
+		return bytes;
+	}
+};
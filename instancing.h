@@ -0,0 +1,334 @@
+#pragma once
+
+#include "snapshot.h"
+
+// Shape stored once in its own coordinates with local acceleration structure
+class ShapePrototype {
+public:
+	SegmentTable segments;
+	SegmentTree tree;
+	std::vector<b2Vec2> vertices;      // chain the shape was built from, to recognize repeated shapes
+	std::vector<int> materials;
+	b2AABB box;
+
+	bool same(const b2Vec2* shapeVertices, const int* shapeMaterials, int count) const {
+		if (count != vertices.size()) {
+			return false;
+		}
+		for (int i = 0;i < count;i++) {
+			if (vertices[i].x != shapeVertices[i].x || vertices[i].y != shapeVertices[i].y) {
+				return false;
+			}
+			if (i + 1 < count && materials[i] != shapeMaterials[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// Copy of prototype placed by rigid transform
+class ShapeInstance {
+public:
+	int prototype;
+	b2Transform xf;
+	int first;                         // m_childIndex of the first prototype segment
+};
+
+// Two level scene: walls drawn once are kept in a flat table, repeated shapes (ChainPath::repeat(),
+// drawInstance()) become instances of shared prototypes under a top level tree over instance bounds.
+// Memory and build time grow with distinct shapes, not with copies. Like SceneSnapshot, hits report
+// null m_fixture; m_childIndex numbers flat segments first and then segments of every instance.
+//   InstancedScene scene;
+//   model.build(&scene);
+//   scene.finish();
+class InstancedScene {
+public:
+	SegmentTable segments;             // walls which are not instanced
+	SegmentTree tree;
+	std::vector<ShapePrototype> prototypes;
+	std::vector<ShapeInstance> instances;
+	std::vector<SegmentTree::Node> nodes;  // top level tree, leaves own ranges of instanceOrder
+	std::vector<int> instanceOrder;
+	int count = 0;                     // segments of scene with all instances expanded
+
+	void clear() {
+		segments.clear();
+		tree.nodes.clear();
+		prototypes.clear();
+		instances.clear();
+		nodes.clear();
+		instanceOrder.clear();
+		count = 0;
+	}
+
+	// finds equal prototype or adds a new one, materials[i] is material of edge vertices[i] -> vertices[i + 1]
+	int prototype(const b2Vec2* vertices, const int* materials, int vertexCount) {
+		for (int i = 0;i < prototypes.size();i++) {
+			if (prototypes[i].same(vertices, materials, vertexCount)) {
+				return i;
+			}
+		}
+
+		prototypes.push_back(ShapePrototype());
+		ShapePrototype& shape = prototypes.back();
+		shape.vertices.assign(vertices, vertices + vertexCount);
+		shape.materials.assign(materials, materials + vertexCount - 1);
+		shape.box.lowerBound = b2Vec2(b2_maxFloat, b2_maxFloat);
+		shape.box.upperBound = b2Vec2(-b2_maxFloat, -b2_maxFloat);
+		for (int i = 0;i < vertexCount;i++) {
+			shape.box.lowerBound = b2Min(shape.box.lowerBound, vertices[i]);
+			shape.box.upperBound = b2Max(shape.box.upperBound, vertices[i]);
+			if (i + 1 < vertexCount) {
+				drawChain(&shape.segments, &vertices[i], 2, materials[i]);
+			}
+		}
+		shape.segments.pad();
+		shape.tree.build(&shape.segments);
+		return (int)prototypes.size() - 1;
+	}
+
+	void instance(int shape, const b2Transform& xf) {
+		ShapeInstance copy;
+		copy.prototype = shape;
+		copy.xf = xf;
+		copy.first = 0;
+		instances.push_back(copy);
+	}
+
+	// world bounds of rotated prototype box
+	b2AABB bounds(const ShapeInstance& copy) const {
+		const b2AABB& local = prototypes[copy.prototype].box;
+		b2Vec2 corners[4] = {
+			local.lowerBound,
+			b2Vec2(local.upperBound.x, local.lowerBound.y),
+			local.upperBound,
+			b2Vec2(local.lowerBound.x, local.upperBound.y)
+		};
+		b2AABB box;
+		box.lowerBound = b2Vec2(b2_maxFloat, b2_maxFloat);
+		box.upperBound = b2Vec2(-b2_maxFloat, -b2_maxFloat);
+		for (int i = 0;i < 4;i++) {
+			b2Vec2 p = b2Mul(copy.xf, corners[i]);
+			box.lowerBound = b2Min(box.lowerBound, p);
+			box.upperBound = b2Max(box.upperBound, p);
+		}
+		return box;
+	}
+
+	// call after the last wall is drawn
+	void finish() {
+		segments.pad();
+		tree.build(&segments);
+
+		count = segments.count;
+		for (int i = 0;i < instances.size();i++) {
+			instances[i].first = count;
+			count += prototypes[instances[i].prototype].segments.count;
+		}
+
+		nodes.clear();
+		instanceOrder.resize(instances.size());
+		std::iota(instanceOrder.begin(), instanceOrder.end(), 0);
+		if (!instances.empty()) {
+			boxes.resize(instances.size());
+			for (int i = 0;i < instances.size();i++) {
+				boxes[i] = bounds(instances[i]);
+			}
+			nodes.reserve(2 * instances.size() / leafSize + 1);
+			split(0, (int)instances.size());
+			boxes.clear();
+			boxes.shrink_to_fit();
+		}
+	}
+
+	// segments really stored, flat walls and one copy of every prototype
+	int storedCount() const {
+		int stored = segments.count;
+		for (int i = 0;i < prototypes.size();i++) {
+			stored += prototypes[i].segments.count;
+		}
+		return stored;
+	}
+
+	int64_t memory() const {
+		int64_t bytes = tableMemory(&segments) + (int64_t)tree.nodes.capacity() * sizeof(SegmentTree::Node);
+		for (int i = 0;i < prototypes.size();i++) {
+			bytes += tableMemory(&prototypes[i].segments) + (int64_t)prototypes[i].tree.nodes.capacity() * sizeof(SegmentTree::Node);
+		}
+		bytes += (int64_t)instances.capacity() * sizeof(ShapeInstance);
+		bytes += (int64_t)nodes.capacity() * sizeof(SegmentTree::Node) + (int64_t)instanceOrder.capacity() * sizeof(int);
+		return bytes;
+	}
+
+	// closest hit of point1 -> point2, returns false if nothing is hit
+	bool rayCast(b2Vec2 point1, b2Vec2 point2, RayCastClosestCallback* callback) const {
+		b2Vec2 r = point2 - point1;
+		float best = 1.0f;
+		float fraction;
+		int bestSegment = tree.rayCast(&segments, point1, point2, best, &fraction);
+		int bestInstance = -1;
+		if (bestSegment >= 0) {
+			best = fraction;
+		}
+
+		int stack[64];
+		int top = 0;
+		if (!nodes.empty()) {
+			stack[top++] = 0;
+		}
+
+		while (top > 0) {
+			const SegmentTree::Node& node = nodes[stack[--top]];
+			if (!SegmentTree::crossesBox(node.box, point1, r, best)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (int j = node.first;j < node.first + node.count;j++) {
+					// fractions do not change under rigid transform, prototype tree tests instance bounds
+					const ShapeInstance& copy = instances[instanceOrder[j]];
+					const ShapePrototype& shape = prototypes[copy.prototype];
+					int i = shape.tree.rayCast(&shape.segments, b2MulT(copy.xf, point1), b2MulT(copy.xf, point2), best, &fraction);
+					if (i >= 0) {
+						best = fraction;
+						bestSegment = i;
+						bestInstance = instanceOrder[j];
+					}
+				}
+			}
+			else {
+				stack[top++] = node.right;
+				stack[top++] = node.left;
+			}
+		}
+
+		if (bestSegment < 0) {
+			return false;
+		}
+		if (bestInstance < 0) {
+			reportSegment(&segments, bestSegment, best, callback, point1, point2);
+			callback->m_childIndex = bestSegment;
+			callback->m_fixture = nullptr;
+			return true;
+		}
+
+		const ShapeInstance& copy = instances[bestInstance];
+		const SegmentTable& local = prototypes[copy.prototype].segments;
+		callback->m_hit = true;
+		callback->m_point = point1 + best * r;
+		callback->m_normal = b2Mul(copy.xf.q, local.normal(bestSegment, b2MulT(copy.xf.q, r)));
+		callback->m_fixture = nullptr;
+		callback->m_childIndex = copy.first + bestSegment;
+		callback->m_material = local.material[bestSegment];
+		return true;
+	}
+
+private:
+	const int leafSize = 4;
+	std::vector<b2AABB> boxes;         // instance bounds while the top level tree is built
+
+	static int64_t tableMemory(const SegmentTable* table) {
+		return (int64_t)table->x0.capacity() * 4 * sizeof(float) + (int64_t)table->material.capacity() * sizeof(uint8) +
+			(int64_t)table->fixture.capacity() * sizeof(b2Fixture*) + (int64_t)table->childIndex.capacity() * sizeof(int32);
+	}
+
+	// same median split as SegmentTree over instance bounds
+	int split(int first, int count) {
+		int index = (int)nodes.size();
+		nodes.push_back(SegmentTree::Node());
+
+		b2AABB box = boxes[instanceOrder[first]];
+		b2Vec2 lower = box.GetCenter();
+		b2Vec2 upper = lower;
+		for (int j = first;j < first + count;j++) {
+			const b2AABB& instanceBox = boxes[instanceOrder[j]];
+			box.Combine(instanceBox);
+			lower = b2Min(lower, instanceBox.GetCenter());
+			upper = b2Max(upper, instanceBox.GetCenter());
+		}
+		nodes[index].box = box;
+
+		if (count <= leafSize) {
+			nodes[index].first = first;
+			nodes[index].count = count;
+			return index;
+		}
+
+		bool alongX = upper.x - lower.x >= upper.y - lower.y;
+		int half = count / 2;
+		std::nth_element(instanceOrder.begin() + first, instanceOrder.begin() + first + half, instanceOrder.begin() + first + count, [&](int a, int b) {
+			return alongX ? boxes[a].GetCenter().x < boxes[b].GetCenter().x : boxes[a].GetCenter().y < boxes[b].GetCenter().y;
+		});
+
+		int left = split(first, half);
+		int right = split(first + half, count - half);
+		nodes[index].left = left;
+		nodes[index].right = right;
+		return index;
+	}
+};
+
+inline int drawChain(InstancedScene* scene, const b2Vec2* vertices, int count, int material) {
+	return drawChain(&scene->segments, vertices, count, material);
+}
+
+inline int drawEdges(InstancedScene* scene, const b2Vec2* vertices, int count, int material) {
+	return drawChain(&scene->segments, vertices, count, material);
+}
+
+// pieces of INSTANCE_MAX_VERTICES like drawInstance(Body*, ...), every piece is a prototype of its own
+inline int drawInstance(InstancedScene* scene, const b2Vec2* vertices, int count, int material, const b2Transform& xf) {
+	int pieceMaterials[INSTANCE_MAX_VERTICES];
+	for (int i = 0;i < INSTANCE_MAX_VERTICES;i++) {
+		pieceMaterials[i] = material;
+	}
+
+	int edges = 0;
+	for (int first = 0;first + 1 < count;first += INSTANCE_MAX_VERTICES - 1) {
+		int pieceCount = b2Min(count - first, INSTANCE_MAX_VERTICES);
+		int shape = scene->prototype(&vertices[first], pieceMaterials, pieceCount);
+		scene->instance(shape, xf);
+		edges += scene->prototypes[shape].segments.count;
+	}
+	return edges;
+}
+
+// flat runs of chain go to the table, every copy of a repeated run becomes an instance
+template <>
+inline int ChainPath::draw<InstancedScene>(InstancedScene* scene) const {
+	int created = 0;
+	int start = 0;
+	int edges = (int)edgeMaterials.size();
+
+	for (int r = 0;r <= repeats.size();r++) {
+		int end = r < repeats.size() ? repeats[r].firstEdge : edges;
+		int first = start;
+		for (int i = start + 1;i <= end;i++) {
+			if (i == end || edgeMaterials[i] != edgeMaterials[first]) {
+				if (first < end) {
+					created += drawChain(scene, &vertices[first], i - first + 1, edgeMaterials[first]);
+				}
+				first = i;
+			}
+		}
+		if (r == repeats.size()) {
+			break;
+		}
+
+		const Repeat& run = repeats[r];
+		std::vector<b2Vec2> local;
+		local.push_back(b2Vec2(0, 0));
+		local.insert(local.end(), run.local.begin(), run.local.end());
+		int shape = scene->prototype(local.data(), run.edgeMaterials.data(), (int)local.size());
+		for (int k = 0;k < run.times;k++) {
+			scene->instance(shape, b2Transform(vertices[run.firstEdge] + (float)k * run.period, b2Rot(0)));
+		}
+		created += scene->prototypes[shape].segments.count * run.times;
+		start = run.firstEdge + (int)run.local.size() * run.times;
+	}
+	return created;
+}
+
+inline void rayCastClosest(const InstancedScene* scene, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	scene->rayCast(point1, point2, callback);
+}
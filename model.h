@@ -0,0 +1,652 @@
+#pragma once
+
+// Pyramid walls without any testbed dependencies, shared by the Pyramid test and headless tools.
+// measurements            https://www.ronaldbirdsall.com/gizeh/petrie/c7.html#36
+// grand gallery           http://www.palarch.nl/wp-content/miatello_l_examining_the_grand_gallery_in_the_pyramd_of_khufu_and_its_features_pjaee_7_6_2010.pdf
+
+#include "trace.h"
+
+#define WIDTH (c / (PI*(sqrt(2)-1)))/1000000                                 // Pyramid width  = 230,380923883861
+#define HEIGHT WIDTH * 14 / 22                                               // Pyramid height = 146,606042471548
+
+#define SIDE                               sqrt(WIDTH*WIDTH+HEIGHT*HEIGHT)   // pyramid side
+#define VERTICAL_ANGLE                     atan(WIDTH/(2*HEIGHT))            // from top to side angle
+
+#define KINGS_CHAMBER_LEVEL                HEIGHT*(1-1/sqrt(2))
+
+#define QUEEN_CHAMBER_ROOF_ANGLE           PI / 6
+#define QUEEN_CHAMBER_HEIGHT               6.26f
+#define QUEEN_CHAMBER_WIDTH                10 * cubit
+#define QUEEN_CHAMBER_CENTER_LEVEL         (0.88f+0.83f)
+#define QUEEN_CHAMBER_SMALLEST_BORDER      0.03f
+
+#define KING_CHAMBER_HEIGHT                10 * cubit
+#define KING_CHAMBER_WIDTH                 10 * sqrt(5) * cubit / 2
+
+#define GALLERY_CEILING_FIRST_STEP_WIDTH   0.37f
+
+#define GALLERY_HOLE_SHORT_DEPTH           0.18f
+#define GALLERY_HOLE_LONG_DEPTH            0.18f
+#define GALLERY_HOLE_SHORT_WIDTH_MUL       1/6.526f      // coefficient
+#define GALLERY_HOLE_LONG_WIDTH_MUL        1.13f/6.526f  // coefficient
+#define GALLERY_HOLES_SPACE_MUL            2.198f/6.526f // coefficient
+
+#define GALLERY_NICHE_HEIGH_MUL            1.15f         // coefficient
+#define GALLERY_NICHE_WIDTH_MUL            0.53f         // coefficient
+
+
+
+constexpr auto shem = 6 * cubit / 5;
+
+constexpr auto border0_bottom = 0.03f;
+constexpr auto border0_top = 0.11f;
+
+// entrance angle https://planetcalc.ru/71/
+constexpr auto angle0 = 0.470322600181172;      //2656'51"  = 0.470322600181172  
+
+constexpr auto defaultAscendingAngle = 0.470322600181172;      //2656'51"  = 0.470322600181172
+constexpr auto defaultDescendingAngle = 0.46157171323714485;   //2626'46"
+constexpr auto defaultAngleRange =  PI / 180;
+
+inline b2Vec2 crossPoint(b2Vec2 p1, b2Vec2 p2, b2Vec2 p3, b2Vec2 p4) {
+	return b2Vec2(
+		((p1.x * p2.y - p1.y * p2.x) * (p3.x - p4.x) - (p1.x - p2.x) * (p3.x * p4.y - p3.y * p4.x)) / ((p1.x - p2.x) * (p3.y - p4.y) - (p1.y - p2.y) * (p3.x - p4.x)),
+		((p1.x * p2.y - p1.y * p2.x) * (p3.y - p4.y) - (p1.y - p2.y) * (p3.x * p4.y - p3.y * p4.x)) / ((p1.x - p2.x) * (p3.y - p4.y) - (p1.y - p2.y) * (p3.x - p4.x))
+	);
+}
+
+enum GalleryWallsMode
+{
+	Horizontal,
+	Parallel
+};
+
+enum MaterialType
+{
+	Transparent,
+	Reflect,
+	Absorb
+};
+
+// gallery wall levels are read from a drawing in these units
+constexpr auto galleryDrawingScale = 4.22f / 166.2f;
+
+// Surveyed sizes used by PyramidModel::build(), in meters. visit(name, value, tolerance) lists
+// every one of them with its survey tolerance (half width of uniform error), so tools can perturb them.
+class Measurements {
+public:
+	float descendingToCrossing = 28.21f;      // p[9] -> p[8] along descending corridor
+	float descendingLength = 77.13f;          // p[8] -> p[13]
+	float ascendingLength = 39.28f;           // p[8] -> p[16]
+	float corridorHeight = 1.2f;              // perpendicular to corridor floor
+	float galleryLength = 46.12f;             // p[16] -> p[23]
+	float greatStep = 1.73f;                  // p[23] -> p[24]
+	float galleryHeight = 8.74f;              // p[51] -> p[52]
+	float galleryCeilingHeight = 8.48f;       // p[61] -> p[54] when ceiling is not parallel to floor
+	float kingPassage = 6.83f;                // p[48] -> King chamber wall
+	float queenPassage = 33.2f;               // p[16] -> p[40] horizontally
+	float lowerChamberLength = 8.36f;
+	float lowerChamberHeight = 2.19f + 0.91f;
+
+	// http://thegreatpyramidofgiza.ca/@Giza$Grand%20Gallery$Chapter_files/image003.jpg
+	float galleryWallsVertical[7] = {
+		89.9f * galleryDrawingScale,
+		129.9f * galleryDrawingScale,
+		166.2f * galleryDrawingScale,
+		211.7f * galleryDrawingScale,
+		245.4f * galleryDrawingScale,
+		278.7f * galleryDrawingScale,
+		312.4f * galleryDrawingScale };
+
+	template <typename Visitor>
+	void visit(Visitor visitor) {
+		visitor("descending to crossing", descendingToCrossing, 0.03f);
+		visitor("descending length", descendingLength, 0.05f);
+		visitor("ascending length", ascendingLength, 0.03f);
+		visitor("corridor height", corridorHeight, 0.01f);
+		visitor("gallery length", galleryLength, 0.03f);
+		visitor("great step", greatStep, 0.01f);
+		visitor("gallery height", galleryHeight, 0.03f);
+		visitor("gallery ceiling height", galleryCeilingHeight, 0.03f);
+		visitor("King passage", kingPassage, 0.02f);
+		visitor("Queen passage", queenPassage, 0.05f);
+		visitor("lower chamber length", lowerChamberLength, 0.03f);
+		visitor("lower chamber height", lowerChamberHeight, 0.03f);
+		// levels are read from a drawing, one drawing unit
+		for (int i = 0;i < 7;i++) {
+			visitor("gallery wall level", galleryWallsVertical[i], galleryDrawingScale);
+		}
+	}
+};
+
+class PyramidModel {
+public:
+	// control parameters
+	float ascendingAngle = defaultAscendingAngle;
+	float descendingAngle = defaultDescendingAngle;
+
+	bool ceilingParallelToFloor = true;
+	float galleryCeilingOffset = 1;
+	int leftGalleryWallMode  = Horizontal;      // http://thepyramids.org/images/giza/231_026_great_pyramid.jpg
+	int rightGalleryWallMode = Parallel;
+
+	int galleryBeamsMode = Absorb;
+
+	bool graniteKingChamber = false;            // King chamber walls reflect with granite spectrum instead of mirror
+	bool inputPrism = false;                    // glass prism in input fan just after it leaves descending corridor
+	bool limestoneWalls = false;                // gallery and Queen chamber mirrors are rough limestone (DiffuseWall)
+	bool movingParts = false;                   // build() leaves out gallery ceiling and King chamber block, see buildGalleryCeiling()
+	float kingChamberBlockLift = 0;             // entrance block raised above its place, m
+
+	Measurements measured;
+
+	b2Vec2 p[92];
+	std::vector<AbsorbContainer> containers;      // filled by build()
+
+	// light entering lower chamber through descending corridor, valid after build()
+	RayFan inputFan() const {
+		RayFan fan;
+		fan.start = p[14] + border0_top * b2Vec2(sin(descendingAngle), -cos(descendingAngle));
+		fan.end = p[13] + border0_bottom * b2Vec2(-sin(descendingAngle), cos(descendingAngle));
+		fan.angle = angle0 + PI;
+		return fan;
+	}
+
+	// light from Queen chamber floor, valid after build()
+	RayFan queenFan(float angle) const {
+		RayFan fan;
+		fan.start = p[39];
+		fan.end = p[42];
+		fan.angle = angle;
+		return fan;
+	}
+
+	// vertical receiver line through the middle of King chamber, valid after build()
+	void kingChamberSection(b2Vec2* a, b2Vec2* b) const {
+		float x = p[48].x - measured.kingPassage - KING_CHAMBER_WIDTH / 2;
+		*a = b2Vec2(x, p[48].y + 0.01f);
+		*b = b2Vec2(x, p[48].y + KING_CHAMBER_HEIGHT - 0.01f);
+	}
+
+	// vertical receiver line through the middle of lower chamber, valid after build()
+	void lowerChamberSection(b2Vec2* a, b2Vec2* b) const {
+		float x = p[88].x + measured.lowerChamberLength / 2;
+		*a = b2Vec2(x, p[88].y + 0.01f);
+		*b = b2Vec2(x, p[88].y + measured.lowerChamberHeight - 0.01f);
+	}
+
+	// mouth of descending corridor in north face, floor to roof, valid after build()
+	void descendingEntrance(b2Vec2* a, b2Vec2* b) const {
+		*a = p[11];
+		*b = p[12];
+	}
+
+	// line across the bottom of descending corridor where inputFan() starts, valid after build()
+	void descendingBottom(b2Vec2* a, b2Vec2* b) const {
+		*a = p[13];
+		*b = p[14];
+	}
+
+	// line across the top of ascending corridor where gallery starts, valid after build()
+	void galleryEntrance(b2Vec2* a, b2Vec2* b) const {
+		*a = p[16];
+		*b = p[18];
+	}
+
+	// stepped gallery ceiling from p[52] to p[54] appended to chain, valid after build()
+	void galleryCeiling(ChainPath* chain) const {
+		if (galleryCeilingOffset != 0) {
+			float numberOfSteps = 36;
+			float stepWidth = (sqrt((p[52] - p[85]).LengthSquared()) - GALLERY_CEILING_FIRST_STEP_WIDTH) / numberOfSteps;
+			//float numberOfSteps = ceil(((sqrt((p[52] - p[85]).LengthSquared()) - GALLERY_CEILING_FIRST_STEP_WIDTH) / 1.2f));
+			float angle = atan2(p[52].y - p[85].y, p[85].x - p[52].x);
+			float stepHight = sqrt((p[84] - p[52]).LengthSquared()) / numberOfSteps;
+
+			// step corners lie on a line, so all steps are copies of the first one
+			b2Vec2 corner[2];
+			for (int i = 0;i < 2;i++) {
+				b2Vec2 p1 = p[52] + (GALLERY_CEILING_FIRST_STEP_WIDTH + stepWidth * i) * b2Vec2(cos(angle), -sin(angle));
+				b2Vec2 p2 = p[84] + (GALLERY_CEILING_FIRST_STEP_WIDTH + stepWidth * i) * b2Vec2(cos(angle), -sin(angle));
+				b2Vec2 p3 = p[52] + (stepHight * i) * b2Vec2(sin(angle), cos(angle));
+				b2Vec2 p4 = p[85] + (stepHight * i) * b2Vec2(sin(angle), cos(angle));
+				corner[i] = crossPoint(p1, p2, p3, p4);
+			}
+			b2Vec2 riser = stepHight * b2Vec2(sin(angle), cos(angle));
+			b2Vec2 step[2] = { riser, corner[1] - corner[0] - riser };
+
+			chain->lineTo(corner[0]);
+			chain->repeat(step, nullptr, 2, (int)numberOfSteps - 1);
+			chain->lineTo(chain->current() + riser);
+		}
+		chain->lineTo(p[54]);
+	}
+
+	// gallery ceiling on a body of its own, for movingParts. Recomputes p[84] and p[85], so after
+	// galleryCeilingOffset changed it replaces the ceiling of build() without building anything else.
+	template <typename Body>
+	void buildGalleryCeiling(Body* body) {
+		placeGalleryCeiling();
+		ChainPath ceiling = ChainPath(p[52]);
+		galleryCeiling(&ceiling);
+		if (limestoneWalls) {
+			ceiling.replaceMaterial(ReflectWall, DiffuseWall);
+		}
+		ceiling.draw(body);
+	}
+
+	// entrance block of King chamber, its lower right corner at position
+	template <typename Body>
+	void buildKingChamberBlock(Body* body, b2Vec2 position) const {
+		NextTo KingChamberBlock[5]{
+			b2Vec2(0,1.33f),
+			b2Vec2(-0.39f,0),
+			b2Vec2(0,-1.33f),
+			b2Vec2(0.39f,0),
+			b2Vec2(0,0)
+		};
+
+		drawPath(body, position, KingChamberBlock);
+	}
+
+	// where build() puts lower right corner of the block, a moving block has its body there
+	b2Vec2 kingChamberBlockPosition() const {
+		return p[50] + b2Vec2(-1.24f - 0.54f, kingChamberBlockLift);
+	}
+
+	// creates all walls on body and fills p[]. Body is b2Body* or any target with drawChain() overload,
+	// SegmentTable* gets the walls directly without b2World.
+	template <typename Body>
+	void build(Body* body) {
+		containers.clear();
+
+		
+		// main points
+		p[0] = b2Vec2(0, 0);
+		p[1] = p[0] + b2Vec2(0, HEIGHT);
+		p[2] = p[0] + b2Vec2(WIDTH / 2, 0);
+		p[3] = p[0] + HEIGHT * (b2Vec2(0, 1) + b2Vec2(sin(2 * VERTICAL_ANGLE), -cos(2 * VERTICAL_ANGLE)));
+		p[4] = p[3] + b2Vec2(0, -HEIGHT);
+		p[5] = b2Vec2(0, p[4].y);
+		p[6] = p[0] + b2Vec2(p[3].x, KINGS_CHAMBER_LEVEL);
+		p[7] = p[0] + b2Vec2(0, KINGS_CHAMBER_LEVEL);
+		
+		p[9] = crossPoint(p[1], p[2], p[5], p[6]);
+		p[8] = p[9]+measured.descendingToCrossing*b2Vec2(-cos(descendingAngle),-sin(descendingAngle));
+
+		p[11] = crossPoint(p[1], p[2], p[8], p[8] + 100 * b2Vec2(cos(descendingAngle), sin(descendingAngle)));
+		p[13] = p[8] + measured.descendingLength * b2Vec2(-cos(descendingAngle), -sin(descendingAngle));
+		p[14] = p[13] + measured.corridorHeight * b2Vec2(-sin(descendingAngle), cos(descendingAngle));
+		p[16] = p[8] + measured.ascendingLength * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+		p[21] = p[16] + b2Vec2(-0.61f * cos(ascendingAngle), 0.61f * sin(ascendingAngle)) + measured.corridorHeight * b2Vec2(sin(ascendingAngle), cos(ascendingAngle));
+		p[19] = p[8] + measured.corridorHeight * b2Vec2(-sin(descendingAngle), cos(descendingAngle));
+		p[15] = crossPoint(p[8], p[16], p[14], p[19]);
+		p[17] = p[8] + measured.corridorHeight * b2Vec2(sin(ascendingAngle), cos(ascendingAngle));
+		p[18] = p[16] + measured.corridorHeight * b2Vec2(sin(ascendingAngle), cos(ascendingAngle));
+		p[20] = p[11] + measured.corridorHeight * b2Vec2(-sin(descendingAngle), cos(descendingAngle));
+		p[22] = p[8] + b2Vec2(0,measured.corridorHeight/cos(descendingAngle));
+		p[10] = crossPoint(p[19], p[20], p[17], p[18]);
+		p[12] = crossPoint(p[19], p[20], p[1], p[2]);
+		p[23] = p[16] + measured.galleryLength * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+		p[24] = p[23] + measured.greatStep * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+		p[25] = p[16] + b2Vec2(-0.61f * cos(ascendingAngle), 0.61f * sin(ascendingAngle)) + b2Vec2(-0.15f * tan(ascendingAngle), -0.15f);
+		p[26] = p[25] + b2Vec2(-(3.85f+0.68f), 1.17f);
+		p[30] = b2Vec2(p[23].x,p[26].y);
+
+		p[31] = p[30] + b2Vec2(0, QUEEN_CHAMBER_HEIGHT - QUEEN_CHAMBER_CENTER_LEVEL);
+		p[32] = p[30] + b2Vec2(0, -QUEEN_CHAMBER_CENTER_LEVEL);
+		p[33] = p[32] - b2Vec2(QUEEN_CHAMBER_WIDTH / 2, 0);
+		p[34] = p[32] + b2Vec2(QUEEN_CHAMBER_WIDTH / 2, 0);
+
+		p[35] = crossPoint(p[33], p[33] + b2Vec2(0, 2 * QUEEN_CHAMBER_HEIGHT), p[31], p[31] + 5.09f * b2Vec2(-cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
+		p[36] = crossPoint(p[34], p[34] + b2Vec2(0, 2 * QUEEN_CHAMBER_HEIGHT), p[31], p[31] + 5.09f * b2Vec2(cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
+		
+
+		p[37] = b2Vec2(p[30].x + QUEEN_CHAMBER_WIDTH / 2, p[26].y);
+		p[38] = crossPoint(p[31], p[37], p[33], p[34]);
+		p[39] = crossPoint(p[35], p[37], p[33], p[34]);
+		p[40] = p[25]+b2Vec2(-(measured.queenPassage - (p[16].x - p[25].x)), 0);
+
+		p[42] = p[40] + b2Vec2( -(p[40].y - p[32].y)*(p[39]-p[35]).x/(p[35]-p[33]).y,-(p[40].y - p[32].y));
+		p[43] = p[34] + b2Vec2(-(41.16f - 38.70f), 0);
+		p[44] = p[43] + b2Vec2(-1.57f, 0);
+
+		p[47] = p[31] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER);
+		p[45] = crossPoint(p[35] + b2Vec2(0, -0.14f), p[35] + b2Vec2(-1, -0.14f), p[47], p[47] + 5.09f * b2Vec2(-cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
+		p[46] = crossPoint(p[36] + b2Vec2(0, -0.14f), p[36] + b2Vec2(1, -0.14f), p[47], p[47] + 5.09f * b2Vec2(cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
+
+		p[48] = p[24] + b2Vec2(0, (43.03f - 42.9f));
+		p[49] = p[23] + b2Vec2(0, 0.9f);
+
+		p[50] = p[48] + b2Vec2(0, 1.11f);
+
+		
+		p[51] = crossPoint(p[24],p[23], b2Vec2(p[50].x + 0.55f,p[50].y), b2Vec2(p[50].x + 0.55f,p[50].y-10));
+		p[52] = p[51] + b2Vec2(0, measured.galleryHeight);
+
+		// right gallery wall
+		{
+			p[61] = crossPoint(p[24], p[16], b2Vec2(p[21].x - 0.5f, p[21].y), b2Vec2(p[21].x - 0.5f, p[25].y));
+			
+			if (ceilingParallelToFloor) {
+				p[54] = p[61] + p[52]-p[51];
+			} else {
+				p[54] = p[61] + b2Vec2(0, measured.galleryCeilingHeight);
+			}
+			p[55] = crossPoint(p[21], b2Vec2(p[21].x, p[21].y - 10), p[24], p[16]);
+
+			p[56] = p[55] + b2Vec2(-0.120f, 0.120f * tan(ascendingAngle));
+			p[57] = p[56] + b2Vec2(-0.080f, 0.080f * tan(ascendingAngle));
+			p[58] = p[57] + b2Vec2(-0.090f, 0.090f * tan(ascendingAngle));
+			p[59] = p[58] + b2Vec2(-0.060f, 0.060f * tan(ascendingAngle));
+			p[60] = p[59] + b2Vec2(-0.075f, 0.075f * tan(ascendingAngle));
+
+			p[62] = p[55] + b2Vec2(0, measured.galleryWallsVertical[0]);
+			p[63] = p[56] + b2Vec2(0, measured.galleryWallsVertical[1]);
+			p[64] = p[57] + b2Vec2(0, measured.galleryWallsVertical[2]);
+			p[65] = p[58] + b2Vec2(0, measured.galleryWallsVertical[3]);
+			p[66] = p[59] + b2Vec2(0, measured.galleryWallsVertical[4]);
+			p[67] = p[60] + b2Vec2(0, measured.galleryWallsVertical[5]);
+			p[68] = p[61] + b2Vec2(0, measured.galleryWallsVertical[6]);
+		}
+		
+		// left gallery wall
+		{
+			p[71] = p[24] + b2Vec2(0.09f, -0.09f * tan(ascendingAngle));
+			p[72] = p[71] + b2Vec2(0.08f, -0.08f * tan(ascendingAngle));
+			p[73] = p[72] + b2Vec2(0.07f, -0.07f * tan(ascendingAngle));
+			p[74] = p[73] + b2Vec2(0.08f, -0.08f * tan(ascendingAngle));
+			p[75] = p[74] + b2Vec2(0.10f, -0.10f * tan(ascendingAngle));
+			p[76] = p[75] + b2Vec2(0.06f, -0.06f * tan(ascendingAngle));
+
+			p[77] = p[71] + b2Vec2(0, measured.galleryWallsVertical[0]);
+			p[78] = p[72] + b2Vec2(0, measured.galleryWallsVertical[1]);
+			p[79] = p[73] + b2Vec2(0, measured.galleryWallsVertical[2]);
+			p[80] = p[74] + b2Vec2(0, measured.galleryWallsVertical[3]);
+			p[81] = p[75] + b2Vec2(0, measured.galleryWallsVertical[4]);
+			p[82] = p[76] + b2Vec2(0, measured.galleryWallsVertical[5]);
+			p[83] = p[51] + b2Vec2(0, measured.galleryWallsVertical[6]);
+		}
+
+		placeGalleryCeiling();
+
+		// gallery floor
+		{
+			p[90] = p[23] + b2Vec2(0, cubit / cos(ascendingAngle));
+			p[91] = p[55] + b2Vec2(0, cubit / cos(ascendingAngle));
+		}
+
+		// Corridors, lower chamber and passage to Queen chamber
+		{
+			NextTo LowerChamber_14[3]{
+				b2Vec2(border0_top * sin(angle0),-border0_top * cos(angle0)),
+				b2Vec2(-(8.27f - 3.21f),0),
+				b2Vec2(0, 0)
+			};
+
+			NextTo LowerChamber_13[3]{
+				b2Vec2(-border0_bottom * sin(descendingAngle),border0_bottom * cos(descendingAngle)),
+				b2Vec2(-8.91 - 8.28,0),
+				b2Vec2(0, 0)
+			};
+
+			NextTo LowerChamber_88[5]{
+				b2Vec2(0,measured.lowerChamberHeight),
+				b2Vec2(measured.lowerChamberLength,0),
+				b2Vec2(0,-2.19f),
+				b2Vec2(8.78 - 7.39,0),
+				b2Vec2(0, 0)
+			};
+
+			NextTo QueenChamber_p16[3]{
+				b2Vec2(-0.61f * cos(ascendingAngle),0.61f * sin(ascendingAngle)),
+				b2Vec2(-0.15f * tan(ascendingAngle),-0.15f),
+				b2Vec2(0,0)
+			};
+
+			p[88] = p[13] + LowerChamber_13[0].v + LowerChamber_13[1].v;
+			p[87] = p[88] + LowerChamber_88[0].v + LowerChamber_88[1].v + LowerChamber_88[2].v + LowerChamber_88[3].v;
+
+			ChainPath corridors = ChainPath(p[40] + b2Vec2(0, -(p[25].y - p[32].y)));
+			corridors.lineTo(p[40]);
+			corridors.lineTo(p[25]);
+			corridors.pathBack(QueenChamber_p16);
+			corridors.lineTo(p[15]);
+			corridors.lineTo(p[14]);
+			p[86] = corridors.pathTo(LowerChamber_14);
+			corridors.absorbContainerTo(p[87]);
+			corridors.pathBack(LowerChamber_88);
+			corridors.pathBack(LowerChamber_13);
+			corridors.lineTo(p[8]);
+			corridors.lineTo(p[11]);
+			corridors.draw(body);
+			containers.insert(containers.end(), corridors.containers.begin(), corridors.containers.end());
+		}
+
+		// equilateral prism with 0.3 m sides, one meter along input fan from its middle
+		if (inputPrism) {
+			RayFan fan = inputFan();
+			b2Vec2 center = 0.5f * (fan.start + fan.end) + b2Vec2(cos(fan.angle), sin(fan.angle));
+			float radius = 0.3f / sqrt(3.0f);
+			b2Vec2 prism[4];
+			for (int i = 0;i < 4;i++) {
+				float a = PI / 2 + i * 2 * PI / 3;
+				prism[i] = center + radius * b2Vec2(cos(a), sin(a));
+			}
+			drawEdges(body, prism, 4, GlassWall);
+		}
+
+		// Gallery
+		// https://upload.wikimedia.org/wikipedia/commons/c/c6/PSM_V80_D462_Longitudinal_sections_of_the_grand_gallery.png
+
+		{
+			// Upper corridor wall and right gallery wall
+			{
+				float angle = 0;  // Horizontal
+
+				if (rightGalleryWallMode == Parallel) {
+					angle = ascendingAngle;
+				}
+
+				ChainPath rightWall = ChainPath(p[12]);
+				rightWall.lineTo(p[10]);
+				rightWall.lineTo(p[18]);
+				rightWall.lineTo(p[21]);
+
+				rightWall.lineTo(b2Vec2(p[21].x, p[63].y - (p[21].x - p[63].x) * tan(angle)));
+				rightWall.lineTo(p[63]);
+
+				rightWall.lineTo(b2Vec2(p[63].x, p[64].y - (p[63].x - p[64].x) * tan(angle)));
+				rightWall.lineTo(p[64]);
+
+				rightWall.lineTo(b2Vec2(p[64].x, p[65].y - (p[64].x - p[65].x) * tan(angle)));
+				rightWall.lineTo(p[65]);
+
+				rightWall.lineTo(b2Vec2(p[65].x, p[66].y - (p[65].x - p[66].x) * tan(angle)));
+				rightWall.lineTo(p[66]);
+
+				rightWall.lineTo(b2Vec2(p[66].x, p[67].y - (p[66].x - p[67].x) * tan(angle)));
+				rightWall.lineTo(p[67]);
+
+				rightWall.lineTo(b2Vec2(p[67].x, p[68].y - (p[67].x - p[68].x) * tan(angle)));
+				rightWall.lineTo(b2Vec2(p[61].x, p[68].y));
+
+				rightWall.lineTo(p[54]);
+				rightWall.draw(body);
+			}
+
+			// Gallery floor, King chamber, left gallery wall and ceiling
+			{
+				NextTo RightGalleryFloor_p26[3]{
+					b2Vec2(0,0.93f),
+					b2Vec2(-1.53f * cos(ascendingAngle),1.53f * sin(ascendingAngle)),
+					b2Vec2(0,0)
+				};
+
+				NextTo KingChamber_p48[10]{
+					b2Vec2(-measured.kingPassage,0),
+
+					/*
+					b2Vec2(-1.64f,0),
+					b2Vec2(0,0.01f),
+					b2Vec2(-1.2f,0),
+					b2Vec2(0,-0.01f),
+					b2Vec2(-1.79f - 2.2f,0),
+					b2Vec2(0,0.02f),
+					*/
+
+					b2Vec2(-KING_CHAMBER_WIDTH,0),
+					b2Vec2(0, KING_CHAMBER_HEIGHT),
+					b2Vec2(KING_CHAMBER_WIDTH,0),
+					b2Vec2(0, -(KING_CHAMBER_HEIGHT - (p[50].y - p[48].y))),
+					b2Vec2(1.79f + 0.77f,0),
+					b2Vec2(0,3.77f - (p[50].y - p[48].y)),
+					b2Vec2(2.96f,0),
+					b2Vec2(0,-(3.77f - (p[50].y - p[48].y))),
+	//				b2Vec2(1.23f,0),
+					b2Vec2(0,0)
+				};
+
+				ChainPath gallery = ChainPath(p[26]);
+
+				// Right Gallery floor
+				p[28] = gallery.pathTo(RightGalleryFloor_p26);
+				p[29] = crossPoint(p[28], p[28] + b2Vec2(0, 1), p[23], p[16]);
+				gallery.lineTo(p[29]);
+				gallery.lineTo(p[23]);
+
+				// Left Gallery floor
+				gallery.lineTo(p[49]);
+				gallery.lineTo(p[48]);
+
+				// King Chamber
+				gallery.pathTo(KingChamber_p48, graniteKingChamber ? GraniteWall : ReflectWall);
+				gallery.lineTo(p[50]);
+
+				// Left gallery wall
+				{
+					float angle = 0;  // Horizontal
+
+					if (leftGalleryWallMode == Parallel) {
+						angle = ascendingAngle;
+					}
+
+					gallery.lineTo(b2Vec2(p[50].x, p[77].y + (p[77].x - p[50].x) * tan(angle)));
+					gallery.lineTo(p[77]);
+
+					gallery.lineTo(b2Vec2(p[77].x, p[78].y + (p[78].x - p[77].x) * tan(angle)));
+					gallery.lineTo(p[78]);
+
+					gallery.lineTo(b2Vec2(p[78].x, p[79].y + (p[79].x - p[78].x) * tan(angle)));
+					gallery.lineTo(p[79]);
+
+					gallery.lineTo(b2Vec2(p[79].x, p[80].y + (p[80].x - p[79].x) * tan(angle)));
+					gallery.lineTo(p[80]);
+
+					gallery.lineTo(b2Vec2(p[80].x, p[81].y + (p[81].x - p[80].x) * tan(angle)));
+					gallery.lineTo(p[81]);
+
+					gallery.lineTo(b2Vec2(p[81].x, p[82].y + (p[82].x - p[81].x) * tan(angle)));
+					gallery.lineTo(p[82]);
+
+					gallery.lineTo(b2Vec2(p[82].x, p[83].y + (p[83].x - p[82].x) * tan(angle)));
+					gallery.lineTo(p[83]);
+
+					gallery.lineTo(p[52]);
+				}
+
+				// Gallery ceiling, a part of its own when moving
+				if (!movingParts) {
+					galleryCeiling(&gallery);
+				}
+
+				if (limestoneWalls) {
+					gallery.replaceMaterial(ReflectWall, DiffuseWall);
+				}
+				gallery.draw(body);
+			}
+
+			// Gallery beams
+			{
+					float stepSize = 6.526f * sqrt((p[90] - p[91]).LengthSquared()) / 88.036f;
+
+					int beamsMaterial = ReflectWall;
+					if (galleryBeamsMode == Absorb) {
+						beamsMaterial = AbsorbWall;
+					}
+
+					// cuttings relative to step_i, every beam is the same instance of both shapes
+					b2Vec2 p3 = (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+					b2Vec2 p4 = p3 + GALLERY_HOLES_SPACE_MUL * stepSize * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+
+					// short cutting
+					b2Vec2 p8 = GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.19f);
+					b2Vec2 p9 = p8 + (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+					b2Vec2 p10 = p9 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
+					b2Vec2 p11 = p8 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
+					b2Vec2 shortCutting[5] = { p8, p9, p10, p11, p8 };
+
+					// long cutting
+					b2Vec2 p12 = p4 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.19f);
+					b2Vec2 p13 = p12 + (GALLERY_HOLE_LONG_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+					b2Vec2 p14 = p13 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
+					b2Vec2 p15 = p12 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
+					b2Vec2 longCutting[5] = { p12, p13, p14, p15, p12 };
+
+					for (int i = 1;i < 14 && galleryBeamsMode != Transparent;i++) {
+						b2Vec2 step_i = p[91] + stepSize * i * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+						b2Transform xf = b2Transform(step_i, b2Rot(0));
+
+						drawInstance(body, shortCutting, 5, beamsMaterial, xf);
+						if (i < 13) {
+							drawInstance(body, longCutting, 5, beamsMaterial, xf);
+						}
+					}
+			}
+		}
+
+		// Queen Chamber
+		{
+			ChainPath queenChamber = ChainPath(p[26]);
+			queenChamber.lineTo(p[37]);
+			queenChamber.lineTo(p[36] + b2Vec2(0, -0.14f));
+			queenChamber.lineTo(p[46]);
+			queenChamber.lineTo(p[36] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER));
+			queenChamber.lineTo(p[36]);
+			queenChamber.lineTo(p[31]);
+			queenChamber.lineTo(p[35]);
+			queenChamber.lineTo(p[35] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER));
+			queenChamber.lineTo(p[45]);
+			queenChamber.lineTo(p[35] + b2Vec2(0, -0.14f));
+			queenChamber.lineTo(p[33]);
+
+			//floor
+			queenChamber.lineTo(p[44]);
+			queenChamber.absorbContainerTo(p[43]);
+			queenChamber.lineTo(p[34]);
+			queenChamber.lineTo(p[38]);
+			queenChamber.absorbContainerTo(p[39]);
+			queenChamber.lineTo(p[42]);
+			queenChamber.absorbContainerTo(b2Vec2(p[40].x, p[42].y));
+			if (limestoneWalls) {
+				queenChamber.replaceMaterial(ReflectWall, DiffuseWall);
+			}
+			queenChamber.draw(body);
+			containers.insert(containers.end(), queenChamber.containers.begin(), queenChamber.containers.end());
+		}
+
+		// King Chamber
+		{
+			if (!movingParts) {
+				buildKingChamberBlock(body, kingChamberBlockPosition());
+			}
+		}
+
+	}
+
+	// gallery ceiling line p[84] -> p[85], galleryCeilingOffset below p[52] -> p[54]
+	void placeGalleryCeiling() {
+		float ceilingAngle = atan2(p[54].x - p[52].x, p[52].y - p[54].y) - asin(galleryCeilingOffset / sqrt((p[54] - p[52]).LengthSquared()));
+		p[84] = p[52] + galleryCeilingOffset * b2Vec2(cos(ceilingAngle), sin(ceilingAngle));
+		p[85] = p[54] - galleryCeilingOffset * b2Vec2(cos(ceilingAngle), sin(ceilingAngle));
+	}
+};
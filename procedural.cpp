@@ -0,0 +1,245 @@
+#include "settings.h"
+#include "test.h"
+#include "imgui/imgui.h"
+
+#include "tools.h"
+#include "generator.h"
+#include "segments.h"
+#include "instancing.h"
+
+class ProceduralGallery : public Test
+{
+public:
+	ProceduralGallery()
+	{
+		rebuild();
+	}
+
+	void UpdateUI() override
+	{
+		ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f));
+		ImGui::SetNextWindowSize(ImVec2(700.0f, 400.0f));
+		ImGui::Begin("Controls", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize);
+
+		if (ImGui::TreeNode("Geometry"))
+		{
+			if (ImGui::SliderInt("Corbel levels", &gallery.levels, 1, 4096)) {
+				needToReset = true;
+			}
+			if (ImGui::SliderInt("Ceiling steps", &gallery.ceilingSteps, 1, 4096)) {
+				needToReset = true;
+			}
+			if (ImGui::SliderInt("Beam cutouts", &gallery.cutouts, 0, 4096)) {
+				needToReset = true;
+			}
+			if (ImGui::SliderFloat("Ceiling slab offset", &gallery.ceilingOffset, 0.0f, 1.0f, "%.3f")) {
+				needToReset = true;
+			}
+			if (ImGui::Checkbox("Instanced cutouts and slabs", &instancing)) {
+				needToReset = true;
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Rays"))
+		{
+			ImGui::SliderInt("Rays", &rays, 1, 10000);
+			ImGui::SliderInt("Maximum reflections", &maximumReflections, 0, 300);
+			ImGui::Checkbox("Draw rays", &drawRays);
+
+			ImGui::TreePop();
+		}
+
+		if (instancing) {
+			ImGui::Text("edges = %d  stored segments = %d  prototypes = %d  instances = %d  memory = %.1f kB", edges,
+				instanced.storedCount(), (int)instanced.prototypes.size(), (int)instanced.instances.size(), instanced.memory() / 1024.0f);
+		}
+		else {
+			ImGui::Text("edges = %d  fixtures = %d  proxies = %d  backend = %s", edges, fixtures, m_world->GetProxyCount(), scene.backendName());
+		}
+		ImGui::Text("build = %.3f ms  trace = %.3f ms  segments traced = %d", buildTime, traceTime, tracedSegments);
+		if (edges < gallery.edgesCount()) {
+			ImGui::Text("warning: %d of %d edges shorter than b2_linearSlop were merged", gallery.edgesCount() - edges, gallery.edgesCount());
+		}
+
+		if (ImGui::Button("Run scaling study")) {
+			runScalingStudy();
+		}
+
+		for (int i = 0;i < study.size();i++) {
+			ImGui::Text("x%-5d edges = %-7d of %-7d stored = %-7d build = %9.3f ms  trace = %9.3f ms  segments = %d%s",
+				study[i].scale, study[i].edges, study[i].outline, study[i].stored, study[i].buildTime, study[i].traceTime, study[i].tracedSegments,
+				study[i].edges < study[i].outline ? "  (merged below slop)" : "");
+		}
+
+		ImGui::End();
+	}
+
+	void Step(Settings& settings) override
+	{
+		if (needToReset) {
+			rebuild();
+			needToReset = false;
+		}
+
+		if (instancing) {
+			drawInstanced();
+		}
+
+		b2Timer timer;
+		tracedSegments = traceFan(drawRays);
+		traceTime = timer.GetMilliseconds();
+
+		Test::Step(settings);
+	}
+
+	static Test* Create()
+	{
+		return new ProceduralGallery;
+	}
+
+private:
+	class ScalingSample {
+	public:
+		int scale;
+		int edges;              // created, fewer than outline when features merged below b2_linearSlop
+		int outline;            // CorbelledGallery::edgesCount()
+		int stored;             // segments kept in memory
+		float buildTime;
+		float traceTime;
+		int tracedSegments;
+	};
+
+	CorbelledGallery gallery;
+
+	int rays = 100;
+	int maximumReflections = 30;
+	bool drawRays = true;
+
+	b2BodyDef bd;
+	b2Body* galleryBody = nullptr;
+	Scene scene;
+	InstancedScene instanced;
+	bool instancing = false;
+
+	bool needToReset = false;
+
+	int edges = 0;
+	int fixtures = 0;
+	float buildTime = 0;
+	float traceTime = 0;
+	int tracedSegments = 0;
+
+	std::vector<ScalingSample> study;
+
+	void rebuild() {
+		if (galleryBody) {
+			m_world->DestroyBody(galleryBody);
+		}
+
+		b2Timer timer;
+		galleryBody = m_world->CreateBody(&bd);
+		if (instancing) {
+			// body stays empty, walls are drawn from instanced scene
+			instanced.clear();
+			edges = gallery.build(&instanced);
+			instanced.finish();
+		}
+		else {
+			edges = gallery.build(galleryBody);
+			scene.update(m_world, galleryBody);
+		}
+		buildTime = timer.GetMilliseconds();
+
+		fixtures = 0;
+		for (b2Fixture* f = galleryBody->GetFixtureList();f;f = f->GetNext()) {
+			fixtures++;
+		}
+	}
+
+	// walls of instanced scene, the body is empty then
+	void drawInstanced() {
+		b2Color color = b2Color(0.9f, 0.7f, 0.7f);
+		for (int i = 0;i < instanced.segments.count;i++) {
+			g_debugDraw.DrawSegment(instanced.segments.start(i), instanced.segments.end(i), color);
+		}
+		for (const ShapeInstance& copy : instanced.instances) {
+			const SegmentTable& local = instanced.prototypes[copy.prototype].segments;
+			for (int i = 0;i < local.count;i++) {
+				g_debugDraw.DrawSegment(b2Mul(copy.xf, local.start(i)), b2Mul(copy.xf, local.end(i)), color);
+			}
+		}
+	}
+
+	int traceFan(bool draw) {
+		if (instancing) {
+			return traceFan(&instanced, draw);
+		}
+		return traceFan(&scene, draw);
+	}
+
+	// fan from gallery center, returns number of traced segments
+	template <typename World>
+	int traceFan(World world, bool draw) {
+		int segments = 0;
+		b2Vec2 center = gallery.center();
+
+		for (int i = 0;i < rays;i++) {
+			float angle = 2 * PI * (i + 0.5f) / rays;
+			Ray ray = Ray(center, 100, angle, maximumReflections);
+
+			if (draw) {
+				b2Color color = b2Color(
+					0.5f + cos(angle) / 2,
+					0.5f + cos(angle + 2 * PI / 3) / 2,
+					0.5f + cos(angle + 4 * PI / 3) / 2
+				);
+				traceRay(world, ray, [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+					g_debugDraw.DrawSegment(source, callback.m_point, color);
+					segments++;
+				});
+			}
+			else {
+				traceRay(world, ray, [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+					segments++;
+				});
+			}
+		}
+		return segments;
+	}
+
+	// rebuilds gallery with levels, steps and cutouts multiplied by 1,2,4...256 and measures build and trace time
+	void runScalingStudy() {
+		CorbelledGallery base = gallery;
+		study.clear();
+
+		for (int scale = 1;scale <= 256;scale *= 2) {
+			gallery.levels = base.levels * scale;
+			gallery.ceilingSteps = base.ceilingSteps * scale;
+			gallery.cutouts = base.cutouts * scale;
+			gallery.levelOverhang = base.levelOverhang / scale;
+			gallery.cutoutWidth = base.cutoutWidth / scale;
+
+			rebuild();
+
+			b2Timer timer;
+			int segments = traceFan(false);
+
+			ScalingSample sample;
+			sample.scale = scale;
+			sample.edges = edges;
+			sample.outline = gallery.edgesCount();
+			sample.stored = instancing ? instanced.storedCount() : scene.segments.count;
+			sample.buildTime = buildTime;
+			sample.traceTime = timer.GetMilliseconds();
+			sample.tracedSegments = segments;
+			study.push_back(sample);
+		}
+
+		gallery = base;
+		rebuild();
+	}
+};
+
+static int testIndex = RegisterTest("Pyramid", "Procedural Gallery", ProceduralGallery::Create);
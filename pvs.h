@@ -0,0 +1,321 @@
+#pragma once
+
+#include <thread>
+#include <algorithm>
+
+#include "snapshot.h"
+
+// Potentially visible sets between walls: for every side of every wall the walls which a ray leaving it
+// can hit next, e.g. nothing in the lower chamber is in a set of a gallery floor wall. All segments from
+// a point of wall i to a point of wall j fill the convex hull of both, so j is dropped only when a chain
+// of connected walls crosses that hull from one side to the other, keeping clearance from i and j, or
+// when j lies behind the side of i the ray leaves to. Sets are conservative: the closest hit among them
+// is the closest hit of the full query, bit for bit as brute force lanes run over a padded copy of every
+// set. Exceptions are rays slipping through joints of a chain by rounding, which the full query lets
+// through. Built once per snapshot version on all threads, O(n^2) pairs with occluders from the tree,
+// for brute force scenes only; scenes over maximumSegments get no sets and are traced by full queries.
+//   sets.update(snapshot);
+//   VisibleScene visible = sets.scene(snapshot);
+//   traceRay(&visible, ray, visitor);
+class VisibleSets;
+
+// Snapshot traced with visible sets, remembers the wall the ray leaves for the next cast. traceRay()
+// over it gives the same visits and distance as over the snapshot the sets were built for.
+class VisibleScene {
+public:
+	const VisibleSets* sets;
+	const SceneSnapshot* snapshot;
+	int from = -1;                           // wall the ray leaves
+};
+
+class VisibleSets {
+public:
+	int maximumSegments = BRUTE_FORCE_SEGMENTS_LIMIT;  // bigger scenes are culled by the tree instead
+	float clearance = 0.001f;                // occluders closer to either wall do not separate them
+	uint32 version = 0;                      // of snapshot the sets were built for
+	int threads = 1;
+
+	std::vector<int> offsets;                // walls seen from side s of wall i are sets[offsets[2 * i + s] .. offsets[2 * i + s + 1])
+	std::vector<int> sets;                   // ascending segment indices, wall i itself included
+	SegmentTable candidates;                 // every set copied and padded to 8, set k starts at first[k]
+	std::vector<int> first;
+	std::vector<int> segment;                // candidates row -> segment index
+	int walls = 0;                           // walls of non zero length
+	float buildTime = 0;                     // ms
+
+	VisibleSets() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	// rebuilds sets when snapshot is of another version, true if rebuilt
+	bool update(const SceneSnapshot* snapshot) {
+		if (snapshot->version == version) {
+			return false;
+		}
+		build(&snapshot->segments, &snapshot->tree);
+		version = snapshot->version;
+		return true;
+	}
+
+	void build(const SegmentTable* segments, const SegmentTree* tree) {
+		b2Timer timer;
+		table = segments;
+		offsets.clear();
+		sets.clear();
+		candidates.clear();
+		first.clear();
+		segment.clear();
+		walls = 0;
+
+		int n = segments->count;
+		if (n > maximumSegments) {
+			buildTime = timer.GetMilliseconds();
+			return;
+		}
+
+		linked.assign(n, 0);
+		for (int k = 1;k < n;k++) {
+			linked[k] = b2DistanceSquared(segments->end(k - 1), segments->start(k)) <= weld * weld;
+		}
+
+		// rows are interleaved over threads, pair (i, j > i) is written by the thread of row i only
+		std::vector<uint8> visible((size_t)n * n, 0);
+		std::vector<std::thread> workers;
+		for (int t = 0;t < threads;t++) {
+			workers.push_back(std::thread([&, t]() {
+				std::vector<int> occluders;
+				for (int i = t;i < n;i += threads) {
+					if (length(i) == 0) {
+						continue;
+					}
+					visible[(size_t)i * n + i] = 1;
+					for (int j = i + 1;j < n;j++) {
+						if (length(j) > 0 && !separated(tree, i, j, occluders)) {
+							visible[(size_t)i * n + j] = 1;
+							visible[(size_t)j * n + i] = 1;
+						}
+					}
+				}
+			}));
+		}
+		for (int t = 0;t < threads;t++) {
+			workers[t].join();
+		}
+
+		// a ray leaves wall i to one side, set 2 * i is in front of it (left of start -> end), 2 * i + 1 behind
+		offsets.resize(2 * n + 1);
+		first.resize(2 * n + 1);
+		for (int i = 0;i < n;i++) {
+			walls += length(i) > 0;
+			for (int behind = 0;behind < 2;behind++) {
+				offsets[2 * i + behind] = (int)sets.size();
+				first[2 * i + behind] = candidates.count;
+				for (int j = 0;j < n;j++) {
+					if (!visible[(size_t)i * n + j] || (j != i && !reaches(i, j, behind ? -1.0f : 1.0f))) {
+						continue;
+					}
+					sets.push_back(j);
+					candidates.add(segments->start(j), segments->end(j), segments->material[j], segments->fixture[j], segments->childIndex[j]);
+					segment.push_back(j);
+				}
+				while (candidates.count % 8) {
+					candidates.add(b2Vec2_zero, b2Vec2_zero, ReflectWall, nullptr, -1);
+					segment.push_back(-1);
+				}
+			}
+		}
+		offsets[2 * n] = (int)sets.size();
+		first[2 * n] = candidates.count;
+		candidates.pad();
+		buildTime = timer.GetMilliseconds();
+	}
+
+	// mean set size over walls and sides
+	float averageSet() const {
+		return walls > 0 ? 0.5f * sets.size() / walls : 0;
+	}
+
+	// closest hit of p1->p2 among walls seen from wall from on the side p2 lies, full query for -1 or when
+	// there are no sets
+	int rayCast(const SceneSnapshot* snapshot, int from, b2Vec2 p1, b2Vec2 p2, float* fraction) const {
+		const SegmentTable* segments = &snapshot->segments;
+		if (from < 0 || first.empty()) {
+			return snapshot->bruteForce ? segments->rayCast(p1, p2, 1.0f, fraction) : snapshot->tree.rayCast(segments, p1, p2, 1.0f, fraction);
+		}
+		int set = 2 * from + (b2Cross(b2Vec2(segments->dx[from], segments->dy[from]), p2 - p1) < 0);
+		int k = candidates.rayCast(p1, p2, 1.0f, fraction, first[set], first[set + 1]);
+		return k < 0 ? -1 : segment[k];
+	}
+
+	// world for traceRay() of one ray
+	VisibleScene scene(const SceneSnapshot* snapshot) const {
+		VisibleScene visible;
+		visible.sets = this;
+		visible.snapshot = snapshot;
+		return visible;
+	}
+
+private:
+	const float weld = 1e-5f;                // chain joints, rounding of shared vertices
+	const SegmentTable* table = nullptr;
+	std::vector<uint8> linked;               // segment k continues segment k - 1
+
+	float length(int i) const {
+		return sqrtf(table->dx[i] * table->dx[i] + table->dy[i] * table->dy[i]);
+	}
+
+	// Walls whose lines cut each other are split there, so that every pair of pieces lies on one side of
+	// the other piece and both are edges of their hull. Touching or crossing walls see each other.
+	bool separated(const SegmentTree* tree, int i, int j, std::vector<int>& occluders) const {
+		b2Vec2 a0 = table->start(i);
+		b2Vec2 a1 = table->end(i);
+		b2Vec2 b0 = table->start(j);
+		b2Vec2 b1 = table->end(j);
+		if (distance(a0, a1, b0, b1) <= clearance) {
+			return false;
+		}
+
+		float sb0 = b2Cross(a1 - a0, b0 - a0);
+		float sb1 = b2Cross(a1 - a0, b1 - a0);
+		float sa0 = b2Cross(b1 - b0, a0 - b0);
+		float sa1 = b2Cross(b1 - b0, a1 - b0);
+		bool cutsJ = (sb0 > 0 && sb1 < 0) || (sb0 < 0 && sb1 > 0);
+		bool cutsI = (sa0 > 0 && sa1 < 0) || (sa0 < 0 && sa1 > 0);
+		if (cutsJ && cutsI) {
+			return false;
+		}
+		if (cutsJ) {
+			b2Vec2 m = b0 + (sb0 / (sb0 - sb1)) * (b1 - b0);
+			return separatedPieces(tree, i, j, a0, a1, b0, m, occluders) && separatedPieces(tree, i, j, a0, a1, m, b1, occluders);
+		}
+		if (cutsI) {
+			b2Vec2 m = a0 + (sa0 / (sa0 - sa1)) * (a1 - a0);
+			return separatedPieces(tree, i, j, a0, m, b0, b1, occluders) && separatedPieces(tree, i, j, m, a1, b0, b1, occluders);
+		}
+		return separatedPieces(tree, i, j, a0, a1, b0, b1, occluders);
+	}
+
+	// Hull a0 a1 b b' has edges 0 (piece of i), 1 (side), 2 (piece of j) and 3 (side). A run of connected
+	// walls entering through one side and leaving through the other splits it between the pieces.
+	bool separatedPieces(const SegmentTree* tree, int i, int j, b2Vec2 a0, b2Vec2 a1, b2Vec2 b0, b2Vec2 b1, std::vector<int>& occluders) const {
+		b2Vec2 q[4] = { a0, a1, b1, b0 };
+		if (!convex(q)) {
+			q[2] = b0;
+			q[3] = b1;
+			if (!convex(q)) {
+				return false;
+			}
+		}
+		float orientation = b2Cross(q[1] - q[0], q[2] - q[0]) + b2Cross(q[2] - q[0], q[3] - q[0]);
+		if (orientation == 0) {
+			return false;
+		}
+		float sign = orientation > 0 ? 1.0f : -1.0f;
+
+		b2AABB box;
+		box.lowerBound = b2Min(b2Min(q[0], q[1]), b2Min(q[2], q[3]));
+		box.upperBound = b2Max(b2Max(q[0], q[1]), b2Max(q[2], q[3]));
+		occluders.clear();
+		tree->query(box, [&](int k) {
+			if (k != i && k != j && length(k) > 0) {
+				occluders.push_back(k);
+			}
+		});
+		std::sort(occluders.begin(), occluders.end());
+
+		bool open = false;                   // previous occluder ends inside hull
+		int previous = -2;
+		int entry = -1;                      // edge the current run entered through, -1 if it began inside
+		bool clear = false;                  // current run keeps clearance from both walls
+		for (int k : occluders) {
+			b2Vec2 p = table->start(k);
+			b2Vec2 d = table->end(k) - p;
+			float t0 = 0;
+			float t1 = 1;
+			int enter = -1;
+			int exit = -1;
+			bool outside = false;
+			for (int e = 0;e < 4;e++) {
+				b2Vec2 v = q[e];
+				b2Vec2 edge = q[(e + 1) % 4] - v;
+				float f0 = sign * b2Cross(edge, p - v);
+				float fd = sign * b2Cross(edge, d);
+				if (fd == 0) {
+					outside |= f0 < 0;
+					continue;
+				}
+				float t = -f0 / fd;
+				if (fd > 0 && t >= t0) {
+					t0 = t;
+					enter = e;
+				}
+				if (fd < 0 && t <= t1) {
+					t1 = t;
+					exit = e;
+				}
+			}
+			if (outside || t0 >= t1) {
+				open = false;
+				continue;
+			}
+
+			if (!(open && previous == k - 1 && linked[k] && enter < 0)) {
+				entry = enter;
+				clear = entry == 1 || entry == 3;
+			}
+			clear = clear && distance(p + t0 * d, p + t1 * d, table->start(i), table->end(i)) > clearance && distance(p + t0 * d, p + t1 * d, table->start(j), table->end(j)) > clearance;
+			previous = k;
+			open = exit < 0;
+			if (!open && clear && (exit == 1 || exit == 3) && exit != entry) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// some point of wall j lies on side of wall i or within the 0.1 mm step of trace behind it
+	bool reaches(int i, int j, float side) const {
+		b2Vec2 d = b2Vec2(table->dx[i], table->dy[i]);
+		float limit = -0.0001f * length(i);
+		return side * b2Cross(d, table->start(j) - table->start(i)) > limit || side * b2Cross(d, table->end(j) - table->start(i)) > limit;
+	}
+
+	static bool convex(const b2Vec2 q[4]) {
+		bool positive = false;
+		bool negative = false;
+		for (int e = 0;e < 4;e++) {
+			float turn = b2Cross(q[(e + 1) % 4] - q[e], q[(e + 2) % 4] - q[(e + 1) % 4]);
+			positive |= turn > 0;
+			negative |= turn < 0;
+		}
+		return !(positive && negative);
+	}
+
+	static float distance(b2Vec2 p, b2Vec2 a, b2Vec2 b) {
+		b2Vec2 d = b - a;
+		float l = d.LengthSquared();
+		float u = l > 0 ? b2Clamp(b2Dot(p - a, d) / l, 0.0f, 1.0f) : 0;
+		return b2Distance(p, a + u * d);
+	}
+
+	// distance between segments p0 p1 and a0 a1, zero when they cross
+	static float distance(b2Vec2 p0, b2Vec2 p1, b2Vec2 a0, b2Vec2 a1) {
+		float s0 = b2Cross(a1 - a0, p0 - a0);
+		float s1 = b2Cross(a1 - a0, p1 - a0);
+		float s2 = b2Cross(p1 - p0, a0 - p0);
+		float s3 = b2Cross(p1 - p0, a1 - p0);
+		if (((s0 > 0 && s1 < 0) || (s0 < 0 && s1 > 0)) && ((s2 > 0 && s3 < 0) || (s2 < 0 && s3 > 0))) {
+			return 0;
+		}
+		return b2Min(b2Min(distance(p0, a0, a1), distance(p1, a0, a1)), b2Min(distance(a0, p0, p1), distance(a1, p0, p1)));
+	}
+};
+
+inline void rayCastClosest(VisibleScene* visible, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	float fraction;
+	int hit = visible->sets->rayCast(visible->snapshot, visible->from, point1, point2, &fraction);
+	if (hit >= 0) {
+		visible->from = hit;
+		reportSegment(&visible->snapshot->segments, hit, fraction, callback, point1, point2);
+	}
+}
@@ -13,58 +13,41 @@
 #include "imgui/imgui.h"
 
 #include "tools.h"
+#include "model.h"
+#include "segments.h"
+#include "beam.h"
+#include "adaptive.h"
+#include "density.h"
+#include "receiver.h"
+#include "visibility.h"
+#include "estimator.h"
+#include "uncertainty.h"
+#include "snapshot.h"
+#include "spectral.h"
+#include "celestial.h"
+#include "validation.h"
+#include "coherence.h"
+#include "pvs.h"
+#include "radiosity.h"
+#include "families.h"
+#include "distance.h"
 
 #include <cmath>  
+#include <map>
 
-#define WIDTH (c / (PI*(sqrt(2)-1)))/1000000                                 // Pyramid width  = 230,380923883861
-#define HEIGHT WIDTH * 14 / 22                                               // Pyramid height = 146,606042471548
-
-#define SIDE                               sqrt(WIDTH*WIDTH+HEIGHT*HEIGHT)   // pyramid side
-#define VERTICAL_ANGLE                     atan(WIDTH/(2*HEIGHT))            // from top to side angle
-
-#define KINGS_CHAMBER_LEVEL                HEIGHT*(1-1/sqrt(2))
-
-#define QUEEN_CHAMBER_ROOF_ANGLE           PI / 6
-#define QUEEN_CHAMBER_HEIGHT               6.26f
-#define QUEEN_CHAMBER_WIDTH                10 * cubit
-#define QUEEN_CHAMBER_CENTER_LEVEL         (0.88f+0.83f)
-#define QUEEN_CHAMBER_SMALLEST_BORDER      0.03f
-
-#define KING_CHAMBER_HEIGHT                10 * cubit
-#define KING_CHAMBER_WIDTH                 10 * sqrt(5) * cubit / 2
-
-#define GALLERY_CEILING_FIRST_STEP_WIDTH   0.37f
-
-#define GALLERY_HOLE_SHORT_DEPTH           0.18f
-#define GALLERY_HOLE_LONG_DEPTH            0.18f
-#define GALLERY_HOLE_SHORT_WIDTH_MUL       1/6.526f      // coefficient
-#define GALLERY_HOLE_LONG_WIDTH_MUL        1.13f/6.526f  // coefficient
-#define GALLERY_HOLES_SPACE_MUL            2.198f/6.526f // coefficient
-
-#define GALLERY_NICHE_HEIGH_MUL            1.15f         // coefficient
-#define GALLERY_NICHE_WIDTH_MUL            0.53f         // coefficient
-
-
-
-constexpr auto shem = 6 * cubit / 5;
-
-constexpr auto border0_bottom = 0.03f;
-constexpr auto border0_top = 0.11f;
-
-// entrance angle https://planetcalc.ru/71/
-constexpr auto angle0 = 0.470322600181172;      //2656'51"  = 0.470322600181172  
-
-constexpr auto defaultAscendingAngle = 0.470322600181172;      //2656'51"  = 0.470322600181172
-constexpr auto defaultDescendingAngle = 0.46157171323714485;   //2626'46"
-constexpr auto defaultAngleRange =  PI / 180;
-
-b2Vec2 crossPoint(b2Vec2 p1, b2Vec2 p2, b2Vec2 p3, b2Vec2 p4) {
-	return b2Vec2(
-		((p1.x * p2.y - p1.y * p2.x) * (p3.x - p4.x) - (p1.x - p2.x) * (p3.x * p4.y - p3.y * p4.x)) / ((p1.x - p2.x) * (p3.y - p4.y) - (p1.y - p2.y) * (p3.x - p4.x)),
-		((p1.x * p2.y - p1.y * p2.x) * (p3.y - p4.y) - (p1.y - p2.y) * (p3.x * p4.y - p3.y * p4.x)) / ((p1.x - p2.x) * (p3.y - p4.y) - (p1.y - p2.y) * (p3.x - p4.x))
-	);
-}
-
+// how drawFan() traces a fan
+enum FanBackend
+{
+	RaysBackend,             // 50 rays through the scene
+	HitsBackend,             // same rays recorded in hitIndex
+	BeamBackend,
+	AdaptiveBackend,
+	DensityBackend,
+	CoherentBackend,
+	VisibleSetsBackend,
+	FamiliesBackend,
+	DistanceFieldBackend
+};
 
 class Piramid : public Test
 {
@@ -72,7 +55,11 @@ public:
 	Piramid()
 	{
 		pyramidBody = m_world->CreateBody(&bd);
-		buildPyramid(pyramidBody);
+		model.build(pyramidBody);
+		createMovingParts();
+		scene.update(m_world, sceneBodies());
+		snapshots.publish(sceneBodies());
+		validator.validate(&scene.segments);
 	}
 
 	void UpdateUI() override
@@ -85,18 +72,18 @@ public:
 
 		if (ImGui::TreeNode("Corridors"))
 		{
-			if (ImGui::SliderAngle("Ascending Angle  ", &ascendingAngle, (defaultAscendingAngle - defaultAngleRange) * 180 / PI, (defaultAscendingAngle + defaultAngleRange) * 180 / PI, "%0f deg")) {
+			if (ImGui::SliderAngle("Ascending Angle  ", &model.ascendingAngle, (defaultAscendingAngle - defaultAngleRange) * 180 / PI, (defaultAscendingAngle + defaultAngleRange) * 180 / PI, "%0f deg")) {
 				needToReset = true;
 				//angle2minutesAndSeconds
 			}
 			char str[30];
-			angle2minutesAndSeconds(str, sizeof(str), "Ascending angle = ", ascendingAngle);
+			angle2minutesAndSeconds(str, sizeof(str), "Ascending angle = ", model.ascendingAngle);
 			ImGui::Text(str);
 
-			if (ImGui::SliderAngle("Descending Angle", &descendingAngle, (defaultDescendingAngle - defaultAngleRange) * 180 / PI, (defaultDescendingAngle + defaultAngleRange) * 180 / PI, "%0f deg")) {
+			if (ImGui::SliderAngle("Descending Angle", &model.descendingAngle, (defaultDescendingAngle - defaultAngleRange) * 180 / PI, (defaultDescendingAngle + defaultAngleRange) * 180 / PI, "%0f deg")) {
 				needToReset = true;
 			}
-			angle2minutesAndSeconds(str, sizeof(str), "Descending angle = ", descendingAngle);
+			angle2minutesAndSeconds(str, sizeof(str), "Descending angle = ", model.descendingAngle);
 			ImGui::Text(str);
 
 
@@ -130,37 +117,310 @@ public:
 			ImGui::TreePop();
 		}
 
-		if (ImGui::TreeNodeEx("Gallery"))
+		if (ImGui::TreeNode("Tracing"))
+		{
+			ImGui::RadioButton("Rays", &fanBackend, RaysBackend);
+
+			ImGui::RadioButton("Record hits, click a wall to list rays", &fanBackend, HitsBackend);
+
+			ImGui::RadioButton("Beam tracing", &fanBackend, BeamBackend);
+
+			ImGui::RadioButton("Adaptive fan", &fanBackend, AdaptiveBackend);
+			ImGui::SliderInt("Adaptive coarse rays", &adaptiveCoarseRays, 2, 200);
+			ImGui::SliderInt("Adaptive tolerance 10^-n", &adaptiveToleranceExponent, 2, 7);
+			ImGui::SliderInt("Adaptive ray cast budget", &adaptiveRayCasts, 10000, 10000000);
+
+			ImGui::RadioButton("Density buffer", &fanBackend, DensityBackend);
+			ImGui::SliderInt("Density rays", &densityRays, 1000, 4000000);
+			ImGui::SliderFloat("Density exposure", &densityBuffer.exposure, 0.1f, 1000.0f, "%.1f", 3.0f);
+
+			ImGui::RadioButton("Coherent rays, reuse walls hit in previous frame", &fanBackend, CoherentBackend);
+
+			ImGui::RadioButton("Visible sets, cast only walls seen from the wall a ray leaves", &fanBackend, VisibleSetsBackend);
+
+			ImGui::RadioButton("Path families, one path per wall sequence", &fanBackend, FamiliesBackend);
+			ImGui::SliderInt("Family rays", &familyRays, 100, 1000000);
+			ImGui::SliderInt("Listed families", &listedFamilies, 0, 50);
+
+			ImGui::RadioButton("Sphere traced distance field", &fanBackend, DistanceFieldBackend);
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Visibility"))
+		{
+			ImGui::Checkbox("Show visibility", &enableVisibility);
+			ImGui::RadioButton("From p8", &visibilitySource, 0);
+			ImGui::SameLine();
+			ImGui::RadioButton("From p30", &visibilitySource, 1);
+			ImGui::SameLine();
+			ImGui::RadioButton("From mouse click", &visibilitySource, 2);
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Absorb containers"))
+		{
+			ImGui::RadioButton("Input fan##containers", &estimatorFan, 0);
+			ImGui::SameLine();
+			ImGui::RadioButton("Queen fan##containers", &estimatorFan, 1);
+			ImGui::SliderFloat("Diffuse part of reflection", &estimatorDiffuse, 0.0f, 1.0f, "%.2f");
+			ImGui::SliderInt("Estimator rays", &estimatorRays, 100, 1000000);
+			ImGui::SliderInt("Estimator reflections", &estimatorReflections, 1, 300);
+
+			if (ImGui::Button("Compare plain and next-event estimation")) {
+				compareEstimators();
+			}
+
+			for (int i = 0;i < estimates[1].mean.size();i++) {
+				double plainVariance = estimates[0].standardError[i] * estimates[0].standardError[i];
+				double neeVariance = estimates[1].standardError[i] * estimates[1].standardError[i];
+				ImGui::Text("container %d: plain %.5f +- %.5f  nee %.5f +- %.5f  variance ratio %.1f", i,
+					estimates[0].mean[i], estimates[0].standardError[i], estimates[1].mean[i], estimates[1].standardError[i],
+					neeVariance > 0 ? plainVariance / neeVariance : 0.0);
+			}
+			if (!estimates[1].mean.empty()) {
+				ImGui::Text("plain: %lld casts %.1f ms  nee: %lld casts + %lld shadow rays %.1f ms",
+					(long long)estimates[0].rayCasts, estimatorTime[0], (long long)estimates[1].rayCasts, (long long)estimates[1].shadowRays, estimatorTime[1]);
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Distance field"))
+		{
+			ImGui::Checkbox("Clearance at mouse click", &enableClearance);
+			if (ImGui::SliderFloat("Coarse cell", &distanceField.cellSize, 0.5f, 16.0f, "%.1f m") |
+				ImGui::SliderInt("Wall list cells per brick side", &distanceField.brickCells, 1, 16) |
+				ImGui::SliderInt("Distance samples per brick side", &distanceField.brickSamples, 1, 64)) {
+				distanceField.version = 0;
+			}
+			ImGui::SliderInt("Benchmark rays", &distanceBenchmarkRays, 100, 100000);
+
+			if (ImGui::Button("Benchmark gallery fan against b2World")) {
+				benchmarkDistanceField();
+			}
+
+			if (distanceBenchmarkTime[1] > 0) {
+				ImGui::Text("bake %.1f ms  %d bricks  %.0f kB", distanceField.buildTime, distanceField.bricks, distanceField.memory() / 1024.0);
+				ImGui::Text("%lld hits: b2World %.1f ms  segments %.1f ms  distance field %.1f ms", (long long)distanceBenchmarkHits,
+					distanceBenchmarkTime[0], distanceBenchmarkTime[1], distanceBenchmarkTime[2]);
+				ImGui::Text("paths with other walls than b2World: segments %d  distance field %d", distanceBenchmarkDiffering[0], distanceBenchmarkDiffering[1]);
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Radiosity"))
+		{
+			ImGui::Checkbox("Show radiosity", &enableRadiosity);
+			if (ImGui::Checkbox("Limestone walls", &model.limestoneWalls)) {
+				needToReset = true;
+			}
+			ImGui::RadioButton("Input fan##radiosity", &radiosityFan, 0);
+			ImGui::SameLine();
+			ImGui::RadioButton("Queen fan##radiosity", &radiosityFan, 1);
+			ImGui::SliderFloat("Patch size", &radiosity.patchSize, 0.1f, 5.0f, "%.2f m");
+			ImGui::SliderFloat("Least diffuse part", &radiosity.diffuse, 0.0f, 1.0f, "%.2f");
+			ImGui::SliderInt("Radiosity rays", &radiosityRays, 100, 1000000);
+			ImGui::Checkbox("Gauss-Seidel", &radiosity.gaussSeidel);
+
+			if (ImGui::Button("Solve")) {
+				runRadiosity();
+			}
+
+			if (!radiosity.patches.empty()) {
+				ImGui::Text("patches = %d  form factors = %d  sweeps = %d  residual = %.2e", (int)radiosity.patches.size(), radiosity.nonZeros(), radiosity.sweeps, radiosity.residual);
+				ImGui::Text("sets %.1f ms  form factors %.1f ms  solve %.1f ms  total %.1f ms", visibleSets.buildTime, radiosity.buildTime, radiosity.solveTime, radiosityTime);
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Spectral"))
+		{
+			if (ImGui::Checkbox("Granite King chamber", &model.graniteKingChamber)) {
+				needToReset = true;
+			}
+			if (ImGui::Checkbox("Glass prism in input fan", &model.inputPrism)) {
+				needToReset = true;
+			}
+			ImGui::RadioButton("Input fan##spectral", &spectralFan, 0);
+			ImGui::SameLine();
+			ImGui::RadioButton("Queen fan##spectral", &spectralFan, 1);
+			ImGui::SliderInt("Spectral rays", &spectralRays, 100, 1000000);
+			ImGui::SliderInt("Wavelengths 0.4-0.7 um", &spectralWavelengths, 1, SPECTRAL_LANES);
+
+			if (ImGui::Button("Trace spectrum")) {
+				traceSpectrum();
+			}
+
+			int count = (int)spectral.escaped.size();
+			if (count > 0) {
+				ImGui::Text("ray casts = %lld  bundles = %lld  splits = %lld  time = %.1f ms", (long long)spectral.rayCasts, (long long)spectral.bundles, (long long)spectral.splits, spectralTime);
+				std::vector<float> contained(count, 0.0f);
+				for (int w = 0;w < count;w++) {
+					for (int j = 0;j < spectral.containers.size();j++) {
+						contained[w] += (float)spectral.contained[j * count + w];
+					}
+				}
+				ImGui::PlotLines("Contained by wavelength", contained.data(), count, 0, nullptr, 0.0f, 1.0f, ImVec2(0, 60));
+				for (int w = 0;w < count;w++) {
+					ImGui::Text("%.3f um: contained %.4f  absorbed %.4f  escaped %.4f  dissipated %.4f", spectral.wavelengths[w],
+						contained[w], spectral.absorbed[w], spectral.escaped[w], spectral.dissipated[w]);
+				}
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Celestial alignment"))
+		{
+			ImGui::SliderInt("First year", &celestialFirstYear, -10000, 2000);
+			ImGui::SliderInt("Last year", &celestialLastYear, -10000, 2000);
+			ImGui::SliderInt("Epochs", &alignment.epochs, 2, 100000);
+			ImGui::SliderInt("Alignment rays", &alignment.rays, 10, 2000);
+			ImGui::SliderInt("Alignment reflections", &alignment.maximumReflections, 0, 20);
+			ImGui::Checkbox("Sun##celestial", &alignment.sun);
+			ImGui::RadioButton("Corridor bottom", &celestialTarget, 0);
+			ImGui::SameLine();
+			ImGui::RadioButton("Gallery entrance", &celestialTarget, 1);
+
+			if (ImGui::Button("Run alignment")) {
+				runAlignment();
+			}
+
+			if (!alignment.samples.empty()) {
+				ImGui::Text("pairs = %lld  ray casts = %lld  time = %.1f ms", (long long)alignment.pairs(), (long long)alignment.rayCasts, alignmentTime);
+				std::vector<float> peak(alignment.epochs);
+				for (int o = 0;o < alignment.objects();o++) {
+					int best = 0;
+					for (int e = 0;e < alignment.epochs;e++) {
+						peak[e] = alignment.sample(o, e).peak;
+						if (peak[e] > peak[best]) {
+							best = e;
+						}
+					}
+					const CelestialAlignment::Sample& s = alignment.sample(o, best);
+					if (s.peak > 0) {
+						ImGui::PlotLines(alignment.objectName(o), peak.data(), alignment.epochs, 0, nullptr, 0.0f, 1.0f, ImVec2(0, 40));
+						ImGui::Text("best year %.0f: peak %.3f at %.2f deg, daily %.5f", alignment.year(best), s.peak, s.elevation, s.daily);
+					}
+					else {
+						ImGui::Text("%s: not transmitted", alignment.objectName(o));
+					}
+				}
+			}
+
+			ImGui::Checkbox("Show star at northern transit", &enableCelestialRay);
+			ImGui::SliderInt("Star", &celestialStar, 0, catalogStarsCount - 1, catalogStars[celestialStar].name);
+			ImGui::SliderInt("Year", &celestialYear, -10000, 2000);
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Survey uncertainty"))
 		{
-			if (ImGui::Checkbox("Ceiling parallel to floor", &ceilingParallelToFloor)) {
+			ImGui::SliderInt("Variants", &uncertainty.variants, 10, 100000);
+			ImGui::SliderInt("Rays per fan", &uncertainty.rays, 10, 10000);
+			ImGui::SliderInt("Variant reflections", &uncertainty.maximumReflections, 1, 300);
+			ImGui::Checkbox("Reject invalid geometry", &uncertainty.validate);
+
+			if (ImGui::Button("Run variants")) {
+				runUncertainty();
+			}
+
+			if (!uncertainty.outcomes.empty()) {
+				ImGui::Text("%d variants (%d rejected)  build %.3f ms  trace %.3f ms per variant  total %.1f ms", uncertainty.variants, uncertainty.rejectedCount,
+					uncertainty.buildMilliseconds / uncertainty.variants, uncertainty.traceMilliseconds / uncertainty.variants, uncertaintyTime);
+				for (int i = 0;i < UncertaintyOutcomeCount;i++) {
+					const OutcomeStatistics& s = uncertainty.statistics[i];
+					ImGui::Text("%s: %.4f +- %.4f  5%% %.4f  median %.4f  95%% %.4f", uncertaintyOutcomeName(i), s.mean, s.deviation, s.percentile5, s.median, s.percentile95);
+					ImGui::PlotHistogram(uncertaintyOutcomeName(i), s.histogram.data(), (int)s.histogram.size(), 0, nullptr, 0.0f, 3.4e38f, ImVec2(0, 50));
+				}
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Receiver"))
+		{
+			ImGui::Checkbox("Show receiver", &enableReceiver);
+			ImGui::RadioButton("King chamber", &receiverChamber, 0);
+			ImGui::SameLine();
+			ImGui::RadioButton("Lower chamber", &receiverChamber, 1);
+			ImGui::RadioButton("Input fan", &receiverFan, 0);
+			ImGui::SameLine();
+			ImGui::RadioButton("Queen fan", &receiverFan, 1);
+
+			ImGui::SliderInt("Receiver bins", &receiverBins, 16, 65536);
+			ImGui::SliderInt("Receiver rays", &receiverRays, 1000, 10000000);
+			ImGui::SliderFloat("Shortest wavelength", &receiverShortestWavelength, 0.001f, 2.0f, "%.4f m", 3.0f);
+			ImGui::SliderFloat("Longest wavelength", &receiverLongestWavelength, 0.001f, 2.0f, "%.4f m", 3.0f);
+			ImGui::SliderInt("Wavelengths", &receiverWavelengths, 1, 256);
+
+			if (ImGui::Button("Accumulate")) {
+				accumulateReceiver();
+			}
+
+			if (!receiverProfile.empty()) {
+				ImGui::Text("paths = %lld  crossings = %lld  time = %.1f ms", (long long)receiver.paths, (long long)receiver.crossings, receiverTime);
+				ImGui::PlotLines("Intensity", receiverProfile.data(), (int)receiverProfile.size(), 0, nullptr, 0.0f, 3.4e38f, ImVec2(0, 120));
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Moving parts"))
+		{
+			if (ImGui::Checkbox("Gallery ceiling and King chamber block on own bodies", &model.movingParts)) {
 				needToReset = true;
 			}
+			if (ImGui::SliderFloat("King chamber block lift", &model.kingChamberBlockLift, 0.0f, 1.5f, "%.3f m")) {
+				partsChanged();
+			}
+			ImGui::Checkbox("Animate", &animateParts);
 
-			if (ImGui::SliderFloat("Ceiling Vertical Offset", &galleryCeilingOffset, 0.0f, 12.0f, "%.3f")) {
+			if (model.movingParts) {
+				std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+				ImGui::Text("move and refit %.3f ms (%s)  full rebuild %.3f ms", refitTime,
+					snapshot->refitted ? "tree refitted" : "rebuilt", rebuildTime);
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNodeEx("Gallery"))
+		{
+			if (ImGui::Checkbox("Ceiling parallel to floor", &model.ceilingParallelToFloor)) {
 				needToReset = true;
 			}
 
+			if (ImGui::SliderFloat("Ceiling Vertical Offset", &model.galleryCeilingOffset, 0.0f, 12.0f, "%.3f")) {
+				partsChanged();
+			}
+
 			// Gallery Left Wall Mode ratio group
 			{
-				if (ImGui::RadioButton("Left Wall levels is Horizontal", &leftGalleryWallMode,Horizontal)) {
-					leftGalleryWallMode = Horizontal;
+				if (ImGui::RadioButton("Left Wall levels is Horizontal", &model.leftGalleryWallMode,Horizontal)) {
+					model.leftGalleryWallMode = Horizontal;
 					needToReset = true;
 				}
 				ImGui::SameLine();
-				if (ImGui::RadioButton("Left Wall levels is Parallel", &leftGalleryWallMode,Parallel)) {
-					leftGalleryWallMode = Parallel;
+				if (ImGui::RadioButton("Left Wall levels is Parallel", &model.leftGalleryWallMode,Parallel)) {
+					model.leftGalleryWallMode = Parallel;
 					needToReset = true;
 				}
 			}
 
 			{
-				if (ImGui::RadioButton("Right Wall levels is Horizontal", &rightGalleryWallMode, Horizontal)) {
-					rightGalleryWallMode = Horizontal;
+				if (ImGui::RadioButton("Right Wall levels is Horizontal", &model.rightGalleryWallMode, Horizontal)) {
+					model.rightGalleryWallMode = Horizontal;
 					needToReset = true;
 				}
 				ImGui::SameLine();
-				if (ImGui::RadioButton("Right Wall levels is Parallel", &rightGalleryWallMode, Parallel)) {
-					rightGalleryWallMode = Parallel;
+				if (ImGui::RadioButton("Right Wall levels is Parallel", &model.rightGalleryWallMode, Parallel)) {
+					model.rightGalleryWallMode = Parallel;
 					needToReset = true;
 				}
 			}
@@ -168,18 +428,18 @@ public:
 			{
 				ImGui::Text("Beams material type:");
 				ImGui::SameLine();
-				if (ImGui::RadioButton("Absorb", &galleryBeamsMode, Absorb)) {
-					galleryBeamsMode = Absorb;
+				if (ImGui::RadioButton("Absorb", &model.galleryBeamsMode, Absorb)) {
+					model.galleryBeamsMode = Absorb;
 					needToReset = true;
 				}
 				ImGui::SameLine();
-				if (ImGui::RadioButton("Transparent", &galleryBeamsMode, Transparent)) {
-					galleryBeamsMode = Transparent;
+				if (ImGui::RadioButton("Transparent", &model.galleryBeamsMode, Transparent)) {
+					model.galleryBeamsMode = Transparent;
 					needToReset = true;
 				}
 				ImGui::SameLine();
-				if (ImGui::RadioButton("Reflect", &galleryBeamsMode, Reflect)) {
-					galleryBeamsMode = Reflect;
+				if (ImGui::RadioButton("Reflect", &model.galleryBeamsMode, Reflect)) {
+					model.galleryBeamsMode = Reflect;
 					needToReset = true;
 				}
 			}
@@ -191,9 +451,76 @@ public:
 		ImGui::End();
 	}
 
+	// static walls first, then moving parts
+	std::vector<b2Body*> sceneBodies() const {
+		std::vector<b2Body*> bodies(1, pyramidBody);
+		if (ceilingBody) {
+			bodies.push_back(ceilingBody);
+			bodies.push_back(blockBody);
+		}
+		return bodies;
+	}
+
+	void partsChanged() {
+		if (model.movingParts) {
+			needToMove = true;
+		}
+		else {
+			needToReset = true;
+		}
+	}
+
+	// gallery ceiling and King chamber block on bodies of their own, valid after model.build()
+	void createMovingParts() {
+		if (!model.movingParts) {
+			return;
+		}
+		ceilingBody = m_world->CreateBody(&bd);
+		model.buildGalleryCeiling(ceilingBody);
+		builtCeilingOffset = model.galleryCeilingOffset;
+
+		b2BodyDef blockDef = bd;
+		blockDef.position = model.kingChamberBlockPosition();
+		blockBody = m_world->CreateBody(&blockDef);
+		model.buildKingChamberBlock(blockBody, b2Vec2(0, 0));
+	}
+
+	void destroyMovingParts() {
+		if (ceilingBody) {
+			m_world->DestroyBody(ceilingBody);
+			m_world->DestroyBody(blockBody);
+		}
+		ceilingBody = nullptr;
+		blockBody = nullptr;
+	}
+
+	// block slides by its transform, ceiling gets new chain on its own body. Static walls, their
+	// segments and b2World proxies stay, scene and snapshot segments of parts move and trees are refitted.
+	void moveParts() {
+		b2Timer timer;
+		if (model.galleryCeilingOffset != builtCeilingOffset) {
+			while (ceilingBody->GetFixtureList()) {
+				ceilingBody->DestroyFixture(ceilingBody->GetFixtureList());
+			}
+			model.buildGalleryCeiling(ceilingBody);
+			builtCeilingOffset = model.galleryCeilingOffset;
+		}
+		blockBody->SetTransform(model.kingChamberBlockPosition(), 0);
+
+		std::vector<b2Body*> bodies = sceneBodies();
+		if (!scene.refit(bodies)) {
+			// ceiling steps appeared or disappeared
+			scene.update(m_world, bodies);
+			pickedSegment = -1;
+		}
+		snapshots.refit(bodies);
+		densityDirty = true;
+		refitTime = timer.GetMilliseconds();
+	}
+
 	void drawNiche(b2Vec2 bottomCenter,float width, float hight) {
-		b2Vec2 p1 = bottomCenter + b2Vec2(width / 2, -width * tan(ascendingAngle) / 2);
-		b2Vec2 p2 = bottomCenter + b2Vec2(-width / 2, width * tan(ascendingAngle) / 2);
+		b2Vec2 p1 = bottomCenter + b2Vec2(width / 2, -width * tan(model.ascendingAngle) / 2);
+		b2Vec2 p2 = bottomCenter + b2Vec2(-width / 2, width * tan(model.ascendingAngle) / 2);
 		b2Vec2 p3 = bottomCenter + b2Vec2(-width / 2, hight);
 		b2Vec2 p4 = bottomCenter + b2Vec2(width / 2, hight);
 		g_debugDraw.DrawSegment(p1, p2, b2Color(0, 0.5f, 0));
@@ -205,32 +532,83 @@ public:
 	void Step(Settings& settings) override
 	{
 		if (needToReset) {
+			b2Timer timer;
 			m_world->DestroyBody(pyramidBody);
+			destroyMovingParts();
 
 			pyramidBody = m_world->CreateBody(&bd);
-			buildPyramid(pyramidBody);
+			model.build(pyramidBody);
+			createMovingParts();
+			scene.update(m_world, sceneBodies());
+			snapshots.publish(sceneBodies());
+			validator.validate(&scene.segments);
+			rebuildTime = timer.GetMilliseconds();
+			radiosity.patches.clear();
+			densityDirty = true;
+			pickedSegment = -1;
 
 			needToReset = false;
 		}
 
+		if (animateParts && model.movingParts && !settings.m_pause) {
+			animationTime += 1 / settings.m_hertz;
+			model.kingChamberBlockLift = 0.6f * (1 - cos(animationTime));
+			model.galleryCeilingOffset = 1 + 0.5f * sin(0.5f * animationTime);
+			needToMove = true;
+		}
+
+		if (needToMove && model.movingParts) {
+			moveParts();
+		}
+		needToMove = false;
+
+		densityFans.clear();
+		hitIndex.clear();
+
 		if (enableInputRay) {
-			drawRainbowRay(
-				m_world,
-				p[14] + border0_top * b2Vec2(sin(descendingAngle), -cos(descendingAngle)),
-				p[13] + border0_bottom * b2Vec2(-sin(descendingAngle), cos(descendingAngle)),
-				angle0 + PI,
-				50
-			);
+			drawFan("Input", model.inputFan());
 		}
 
 		if (enableQueenRay) {
-			drawRainbowRay(
-				m_world,
-				p[39],
-				p[42],
-				queenAngle,
-				50
-			);
+			drawFan("Queen", model.queenFan(queenAngle));
+		}
+
+		if (enableCelestialRay) {
+			float elevation;
+			if (alignment.northernTransit(celestialStar, celestialYear, &elevation)) {
+				RayFan fan;
+				model.descendingEntrance(&fan.start, &fan.end);
+				fan.angle = PI + (float)Ephemeris::radians(elevation);
+				drawFan(catalogStars[celestialStar].name, fan);
+			}
+		}
+
+		if (fanBackend == DensityBackend) {
+			drawDensity();
+		}
+
+		if (enableReceiver) {
+			drawReceiver();
+		}
+
+		if (enableVisibility) {
+			drawVisibility();
+		}
+
+		if (fanBackend == HitsBackend) {
+			drawPickedHits();
+		}
+
+		if (validator.issueCount() > 0) {
+			drawGeometryIssues();
+		}
+
+		if (enableRadiosity) {
+			drawRadiosity();
+		}
+
+		if (enableClearance) {
+			drawClearance();
 		}
 
 		for (int i = 0;i < sizeof(p) / sizeof(p[0]);i++) {
@@ -380,14 +758,14 @@ public:
 				char name[16];
 
 				// small hole
-				b2Vec2 step_i = p[91] + stepSize * i * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+				b2Vec2 step_i = p[91] + stepSize * i * b2Vec2(-cos(model.ascendingAngle), sin(model.ascendingAngle));
 
-				b2Vec2 p0 = step_i + cubit * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
+				b2Vec2 p0 = step_i + cubit * b2Vec2(-sin(model.ascendingAngle), -cos(model.ascendingAngle));
 				g_debugDraw.DrawSegment(step_i, p0, b2Color(0, 0.5f, 0));
 
-				b2Vec2 p1 = step_i + GALLERY_HOLE_SHORT_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
-				b2Vec2 p3 = step_i + (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-				b2Vec2 p2 = p3 + GALLERY_HOLE_SHORT_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
+				b2Vec2 p1 = step_i + GALLERY_HOLE_SHORT_DEPTH * b2Vec2(-sin(model.ascendingAngle), -cos(model.ascendingAngle));
+				b2Vec2 p3 = step_i + (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(model.ascendingAngle), sin(model.ascendingAngle));
+				b2Vec2 p2 = p3 + GALLERY_HOLE_SHORT_DEPTH * b2Vec2(-sin(model.ascendingAngle), -cos(model.ascendingAngle));
 
 				g_debugDraw.DrawSegment(step_i, p1, b2Color(0, 0.5f, 0.5f));
 				g_debugDraw.DrawSegment(p1, p2, b2Color(0, 0.5f, 0.5f));
@@ -399,10 +777,10 @@ public:
 				
 
 				// long hole
-				b2Vec2 p4 = p3 + GALLERY_HOLES_SPACE_MUL*stepSize * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-				b2Vec2 p5 = p4 + GALLERY_HOLE_LONG_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
-				b2Vec2 p7 = p4 + (GALLERY_HOLE_LONG_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-				b2Vec2 p6 = p7 + GALLERY_HOLE_LONG_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
+				b2Vec2 p4 = p3 + GALLERY_HOLES_SPACE_MUL*stepSize * b2Vec2(-cos(model.ascendingAngle), sin(model.ascendingAngle));
+				b2Vec2 p5 = p4 + GALLERY_HOLE_LONG_DEPTH * b2Vec2(-sin(model.ascendingAngle), -cos(model.ascendingAngle));
+				b2Vec2 p7 = p4 + (GALLERY_HOLE_LONG_WIDTH_MUL * stepSize) * b2Vec2(-cos(model.ascendingAngle), sin(model.ascendingAngle));
+				b2Vec2 p6 = p7 + GALLERY_HOLE_LONG_DEPTH * b2Vec2(-sin(model.ascendingAngle), -cos(model.ascendingAngle));
 
 				g_debugDraw.DrawSegment(p4, p5, b2Color(0, 0.5f, 0.5f));
 				g_debugDraw.DrawSegment(p5, p6, b2Color(0, 0.5f, 0.5f));
@@ -415,7 +793,7 @@ public:
 				if (i > 0) {
 					// short cutting
 					b2Vec2 p8 = step_i + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.19f);
-					b2Vec2 p9 = p8 + (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+					b2Vec2 p9 = p8 + (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(model.ascendingAngle), sin(model.ascendingAngle));
 					b2Vec2 p10 = p9 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
 					b2Vec2 p11 = p8 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
 					g_debugDraw.DrawSegment(p8, p9, b2Color(0, 0.5f, 0.5f));
@@ -426,7 +804,7 @@ public:
 					if (i < 13) {
 						// long cutting
 						b2Vec2 p12 = p4 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.19f);
-						b2Vec2 p13 = p12 + (GALLERY_HOLE_LONG_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
+						b2Vec2 p13 = p12 + (GALLERY_HOLE_LONG_WIDTH_MUL * stepSize) * b2Vec2(-cos(model.ascendingAngle), sin(model.ascendingAngle));
 						b2Vec2 p14 = p13 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
 						b2Vec2 p15 = p12 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
 						g_debugDraw.DrawSegment(p12, p13, b2Color(0, 0.5f, 0.5f));
@@ -440,10 +818,10 @@ public:
 						drawNiche(b2Vec2((p3.x + step_i.x) / 2, (p3.y + step_i.y) / 2), w, h);
 						drawNiche(b2Vec2((p7.x + p4.x) / 2, (p7.y + p4.y) / 2), w, h);
 
-						drawRay(m_world, Ray(p12, 100, PI / 2 - ascendingAngle, 0), b2Color(0, 0.5f, 0.5f));
+						drawBounces<0>(&scene, Ray(p12, 100, PI / 2 - model.ascendingAngle, 0), b2Color(0, 0.5f, 0.5f));
 					}
 
-					drawRay(m_world, Ray(p8, 100, PI / 2 - ascendingAngle, 0), b2Color(0, 0.5f, 0.5f));
+					drawBounces<0>(&scene, Ray(p8, 100, PI / 2 - model.ascendingAngle, 0), b2Color(0, 0.5f, 0.5f));
 
 				}
 			}
@@ -453,489 +831,621 @@ public:
 		Test::Step(settings);
 	}
 
-	static Test* Create()
-	{
-		return new Piramid;
+	// problems found by validator after the last rebuild, gaps and crossings let rays escape
+	void drawGeometryIssues() {
+		b2Color colors[GeometryIssueTypeCount] = { b2Color(1, 0, 0), b2Color(1, 1, 0), b2Color(0, 1, 1), b2Color(1, 0, 1) };
+		for (int i = 0;i < validator.issues.size();i++) {
+			const GeometryIssue& issue = validator.issues[i];
+			g_debugDraw.DrawPoint(issue.point, 8, colors[issue.type]);
+		}
+
+		g_debugDraw.DrawString(5, m_textLine, "geometry %s: gaps = %d  T-junctions = %d  duplicates = %d  crossings = %d  open ends = %d",
+			validator.valid() ? "valid" : "INVALID", validator.counts[GeometryGap], validator.counts[GeometryTJunction],
+			validator.counts[GeometryDuplicate], validator.counts[GeometryCrossing], validator.openEnds);
+		m_textLine += m_textIncrement;
 	}
 
-private:
-	enum GalleryWallsMode
-	{
-		Horizontal,
-		Parallel
-	};
+	// patches colored from blue to red by log of irradiance over 4 decades, drawn just off their side
+	void drawRadiosity() {
+		float largest = radiosity.largestIrradiance();
+		if (largest <= 0) {
+			return;
+		}
+		for (int i = 0;i < radiosity.patches.size();i++) {
+			const RadiosityPatch& patch = radiosity.patches[i];
+			if (radiosity.irradiance[i] <= 0) {
+				continue;
+			}
+			float level = b2Clamp(1 + log10f(radiosity.irradiance[i] / largest) / 4, 0.0f, 1.0f);
+			b2Vec2 d = patch.end - patch.start;
+			b2Vec2 n = (0.03f / d.Length()) * b2Vec2(-d.y, d.x);
+			if (patch.side == 1) {
+				n = -n;
+			}
+			g_debugDraw.DrawSegment(patch.start + n, patch.end + n, b2Color(level, 0.2f, 1 - level));
+		}
 
-	enum MaterialType
-	{
-		Transparent,
-		Reflect,
-		Absorb
-	};
+		g_debugDraw.DrawString(5, m_textLine, "radiosity: largest irradiance %.4f  %d sweeps  residual %.2e", largest, radiosity.sweeps, radiosity.residual);
+		m_textLine += m_textIncrement;
+	}
 
-	// control parameters 
-	float ascendingAngle = defaultAscendingAngle;
-	float descendingAngle = defaultDescendingAngle;
-	bool showCorridorsCrossingProblem = false;
-	bool enableInputRay = false;
+	// traces light fan with the selected method
+	void drawFan(const char* name, RayFan fan) {
+		switch (fanBackend) {
+		case HitsBackend:
+			drawRainbowRay(&scene, fan.start, fan.end, fan.angle, 50, &hitIndex);
+			break;
+		case BeamBackend:
+			drawBeam(&beamTracer, fan.start, fan.end, fan.angle);
+			drawBeamStatistics(name);
+			break;
+		case AdaptiveBackend:
+			drawAdaptiveFan(name, fan);
+			break;
+		case DensityBackend:
+			densityFans.push_back(fan);
+			break;
+		case CoherentBackend:
+			drawCoherentFan(name, fan);
+			break;
+		case VisibleSetsBackend:
+			drawVisibleSetsFan(name, fan);
+			break;
+		case FamiliesBackend:
+			drawFamiliesFan(name, fan);
+			break;
+		case DistanceFieldBackend:
+			drawDistanceFieldFan(name, fan);
+			break;
+		default:
+			drawRainbowRay(&scene, fan.start, fan.end, fan.angle, 50);
+		}
+	}
 
-	bool enableQueenRay = false;
-	float queenAngle = PI / 6;
+	// retraced only when scene, fan or settings changed, otherwise drawn from the cached segments
+	void drawAdaptiveFan(const char* name, RayFan fan) {
+		AdaptiveFan& adaptive = adaptiveFans[name];
+		adaptive.coarseRays = adaptiveCoarseRays;
+		adaptive.tolerance = pow(10.0f, -adaptiveToleranceExponent);
+		adaptive.maximumRayCasts = adaptiveRayCasts;
+		adaptive.update(&scene, snapshots.acquire()->version, fan);
+
+		for (int i = 0;i < adaptive.segments.size();i++) {
+			const FanSegment& segment = adaptive.segments[i];
+			g_debugDraw.DrawSegment(segment.source, segment.point, rainbowColor(segment.t));
+		}
 
-	bool ceilingParallelToFloor = true;
-	float galleryCeilingOffset = 1;
-	int leftGalleryWallMode  = Horizontal;      // http://thepyramids.org/images/giza/231_026_great_pyramid.jpg
-	int rightGalleryWallMode = Parallel;
+		g_debugDraw.DrawString(5, m_textLine, "%s adaptive fan: rays = %d  ray casts = %d  boundaries = %d  absorbed = %.4f%%  (uniform equivalent %.0f rays)  %.1f ms", name,
+			(int)adaptive.samples.size(), adaptive.rayCasts, adaptive.boundaries(), 100 * adaptive.absorbedFraction(), 1 / adaptive.tolerance, adaptive.traceTime);
+		m_textLine += m_textIncrement;
+		if (adaptive.unresolved > 0) {
+			g_debugDraw.DrawString(5, m_textLine, "%s adaptive fan: ray cast budget spent, %d boundaries not refined to tolerance", name, adaptive.unresolved);
+			m_textLine += m_textIncrement;
+		}
+	}
 
-	int galleryBeamsMode = Absorb;
+	// same rays as drawRainbowRay(), every fan keeps wall sequences of its rays for the next frame
+	void drawCoherentFan(const char* name, RayFan fan) {
+		b2Timer timer;
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		CoherenceHints& hints = coherence[name];
+		int rays = 50;
+		hints.prepare(rays, Ray(fan.start, 100, fan.angle).maximumReflections, snapshot->segments.count);
+
+		drawRainbowFan(fan, rays, [&](int i, Ray ray, RainbowSegment segment) {
+			HintedScene hinted = hints.scene(snapshot.get(), i);
+			traceRay(&hinted, ray, segment);
+		});
+
+		g_debugDraw.DrawString(5, m_textLine, "%s coherent fan: hints answered %.1f%% of %lld ray casts  %.3f ms", name,
+			100 * hints.hitRate(), (long long)(hints.predicted + hints.fallbacks), timer.GetMilliseconds());
+		m_textLine += m_textIncrement;
+	}
 
-	b2BodyDef bd;
-	b2Body* pyramidBody;
+	// same rays as drawRainbowRay(), sets are rebuilt when the scene changed
+	void drawVisibleSetsFan(const char* name, RayFan fan) {
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		visibleSets.update(snapshot.get());
+		b2Timer timer;
 
+		drawRainbowFan(fan, 50, [&](int i, Ray ray, RainbowSegment segment) {
+			VisibleScene visible = visibleSets.scene(snapshot.get());
+			traceRay(&visible, ray, segment);
+		});
 
-	bool needToReset = false;
+		g_debugDraw.DrawString(5, m_textLine, "%s visible sets: %.1f of %d walls per set (built in %.1f ms)  %.3f ms", name,
+			visibleSets.averageSet(), visibleSets.walls, visibleSets.buildTime, timer.GetMilliseconds());
+		m_textLine += m_textIncrement;
+	}
 
-	b2Vec2 p[92];
-
-	void buildPyramid(b2Body* body) {
-		
-		// main points
-		p[0] = b2Vec2(0, 0);
-		p[1] = p[0] + b2Vec2(0, HEIGHT);
-		p[2] = p[0] + b2Vec2(WIDTH / 2, 0);
-		p[3] = p[0] + HEIGHT * (b2Vec2(0, 1) + b2Vec2(sin(2 * VERTICAL_ANGLE), -cos(2 * VERTICAL_ANGLE)));
-		p[4] = p[3] + b2Vec2(0, -HEIGHT);
-		p[5] = b2Vec2(0, p[4].y);
-		p[6] = p[0] + b2Vec2(p[3].x, KINGS_CHAMBER_LEVEL);
-		p[7] = p[0] + b2Vec2(0, KINGS_CHAMBER_LEVEL);
-		
-		p[9] = crossPoint(p[1], p[2], p[5], p[6]);
-		p[8] = p[9]+28.21f*b2Vec2(-cos(descendingAngle),-sin(descendingAngle));
-
-		p[11] = crossPoint(p[1], p[2], p[8], p[8] + 100 * b2Vec2(cos(descendingAngle), sin(descendingAngle)));
-		p[13] = p[8] + b2Vec2(-77.13f * cos(descendingAngle), -77.13f * sin(descendingAngle));
-		p[14] = p[13] + 1.2f * b2Vec2(-sin(descendingAngle), cos(descendingAngle));
-		p[16] = p[8] + b2Vec2(-39.28f  * cos(ascendingAngle), 39.28f * sin(ascendingAngle)),
-		p[21] = p[16] + b2Vec2(-0.61f * cos(ascendingAngle), 0.61f * sin(ascendingAngle)) + 1.2f * b2Vec2(sin(ascendingAngle), cos(ascendingAngle));
-		p[19] = p[8] + 1.2f * b2Vec2(-sin(descendingAngle), cos(descendingAngle));
-		p[15] = crossPoint(p[8], p[16], p[14], p[19]);
-		p[17] = p[8] + 1.2f * b2Vec2(sin(ascendingAngle), cos(ascendingAngle));
-		p[18] = p[16] + 1.2f * b2Vec2(sin(ascendingAngle), cos(ascendingAngle));
-		p[20] = p[11] + 1.2f * b2Vec2(-sin(descendingAngle), cos(descendingAngle));
-		p[22] = p[8] + b2Vec2(0,1.2f/cos(descendingAngle));
-		p[10] = crossPoint(p[19], p[20], p[17], p[18]);
-		p[12] = crossPoint(p[19], p[20], p[1], p[2]);
-		p[23] = p[16] + 46.12f * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-		p[24] = p[23] + 1.73f * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-		p[25] = p[16] + b2Vec2(-0.61f * cos(ascendingAngle), 0.61f * sin(ascendingAngle)) + b2Vec2(-0.15f * tan(ascendingAngle), -0.15f);
-		p[26] = p[25] + b2Vec2(-(3.85f+0.68f), 1.17f);
-		p[30] = b2Vec2(p[23].x,p[26].y);
-
-		p[31] = p[30] + b2Vec2(0, QUEEN_CHAMBER_HEIGHT - QUEEN_CHAMBER_CENTER_LEVEL);
-		p[32] = p[30] + b2Vec2(0, -QUEEN_CHAMBER_CENTER_LEVEL);
-		p[33] = p[32] - b2Vec2(QUEEN_CHAMBER_WIDTH / 2, 0);
-		p[34] = p[32] + b2Vec2(QUEEN_CHAMBER_WIDTH / 2, 0);
-
-		p[35] = crossPoint(p[33], p[33] + b2Vec2(0, 2 * QUEEN_CHAMBER_HEIGHT), p[31], p[31] + 5.09f * b2Vec2(-cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
-		p[36] = crossPoint(p[34], p[34] + b2Vec2(0, 2 * QUEEN_CHAMBER_HEIGHT), p[31], p[31] + 5.09f * b2Vec2(cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
-		
-
-		p[37] = b2Vec2(p[30].x + QUEEN_CHAMBER_WIDTH / 2, p[26].y);
-		p[38] = crossPoint(p[31], p[37], p[33], p[34]);
-		p[39] = crossPoint(p[35], p[37], p[33], p[34]);
-		p[40] = p[25]+b2Vec2(-(33.2f - (p[16].x - p[25].x)), 0);
-
-		p[42] = p[40] + b2Vec2( -(p[40].y - p[32].y)*(p[39]-p[35]).x/(p[35]-p[33]).y,-(p[40].y - p[32].y));
-		p[43] = p[34] + b2Vec2(-(41.16f - 38.70f), 0);
-		p[44] = p[43] + b2Vec2(-1.57f, 0);
-
-		p[47] = p[31] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER);
-		p[45] = crossPoint(p[35] + b2Vec2(0, -0.14f), p[35] + b2Vec2(-1, -0.14f), p[47], p[47] + 5.09f * b2Vec2(-cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
-		p[46] = crossPoint(p[36] + b2Vec2(0, -0.14f), p[36] + b2Vec2(1, -0.14f), p[47], p[47] + 5.09f * b2Vec2(cos(QUEEN_CHAMBER_ROOF_ANGLE), -sin(QUEEN_CHAMBER_ROOF_ANGLE)));
-
-		p[48] = p[24] + b2Vec2(0, (43.03f - 42.9f));
-		p[49] = p[23] + b2Vec2(0, 0.9f);
-
-		p[50] = p[48] + b2Vec2(0, 1.11f);
-
-		
-		p[51] = crossPoint(p[24],p[23], b2Vec2(p[50].x + 0.55f,p[50].y), b2Vec2(p[50].x + 0.55f,p[50].y-10));
-		p[52] = p[51] + b2Vec2(0, 8.74f);
-
-		// http://thegreatpyramidofgiza.ca/@Giza$Grand%20Gallery$Chapter_files/image003.jpg
-		float mul1 = 4.22f / 166.2f;
-
-		float galleryWallsVertical[] = {
-			89.9f * mul1,
-			129.9f * mul1,
-			166.2f * mul1,
-			211.7f * mul1,
-			245.4f * mul1,
-			278.7f * mul1,
-			312.4f * mul1 };
-
-		// right gallery wall
-		{
-			p[61] = crossPoint(p[24], p[16], b2Vec2(p[21].x - 0.5f, p[21].y), b2Vec2(p[21].x - 0.5f, p[25].y));
-			
-			if (ceilingParallelToFloor) {
-				p[54] = p[61] + p[52]-p[51];
-			} else {
-				p[54] = p[61] + b2Vec2(0, 8.48f);
-			}
-			p[55] = crossPoint(p[21], b2Vec2(p[21].x, p[21].y - 10), p[24], p[16]);
-
-			p[56] = p[55] + b2Vec2(-0.120f, 0.120f * tan(ascendingAngle));
-			p[57] = p[56] + b2Vec2(-0.080f, 0.080f * tan(ascendingAngle));
-			p[58] = p[57] + b2Vec2(-0.090f, 0.090f * tan(ascendingAngle));
-			p[59] = p[58] + b2Vec2(-0.060f, 0.060f * tan(ascendingAngle));
-			p[60] = p[59] + b2Vec2(-0.075f, 0.075f * tan(ascendingAngle));
-
-			p[62] = p[55] + b2Vec2(0, galleryWallsVertical[0]);
-			p[63] = p[56] + b2Vec2(0, galleryWallsVertical[1]);
-			p[64] = p[57] + b2Vec2(0, galleryWallsVertical[2]);
-			p[65] = p[58] + b2Vec2(0, galleryWallsVertical[3]);
-			p[66] = p[59] + b2Vec2(0, galleryWallsVertical[4]);
-			p[67] = p[60] + b2Vec2(0, galleryWallsVertical[5]);
-			p[68] = p[61] + b2Vec2(0, galleryWallsVertical[6]);
-		}
-		
-		// left gallery wall
-		{
-			p[71] = p[24] + b2Vec2(0.09f, -0.09f * tan(ascendingAngle));
-			p[72] = p[71] + b2Vec2(0.08f, -0.08f * tan(ascendingAngle));
-			p[73] = p[72] + b2Vec2(0.07f, -0.07f * tan(ascendingAngle));
-			p[74] = p[73] + b2Vec2(0.08f, -0.08f * tan(ascendingAngle));
-			p[75] = p[74] + b2Vec2(0.10f, -0.10f * tan(ascendingAngle));
-			p[76] = p[75] + b2Vec2(0.06f, -0.06f * tan(ascendingAngle));
-
-			p[77] = p[71] + b2Vec2(0, galleryWallsVertical[0]);
-			p[78] = p[72] + b2Vec2(0, galleryWallsVertical[1]);
-			p[79] = p[73] + b2Vec2(0, galleryWallsVertical[2]);
-			p[80] = p[74] + b2Vec2(0, galleryWallsVertical[3]);
-			p[81] = p[75] + b2Vec2(0, galleryWallsVertical[4]);
-			p[82] = p[76] + b2Vec2(0, galleryWallsVertical[5]);
-			p[83] = p[51] + b2Vec2(0, galleryWallsVertical[6]);
-		}
+	// same rays as drawRainbowRay(), field is rebaked when the scene changed
+	void drawDistanceFieldFan(const char* name, RayFan fan) {
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		distanceField.update(snapshot.get());
+		b2Timer timer;
 
-		// gallery ceiling
-		{
-			float ceilingAngle = atan2(p[54].x - p[52].x, p[52].y - p[54].y) - asin(galleryCeilingOffset / sqrt((p[54] - p[52]).LengthSquared()));
-			p[84] = p[52] + galleryCeilingOffset * b2Vec2(cos(ceilingAngle), sin(ceilingAngle));
-			p[85] = p[54] - galleryCeilingOffset * b2Vec2(cos(ceilingAngle), sin(ceilingAngle));
+		drawRainbowFan(fan, 50, [&](int i, Ray ray, RainbowSegment segment) {
+			traceRay(&distanceField, ray, segment);
+		});
+
+		g_debugDraw.DrawString(5, m_textLine, "%s distance field: %d bricks (baked in %.1f ms)  %.3f ms", name,
+			distanceField.bricks, distanceField.buildTime, timer.GetMilliseconds());
+		m_textLine += m_textIncrement;
+	}
+
+	// circle of distance to the closest wall around the last click
+	void drawClearance() {
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		distanceField.update(snapshot.get());
+		float d = distanceField.distance(clearancePoint);
+		g_debugDraw.DrawCircle(clearancePoint, fabsf(d), b2Color(0, 1, 0.5f));
+		g_debugDraw.DrawString(5, m_textLine, "clearance at %.2f, %.2f: %.3f m", clearancePoint.x, clearancePoint.y, d);
+		m_textLine += m_textIncrement;
+	}
+
+	// representative path of every family colored by rank, the largest families are listed
+	void drawFamiliesFan(const char* name, RayFan fan) {
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		PathFamilies& fanFamilies = families[name];
+		fanFamilies.update(snapshot.get(), fan, familyRays);
+		std::vector<const PathFamily*> list = fanFamilies.sorted();
+
+		for (int i = 0;i < list.size();i++) {
+			const std::vector<b2Vec2>& path = list[i]->representative;
+			b2Color color = rainbowColor((float)i / list.size());
+			for (int k = 0;k + 1 < path.size();k++) {
+				g_debugDraw.DrawSegment(path[k], path[k + 1], color);
+			}
 		}
 
-		// gallery floor
-		{
-			p[90] = p[23] + b2Vec2(0, cubit / cos(ascendingAngle));
-			p[91] = p[55] + b2Vec2(0, cubit / cos(ascendingAngle));
+		g_debugDraw.DrawString(5, m_textLine, "%s families: %d of %lld rays  %lld ray casts  traced in %.1f ms", name,
+			(int)list.size(), (long long)fanFamilies.rays, (long long)fanFamilies.rayCasts, fanFamilies.traceTime);
+		m_textLine += m_textIncrement;
+		for (int i = 0;i < b2Min(listedFamilies, (int)list.size());i++) {
+			const PathFamily* family = list[i];
+			g_debugDraw.DrawString(5, m_textLine, "  %d: %lld rays (%.2f%%) fan %.4f-%.4f  %d walls  %s", i + 1, (long long)family->count,
+				100.0 * family->count / fanFamilies.rays, family->firstT, family->lastT, (int)family->walls.size(), fanFamilies.outcome(family));
+			m_textLine += m_textIncrement;
 		}
+	}
 
-		drawLine(body, p[8], p[11]);
-		drawLine(body, p[10], p[12]);
-		drawLine(body, p[8], p[13]);
-		drawLine(body, p[14], p[15]);
-		drawLine(body, p[15], p[16]);
-		drawLine(body, p[18], p[10]);
-		drawLine(body, p[21], p[18]);
+	// retraces fans into density buffer only when view, scene or fans changed, otherwise redraws the texture
+	void drawDensity() {
+		bool changed = densityDirty || densityFans.size() != tracedDensityFans.size() || densityRays != tracedDensityRays ||
+			densityCamera.m_center.x != g_camera.m_center.x || densityCamera.m_center.y != g_camera.m_center.y ||
+			densityCamera.m_zoom != g_camera.m_zoom || densityCamera.m_width != g_camera.m_width || densityCamera.m_height != g_camera.m_height;
 
+		for (int i = 0;!changed && i < densityFans.size();i++) {
+			const RayFan& a = densityFans[i];
+			const RayFan& b = tracedDensityFans[i];
+			changed = a.start.x != b.start.x || a.start.y != b.start.y || a.end.x != b.end.x || a.end.y != b.end.y || a.angle != b.angle;
+		}
 
+		if (changed) {
+			b2Timer timer;
+			std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+			densityBuffer.fitView();
+			for (int i = 0;i < densityFans.size();i++) {
+				densityBuffer.accumulateFan(snapshot.get(), densityFans[i].start, densityFans[i].end, densityFans[i].angle, densityRays, 300);
+			}
+			densityTime = timer.GetMilliseconds();
 
-		// Lower Chamber
-		{
-			NextTo LowerChamber_14[3]{
-				b2Vec2(border0_top * sin(angle0),-border0_top * cos(angle0)),
-				b2Vec2(-(8.27f - 3.21f),0),
-				b2Vec2(0, 0)
-			};
+			tracedDensityFans = densityFans;
+			tracedDensityRays = densityRays;
+			densityCamera = g_camera;
+			densityDirty = false;
+		}
 
-			p[86] = drawPath(body, p[14], LowerChamber_14);
+		if (changed || densityExposure != densityBuffer.exposure) {
+			densityBuffer.toneMap();
+			densityExposure = densityBuffer.exposure;
+		}
 
-			NextTo LowerChamber_13[3]{
-				b2Vec2(-border0_bottom * sin(descendingAngle),border0_bottom * cos(descendingAngle)),
-				b2Vec2(-8.91 - 8.28,0),
-				b2Vec2(0, 0)
-			};
-			p[88] = drawPath(body, p[13], LowerChamber_13);
+		densityBuffer.draw();
 
-			NextTo LowerChamber_88[5]{
-				b2Vec2(0,2.19f  + 0.91f),
-				b2Vec2(8.36f,0),
-				b2Vec2(0,-2.19f),
-				b2Vec2(8.78 - 7.39,0),
-				b2Vec2(0, 0)
-			};
+		g_debugDraw.DrawString(5, m_textLine, "density: %d x %d  rays = %d per fan  threads = %d  trace and rasterize = %.1f ms",
+			densityBuffer.width, densityBuffer.height, densityRays, densityBuffer.threads, densityTime);
+		m_textLine += m_textIncrement;
+	}
 
-			p[87] = drawPath(body, p[88], LowerChamber_88);
+	void MouseDown(const b2Vec2& p) override
+	{
+		if (enableVisibility && visibilitySource == 2) {
+			visibilityPoint = p;
+		}
+		if (enableClearance) {
+			clearancePoint = p;
+		}
+		if (fanBackend == HitsBackend) {
+			pickWall(p);
+		}
+		Test::MouseDown(p);
+	}
 
-			drawAbsorbContainer(body, p[86], p[87]);
+	// closest wall segment within half a meter from point
+	void pickWall(b2Vec2 point) {
+		const SegmentTable& segments = scene.segments;
+		float closest = 0.5f;
+		pickedSegment = -1;
+		for (int i = 0;i < segments.count;i++) {
+			b2Vec2 v = segments.end(i) - segments.start(i);
+			float t = b2Clamp(b2Dot(point - segments.start(i), v) / b2Max(v.LengthSquared(), b2_epsilon), 0.0f, 1.0f);
+			float distance = b2Distance(point, segments.start(i) + t * v);
+			if (distance < closest) {
+				closest = distance;
+				pickedSegment = i;
+			}
 		}
+	}
 
+	// picked wall and every recorded ray which touched it, drawn up to the touching bounce
+	void drawPickedHits() {
+		if (pickedSegment < 0) {
+			g_debugDraw.DrawString(5, m_textLine, "hits: %lld records of %d rays  %.1f KB  click a wall to pick it",
+				(long long)hitIndex.records, (int)hitIndex.rays.size(), hitIndex.memory() / 1024.0f);
+			m_textLine += m_textIncrement;
+			return;
+		}
 
+		const SegmentTable& segments = scene.segments;
+		g_debugDraw.DrawSegment(segments.start(pickedSegment), segments.end(pickedSegment), b2Color(1, 0, 1));
+
+		const b2Fixture* fixture = segments.fixture[pickedSegment];
+		int childIndex = segments.childIndex[pickedSegment];
+		const std::vector<HitRecord>& records = hitIndex.hitsOf(fixture, childIndex);
+
+		g_debugDraw.DrawString(5, m_textLine, "picked wall %d: %d hits from %d rays", pickedSegment, (int)records.size(),
+			(int)hitIndex.raysHitting(fixture, childIndex).size());
+		m_textLine += m_textIncrement;
+
+		int listed = 0;
+		for (int i = 0;i < records.size();i++) {
+			const HitRecord& record = records[i];
+			Ray ray = hitIndex.rays[record.ray];
+			ray.maximumReflections = record.bounce;
+			traceRay(&scene, ray, [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+				g_debugDraw.DrawSegment(source, callback.m_point, b2Color(1, 1, 1));
+			});
+
+			if (listed < 10) {
+				g_debugDraw.DrawString(5, m_textLine, "  ray %d  bounce %d  path %.2f m", record.ray, record.bounce, record.pathLength);
+				m_textLine += m_textIncrement;
+				listed++;
+			}
+		}
+	}
 
-		// Queen chamber
-		{
-			NextTo QueenChamber_p16[3]{
-				b2Vec2(-0.61f * cos(ascendingAngle),0.61f * sin(ascendingAngle)),
-				b2Vec2(-0.15f * tan(ascendingAngle),-0.15f),
-				b2Vec2(0,0)
-			};
-			
-			drawPath(body, p[16], QueenChamber_p16);
-			drawLine(body, p[25], p[40]);
-			drawLine(body, p[40],p[40]+ b2Vec2(0, -(p[25].y - p[32].y)));
-			drawLine(body, p[39], p[42]);
-			drawAbsorbContainer(body, p[44], p[43]);
-			drawAbsorbContainer(body, p[38], p[39]);
-			drawAbsorbContainer(body, p[42], b2Vec2(p[40].x,p[42].y));
+	// visibility polygon as triangle fan and visible parts of walls
+	void drawVisibility() {
+		b2Vec2 origin = visibilityPoint;
+		if (visibilitySource == 0) {
+			// p[8] is a wall vertex, query from just inside descending corridor
+			origin = p[8] + 0.01f * (p[19] - p[8]);
+		}
+		else if (visibilitySource == 1) {
+			origin = p[30];
 		}
 
-		// Gallery
-		// https://upload.wikimedia.org/wikipedia/commons/c/c6/PSM_V80_D462_Longitudinal_sections_of_the_grand_gallery.png
+		b2Timer timer;
+		visibility.compute(origin);
+		float time = timer.GetMilliseconds();
 
-		{
-			// Right gallery wall
-			{
-				float angle = 0;  // Horizontal
+		for (int i = 0;i + 1 < visibility.polygon.size();i += 2) {
+			b2Vec2 triangle[3] = { origin, visibility.polygon[i], visibility.polygon[i + 1] };
+			g_debugDraw.DrawSolidPolygon(triangle, 3, b2Color(0.3f, 0.3f, 0.1f, 0.3f));
+		}
 
-				if (rightGalleryWallMode == Parallel) {
-					angle = ascendingAngle;
-				}
+		const SegmentTable& segments = scene.segments;
+		float length = 0;
+		for (int i = 0;i < visibility.intervals.size();i++) {
+			const VisibleInterval& interval = visibility.intervals[i];
+			b2Vec2 v = segments.end(interval.segment) - segments.start(interval.segment);
+			g_debugDraw.DrawSegment(segments.start(interval.segment) + interval.u0 * v, segments.start(interval.segment) + interval.u1 * v, b2Color(0, 1, 0));
+			length += fabsf(interval.u1 - interval.u0) * v.Length();
+		}
 
-				drawLine(body, p[21], b2Vec2(p[21].x, p[63].y - (p[21].x - p[63].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[21].x, p[63].y - (p[21].x - p[63].x) * tan(angle)), p[63]);
+		g_debugDraw.DrawString(5, m_textLine, "visibility: intervals = %d  visible wall length = %.2f m  sweep = %.3f ms", (int)visibility.intervals.size(), length, time);
+		m_textLine += m_textIncrement;
+	}
 
-				drawLine(body, p[63], b2Vec2(p[63].x, p[64].y - (p[63].x-p[64].x)*tan(angle)));
-				drawLine(body, b2Vec2(p[63].x, p[64].y - (p[63].x - p[64].x) * tan(angle)), p[64]);
+	// same rays and scattering model with and without shadow rays to containers
+	void compareEstimators() {
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		for (int i = 0;i < 2;i++) {
+			b2Timer timer;
+			estimates[i].containers = model.containers;
+			estimates[i].diffuse = estimatorDiffuse;
+			estimates[i].maximumReflections = estimatorReflections;
+			estimates[i].nextEvent = i == 1;
+			estimates[i].trace(snapshot.get(), estimatorFan == 0 ? model.inputFan() : model.queenFan(queenAngle), estimatorRays, 1);
+			estimatorTime[i] = timer.GetMilliseconds();
+		}
+	}
 
-				drawLine(body, p[64], b2Vec2(p[64].x, p[65].y - (p[64].x-p[65].x)*tan(angle)));
-				drawLine(body, b2Vec2(p[64].x, p[65].y - (p[64].x - p[65].x) * tan(angle)), p[65]);
+	void traceSpectrum() {
+		b2Timer timer;
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		spectral.wavelengths.clear();
+		for (int i = 0;i < spectralWavelengths;i++) {
+			spectral.wavelengths.push_back(spectralWavelengths > 1 ? 0.4f + 0.3f * i / (spectralWavelengths - 1) : 0.55f);
+		}
+		spectral.containers = model.containers;
+		spectral.traceFan(snapshot.get(), spectralFan == 0 ? model.inputFan() : model.queenFan(queenAngle), spectralRays);
+		spectralTime = timer.GetMilliseconds();
+	}
 
-				drawLine(body, p[65], b2Vec2(p[65].x, p[66].y - (p[65].x-p[66].x)*tan(angle)));
-				drawLine(body, b2Vec2(p[65].x, p[66].y - (p[65].x - p[66].x) * tan(angle)), p[66]);
+	// long multi-bounce rays up the gallery through b2World, brute force over segments and distance field
+	void benchmarkDistanceField() {
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		distanceField.update(snapshot.get());
+
+		RayFan fan;
+		model.galleryEntrance(&fan.start, &fan.end);
+		fan.angle = model.ascendingAngle + 0.1f;
+		std::vector<uint64_t> sequences[3];
+		distanceBenchmarkHits = 0;
+		distanceBenchmarkTime[0] = benchmarkTrace(m_world, fan, &sequences[0], &distanceBenchmarkHits);
+		int64_t hits = 0;
+		distanceBenchmarkTime[1] = benchmarkTrace(&snapshot->segments, fan, &sequences[1], &hits);
+		distanceBenchmarkTime[2] = benchmarkTrace(&distanceField, fan, &sequences[2], &hits);
+
+		for (int k = 0;k < 2;k++) {
+			distanceBenchmarkDiffering[k] = 0;
+			for (int i = 0;i < distanceBenchmarkRays;i++) {
+				if (sequences[k + 1][i] != sequences[0][i]) {
+					distanceBenchmarkDiffering[k]++;
+				}
+			}
+		}
+	}
 
-				drawLine(body, p[66], b2Vec2(p[66].x, p[67].y - (p[66].x-p[67].x)*tan(angle)));
-				drawLine(body, b2Vec2(p[66].x, p[67].y - (p[66].x - p[67].x) * tan(angle)), p[67]);
+	// traces all benchmark rays of fan with one timer, sequences gets a hash of the walls every ray hits.
+	// Snapshot walls are named by segment index, mapped back to fixture and chain edge of scene.segments.
+	template <typename World>
+	float benchmarkTrace(World world, RayFan fan, std::vector<uint64_t>* sequences, int64_t* hits) {
+		const SegmentTable& segments = scene.segments;
+		sequences->assign(distanceBenchmarkRays, 0);
+		b2Timer timer;
+		for (int i = 0;i < distanceBenchmarkRays;i++) {
+			Ray ray(fan.start + ((i + 0.5f) / distanceBenchmarkRays) * (fan.end - fan.start), 100, fan.angle);
+			uint64_t& sequence = (*sequences)[i];
+			traceRay(world, ray, [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+				WallKey wall = { callback.m_fixture, callback.m_childIndex };
+				if (!wall.fixture && wall.childIndex < segments.count) {
+					wall = { segments.fixture[wall.childIndex], segments.childIndex[wall.childIndex] };
+				}
+				sequence = (sequence ^ WallKeyHash()(wall)) * 0x100000001b3ull;
+				(*hits)++;
+			});
+		}
+		return timer.GetMilliseconds();
+	}
 
-				drawLine(body, p[67], b2Vec2(p[67].x, p[68].y - (p[67].x - p[68].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[67].x, p[68].y - (p[67].x - p[68].x) * tan(angle)), b2Vec2(p[61].x, p[68].y));
+	// form factors between walls of the latest snapshot, then direct light of the fan and diffuse exchange
+	void runRadiosity() {
+		b2Timer timer;
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		visibleSets.update(snapshot.get());
+		radiosity.build(snapshot.get(), &visibleSets);
+		radiosity.illuminate(snapshot.get(), radiosityFan == 0 ? model.inputFan() : model.queenFan(queenAngle), radiosityRays);
+		radiosity.solve();
+		radiosityTime = timer.GetMilliseconds();
+	}
 
-				drawLine(body, p[68], p[54]);
-			}
+	// in-plane table through descending corridor entrance, then every object and epoch
+	void runAlignment() {
+		b2Timer timer;
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		alignment.firstYear = celestialFirstYear;
+		alignment.lastYear = celestialLastYear;
+		if (celestialTarget == 0) {
+			model.descendingBottom(&alignment.targetStart, &alignment.targetEnd);
+		}
+		else {
+			model.galleryEntrance(&alignment.targetStart, &alignment.targetEnd);
+		}
+		b2Vec2 a, b;
+		model.descendingEntrance(&a, &b);
+		alignment.run(snapshot.get(), a, b);
+		alignmentTime = timer.GetMilliseconds();
+	}
 
-			// Left gallery wall
-			{
-				float angle = 0;  // Horizontal
+	// perturbed variants of current model, nominal walls on pyramidBody stay as they are
+	void runUncertainty() {
+		b2Timer timer;
+		uncertainty.nominal = model;
+		uncertainty.queenAngle = queenAngle;
+		uncertainty.run();
+		uncertaintyTime = timer.GetMilliseconds();
+	}
 
-				if (leftGalleryWallMode == Parallel) {
-					angle = ascendingAngle;
-				}
+	void receiverSection(b2Vec2* a, b2Vec2* b) {
+		if (receiverChamber == 0) {
+			model.kingChamberSection(a, b);
+		}
+		else {
+			model.lowerChamberSection(a, b);
+		}
+	}
 
-				drawLine(body, p[50], b2Vec2(p[50].x, p[77].y+ (p[77].x-p[50].x)*tan(angle)));
-				drawLine(body, b2Vec2(p[50].x, p[77].y + (p[77].x - p[50].x) * tan(angle)), p[77]);
+	void accumulateReceiver() {
+		b2Vec2 a, b;
+		receiverSection(&a, &b);
 
-				drawLine(body, p[77], b2Vec2(p[77].x, p[78].y + (p[78].x - p[77].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[77].x, p[78].y + (p[78].x - p[77].x) * tan(angle)), p[78]);
+		std::vector<float> wavelengths;
+		for (int i = 0;i < receiverWavelengths;i++) {
+			float k = receiverWavelengths > 1 ? (float)i / (receiverWavelengths - 1) : 0;
+			wavelengths.push_back(receiverShortestWavelength + k * (receiverLongestWavelength - receiverShortestWavelength));
+		}
 
-				drawLine(body, p[78], b2Vec2(p[78].x, p[79].y + (p[79].x - p[78].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[78].x, p[79].y + (p[79].x - p[78].x) * tan(angle)), p[79]);
+		b2Timer timer;
+		std::shared_ptr<const SceneSnapshot> snapshot = snapshots.acquire();
+		receiver = Receiver(a, b, receiverBins, wavelengths);
+		receiver.traceFan(snapshot.get(), receiverFan == 0 ? model.inputFan() : model.queenFan(queenAngle), receiverRays, 300);
+		receiverProfile = receiver.profile();
+		receiverTime = timer.GetMilliseconds();
+	}
 
-				drawLine(body, p[79], b2Vec2(p[79].x, p[80].y + (p[80].x - p[79].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[79].x, p[80].y + (p[80].x - p[79].x) * tan(angle)), p[80]);
+	// receiver line with intensity profile drawn perpendicular to it
+	void drawReceiver() {
+		b2Vec2 a, b;
+		receiverSection(&a, &b);
+		g_debugDraw.DrawSegment(a, b, b2Color(1, 1, 0));
 
-				drawLine(body, p[80], b2Vec2(p[80].x, p[81].y + (p[81].x - p[80].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[80].x, p[81].y+ (p[81].x - p[80].x) * tan(angle)), p[81]);
+		if (receiverProfile.empty() || receiver.a != a || receiver.b != b) {
+			return;
+		}
 
-				drawLine(body, p[81], b2Vec2(p[81].x, p[82].y+ (p[82].x - p[81].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[81].x, p[82].y+ (p[82].x - p[81].x) * tan(angle)), p[82]);
+		float maximum = 0;
+		for (int i = 0;i < receiverProfile.size();i++) {
+			maximum = b2Max(maximum, receiverProfile[i]);
+		}
+		if (maximum == 0) {
+			return;
+		}
 
-				drawLine(body, p[82], b2Vec2(p[82].x, p[83].y+ (p[83].x - p[82].x) * tan(angle)));
-				drawLine(body, b2Vec2(p[82].x, p[83].y+ (p[83].x - p[82].x) * tan(angle)), p[83]);
+		b2Vec2 e = b - a;
+		b2Vec2 n = (1.0f / e.Length()) * b2Vec2(e.y, -e.x);
+		b2Vec2 previous = a;
+		for (int i = 0;i < receiverProfile.size();i++) {
+			b2Vec2 point = a + ((i + 0.5f) / receiverProfile.size()) * e + (2.0f * receiverProfile[i] / maximum) * n;
+			g_debugDraw.DrawSegment(previous, point, b2Color(1, 0.5f, 0));
+			previous = point;
+		}
+	}
 
-				drawLine(body, p[83], p[52]);
+	void drawBeamStatistics(const char* name) {
+		int litWalls = 0;
+		for (int i = 0;i < scene.segments.count;i++) {
+			if (beamTracer.litWidth(i) > 0) {
+				litWalls++;
 			}
+		}
 
-			// Gallery ceiling
-			{
-				if (galleryCeilingOffset == 0) {
-					drawLine(body, p[52], p[54]);
-				}
-				else {
-					float numberOfSteps = 36;
-					float stepWidth = (sqrt((p[52] - p[85]).LengthSquared()) - GALLERY_CEILING_FIRST_STEP_WIDTH) / numberOfSteps;
-					//float numberOfSteps = ceil(((sqrt((p[52] - p[85]).LengthSquared()) - GALLERY_CEILING_FIRST_STEP_WIDTH) / 1.2f));
-					float angle = atan2(p[52].y - p[85].y, p[85].x - p[52].x);
-					float stepHight = sqrt((p[84] - p[52]).LengthSquared()) / numberOfSteps;
-
-					b2Vec2 previousPoint = p[52];
-
-					for (int i = 0;i < numberOfSteps;i++) {
-						b2Vec2 p1 = p[52] + (GALLERY_CEILING_FIRST_STEP_WIDTH + stepWidth * i) * b2Vec2(cos(angle), -sin(angle));
-						b2Vec2 p2 = p[84] + (GALLERY_CEILING_FIRST_STEP_WIDTH + stepWidth * i) * b2Vec2(cos(angle), -sin(angle));
-						b2Vec2 p3 = p[52] + (stepHight * i) * b2Vec2(sin(angle), cos(angle));
-						b2Vec2 p4 = p[85] + (stepHight * i) * b2Vec2(sin(angle), cos(angle));
-						b2Vec2 p = crossPoint(p1, p2, p3, p4);
-						b2Vec2 p_new = p + stepHight * b2Vec2(sin(angle), cos(angle));
-						drawLine(body, previousPoint, p);
-						drawLine(body, p, p_new);
-						previousPoint = b2Vec2(p_new.x, p_new.y);
-					}
-					drawLine(body, previousPoint, p[54]);
-				}
-			}
+		g_debugDraw.DrawString(5, m_textLine, "%s beam: sub-beams = %d  lit walls = %d  absorbed = %.2f%%", name,
+			beamTracer.beams, litWalls, 100 * beamTracer.absorbedWidth / beamTracer.sourceWidth);
+		m_textLine += m_textIncrement;
+		if (beamTracer.truncatedWidth > 0) {
+			g_debugDraw.DrawString(5, m_textLine, "%s beam: stopped at %d sub-beams, %.2f%% of width untraced, statistics are incomplete", name,
+				beamTracer.maximumBeams, 100 * beamTracer.truncatedWidth / beamTracer.sourceWidth);
+			m_textLine += m_textIncrement;
+		}
+	}
 
+	static Test* Create()
+	{
+		return new Piramid;
+	}
 
-			// Right Gallery floor
-			{
-				NextTo RightGalleryFloor_p26[3]{
-					b2Vec2(0,0.93f),
-					b2Vec2(-1.53f * cos(ascendingAngle),1.53f * sin(ascendingAngle)),
-					b2Vec2(0,0)
-				};
-				p[28] = drawPath(body, p[26], RightGalleryFloor_p26);
-				p[29] = crossPoint(p[28], p[28] + b2Vec2(0, 1), p[23], p[16]);
+private:
+	// control parameters 
+	bool showCorridorsCrossingProblem = false;
+	bool enableInputRay = false;
 
-				drawLine(body, p[28], p[29]);
-				drawLine(body, p[29],p[23]);
-			}
-			
-			// Left Gallery floor
-			{
-				drawLine(body, p[48], p[49]);
-				drawLine(body, p[23], p[49]);
-			}
+	bool enableQueenRay = false;
+	float queenAngle = PI / 6;
 
-			// Gallery beams
-			{
-					float stepSize = 6.526f * sqrt((p[90] - p[91]).LengthSquared()) / 88.036f;
-
-					for (int i = 0;i < 14;i++) {
-						// small hole
-						b2Vec2 step_i = p[91] + stepSize * i * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-
-						b2Vec2 p0 = step_i + cubit * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
-						
-						b2Vec2 p1 = step_i + GALLERY_HOLE_SHORT_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
-						b2Vec2 p3 = step_i + (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-						b2Vec2 p2 = p3 + GALLERY_HOLE_SHORT_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
-						b2Vec2 p4 = p3 + GALLERY_HOLES_SPACE_MUL * stepSize * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-						b2Vec2 p5 = p4 + GALLERY_HOLE_LONG_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
-						b2Vec2 p7 = p4 + (GALLERY_HOLE_LONG_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-						b2Vec2 p6 = p7 + GALLERY_HOLE_LONG_DEPTH * b2Vec2(-sin(ascendingAngle), -cos(ascendingAngle));
-
-						if (i > 0) {
-							// short cutting
-							b2Vec2 p8 = step_i + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.19f);
-							b2Vec2 p9 = p8 + (GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-							b2Vec2 p10 = p9 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
-							b2Vec2 p11 = p8 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
-
-							if (galleryBeamsMode == Reflect) {
-								drawLine(body, p8, p9);
-								drawLine(body, p9, p10);
-								drawLine(body, p10, p11);
-								drawLine(body, p11, p8);
-							}
-
-							if (galleryBeamsMode == Absorb) {
-								drawAbsorbLine(body, p8, p9);
-								drawAbsorbLine(body, p9, p10);
-								drawAbsorbLine(body, p10, p11);
-								drawAbsorbLine(body, p11, p8);
-							}
-
-							if (i < 13) {
-								// long cutting
-								b2Vec2 p12 = p4 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.19f);
-								b2Vec2 p13 = p12 + (GALLERY_HOLE_LONG_WIDTH_MUL * stepSize) * b2Vec2(-cos(ascendingAngle), sin(ascendingAngle));
-								b2Vec2 p14 = p13 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
-								b2Vec2 p15 = p12 + GALLERY_HOLE_SHORT_WIDTH_MUL * stepSize * b2Vec2(0, 0.38f);
-
-								if (galleryBeamsMode == Reflect) {
-									drawLine(body, p12, p13);
-									drawLine(body, p13, p14);
-									drawLine(body, p14, p15);
-									drawLine(body, p15, p12);
-								}
-
-								if (galleryBeamsMode == Absorb) {
-									drawAbsorbLine(body, p12, p13);
-									drawAbsorbLine(body, p13, p14);
-									drawAbsorbLine(body, p14, p15);
-									drawAbsorbLine(body, p15, p12);
-								}
-							}
-						}
-				}
+	PyramidModel model;
+	b2Vec2 (&p)[92] = model.p;
 
-			
-			
-			
-			}
-		}
+	b2BodyDef bd;
+	b2Body* pyramidBody;
+	b2Body* ceilingBody = nullptr;               // moving parts, null unless model.movingParts
+	b2Body* blockBody = nullptr;
+	float builtCeilingOffset = 0;                // galleryCeilingOffset of chain on ceilingBody
+	bool needToMove = false;
+	bool animateParts = false;
+	float animationTime = 0;
+	float refitTime = 0;                         // ms of last moveParts()
+	float rebuildTime = 0;                       // ms of last full rebuild
+	Scene scene;
+	SnapshotSlot snapshots;                      // read by tracing threads
+	GeometryValidator validator;                 // checks scene.segments after every rebuild
+	int fanBackend = RaysBackend;                // FanBackend of drawFan()
+	std::map<std::string, CoherenceHints> coherence;  // by fan name
+	VisibleSets visibleSets;                     // of the latest snapshot, rebuilt on first use after rebuild
+	int familyRays = 10000;
+	int listedFamilies = 5;
+	std::map<std::string, PathFamilies> families;  // by fan name
+	BeamTracer beamTracer = BeamTracer(&scene.segments);
+
+	std::map<std::string, AdaptiveFan> adaptiveFans;  // by fan name
+	int adaptiveCoarseRays = 16;
+	int adaptiveToleranceExponent = 6;
+	int adaptiveRayCasts = 1000000;
+
+	DensityBuffer densityBuffer;
+	int densityRays = 100000;
+	std::vector<RayFan> densityFans;             // fans requested in current step
+	std::vector<RayFan> tracedDensityFans;       // fans currently in the buffer
+	int tracedDensityRays = 0;
+	float densityExposure = 0;
+	Camera densityCamera;
+	bool densityDirty = true;
+	float densityTime = 0;
+
+	bool enableVisibility = false;
+	int visibilitySource = 1;                    // 0 p[8], 1 p[30], 2 last mouse click
+	b2Vec2 visibilityPoint = b2Vec2(0, 0);
+
+	HitIndex hitIndex;
+	int pickedSegment = -1;                      // in scene.segments
+	Visibility visibility = Visibility(&scene.segments);
+
+	int estimatorFan = 0;
+	float estimatorDiffuse = 0.3f;
+	int estimatorRays = 10000;
+	int estimatorReflections = 50;
+	ContainerEstimator estimates[2];             // plain, next-event estimation
+	float estimatorTime[2] = { 0, 0 };
+
+	DistanceField distanceField;                 // of the latest snapshot, rebaked on first use after rebuild
+	bool enableClearance = false;
+	b2Vec2 clearancePoint = b2Vec2(0, 0);
+	int distanceBenchmarkRays = 10000;
+	int64_t distanceBenchmarkHits = 0;
+	int distanceBenchmarkDiffering[2] = { 0, 0 };  // segments, distance field against b2World
+	float distanceBenchmarkTime[3] = { 0, 0, 0 };  // b2World, segments, distance field
+
+	RadiositySolver radiosity;
+	bool enableRadiosity = false;
+	int radiosityFan = 0;
+	int radiosityRays = 100000;
+	float radiosityTime = 0;
+
+	SpectralTracer spectral;
+	int spectralFan = 0;
+	int spectralRays = 10000;
+	int spectralWavelengths = SPECTRAL_LANES;
+	float spectralTime = 0;
+
+	CelestialAlignment alignment;
+	int celestialFirstYear = -3500;
+	int celestialLastYear = 2000;
+	int celestialTarget = 0;                     // 0 descending corridor bottom, 1 gallery entrance
+	bool enableCelestialRay = false;
+	int celestialStar = 0;
+	int celestialYear = -2500;
+	float alignmentTime = 0;
+
+	UncertaintyStudy uncertainty;
+	float uncertaintyTime = 0;
+
+	bool enableReceiver = false;
+	int receiverChamber = 0;                     // 0 King chamber, 1 lower chamber
+	int receiverFan = 0;                         // 0 Input fan, 1 Queen fan
+	int receiverBins = 512;
+	int receiverRays = 1000000;
+	float receiverShortestWavelength = 0.1f;
+	float receiverLongestWavelength = 0.2f;
+	int receiverWavelengths = 16;
+	Receiver receiver = Receiver(b2Vec2(0, 0), b2Vec2(1, 0), 1, std::vector<float>());
+	std::vector<float> receiverProfile;
+	float receiverTime = 0;
+
+
+	bool needToReset = false;
 
-		// Queen Chamber
-		{
-			drawLine(body, p[31], p[35]);
-			drawLine(body, p[31], p[36]);
-
-			drawLine(body, p[35], p[35] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER));
-			drawLine(body, p[36], p[36] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER));
-			drawLine(body, p[35] + b2Vec2(0, -0.14f), p[33]);
-			drawLine(body, p[35] + b2Vec2(0, -0.14f), p[45]);
-			drawLine(body, p[36] + b2Vec2(0, -0.14f), p[37]);
-			drawLine(body, p[36] + b2Vec2(0, -0.14f), p[46]);
-			drawLine(body, p[35] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER), p[45]);
-			drawLine(body, p[36] + b2Vec2(0, -QUEEN_CHAMBER_SMALLEST_BORDER), p[46]);
-			drawLine(body, p[26], p[37]);
-
-			//floor
-			drawLine(body, p[34], p[43]);
-			drawLine(body, p[33], p[44]);
-			drawLine(body, p[34], p[38]);
-		}
-
-		// King Chamber
-		{
-			NextTo KingChamber_p48[10]{
-				b2Vec2(-6.83f,0),
-
-				/*
-				b2Vec2(-1.64f,0),
-				b2Vec2(0,0.01f),
-				b2Vec2(-1.2f,0),
-				b2Vec2(0,-0.01f),
-				b2Vec2(-1.79f - 2.2f,0),
-				b2Vec2(0,0.02f),
-				*/
-
-				b2Vec2(-KING_CHAMBER_WIDTH,0),
-				b2Vec2(0, KING_CHAMBER_HEIGHT),
-				b2Vec2(KING_CHAMBER_WIDTH,0),
-				b2Vec2(0, -(KING_CHAMBER_HEIGHT - (p[50].y - p[48].y))),
-				b2Vec2(1.79f + 0.77f,0),
-				b2Vec2(0,3.77f - (p[50].y - p[48].y)),
-				b2Vec2(2.96f,0),
-				b2Vec2(0,-(3.77f - (p[50].y - p[48].y))),
-//				b2Vec2(1.23f,0),
-				b2Vec2(0,0)
-			};
-
-			NextTo KingChamberBlock[5]{
-				b2Vec2(0,1.33f),
-				b2Vec2(-0.39f,0),
-				b2Vec2(0,-1.33f),
-				b2Vec2(0.39f,0),
-				b2Vec2(0,0)
-			};
-
-			drawLine(body, p[50], drawPath(body, p[48], KingChamber_p48));
-			drawPath(body, p[50] + b2Vec2(-1.24f - 0.54f, 0), KingChamberBlock);
-
-		}
-
-	}
-
-	
 };
 
 static int testIndex = RegisterTest("Pyramid", "Pyramid", Piramid::Create);
\ No newline at end of file
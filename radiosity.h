@@ -0,0 +1,351 @@
+#pragma once
+
+#include <thread>
+#include <numeric>
+#include <algorithm>
+
+#include "pvs.h"
+
+// Wall piece seen from one side, side 0 faces left of segment start -> end
+class RadiosityPatch {
+public:
+	int segment;
+	int side;
+	b2Vec2 start;
+	b2Vec2 end;
+	float albedo;                            // diffusely reflected part of irradiance
+};
+
+// Steady state irradiance of Lambertian walls lit by a ray fan. Walls are split into patches of at most
+// patchSize, one per side. Form factors between patches come from crossed strings (exact for two
+// unoccluded segments in 2D) times the unoccluded part of samples x samples point pairs, only between
+// walls in each other's potentially visible sets, and are stored as sparse rows (CSR). The fan gives
+// direct irradiance: every hit deposits the ray power, the specular part of the reflection goes on,
+// absorbing walls stop it. Radiosity B = albedo * (direct + F * B) is then solved by Jacobi sweeps over
+// rows split between threads, or by in-place Gauss-Seidel sweeps on one thread. Only the diffuse part is
+// transported between patches, light reaching a mirror by diffuse exchange is not followed further.
+// Irradiance is power per meter of wall for unit power per meter of fan line.
+//   solver.build(snapshot, &sets);
+//   solver.illuminate(snapshot, fan, rays);
+//   solver.solve();
+class RadiositySolver {
+public:
+	float patchSize = 0.5f;
+	int samples = 3;                         // visibility samples along every patch of a pair
+	float diffuse = 0.3f;                    // least diffuse part of reflection of any wall, as in ContainerEstimator
+	float minimumFactor = 1e-6f;             // smaller form factors are dropped
+	float tolerance = 1e-4f;                 // largest change of radiosity per sweep relative to the largest radiosity
+	int maximumSweeps = 1000;
+	int maximumReflections = 300;            // specular bounces of fan rays
+	bool gaussSeidel = false;
+	int threads = 1;
+
+	std::vector<RadiosityPatch> patches;
+	std::vector<int> firstPatch;             // of segment, pieces are 2 patches each
+	std::vector<int> rowStart;               // form factors of patch i are factor[rowStart[i] .. rowStart[i + 1])
+	std::vector<int> column;
+	std::vector<float> factor;
+	std::vector<float> direct;               // irradiance from fan
+	std::vector<float> radiosity;
+	std::vector<float> irradiance;           // direct and diffuse, after solve()
+
+	int sweeps = 0;
+	float residual = 0;
+	float buildTime = 0;                     // ms
+	float solveTime = 0;
+
+	RadiositySolver() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	// patches and form factors of snapshot walls, sets of the same snapshot or null for all pairs of walls
+	void build(const SceneSnapshot* snapshot, const VisibleSets* sets) {
+		b2Timer timer;
+		const SegmentTable* segments = &snapshot->segments;
+		patches.clear();
+		firstPatch.resize(segments->count + 1);
+		for (int i = 0;i < segments->count;i++) {
+			firstPatch[i] = (int)patches.size();
+			float length = b2Distance(segments->start(i), segments->end(i));
+			if (length == 0) {
+				continue;
+			}
+			int pieces = b2Max(1, (int)ceilf(length / patchSize));
+			float albedo = materials[segments->material[i]].absorb ? 0 : materials[segments->material[i]].reflectance() * scatter(segments->material[i]);
+			for (int k = 0;k < pieces;k++) {
+				for (int side = 0;side < 2;side++) {
+					RadiosityPatch patch;
+					patch.segment = i;
+					patch.side = side;
+					patch.start = segments->start(i) + ((float)k / pieces) * (segments->end(i) - segments->start(i));
+					patch.end = segments->start(i) + ((float)(k + 1) / pieces) * (segments->end(i) - segments->start(i));
+					patch.albedo = albedo;
+					patches.push_back(patch);
+				}
+			}
+		}
+		firstPatch[segments->count] = (int)patches.size();
+
+		int n = (int)patches.size();
+		std::vector<std::vector<int>> columns(n);
+		std::vector<std::vector<float>> factors(n);
+		bool useSets = sets && !sets->offsets.empty();
+		std::vector<std::thread> workers;
+		for (int t = 0;t < threads;t++) {
+			workers.push_back(std::thread([&, t]() {
+				for (int i = t;i < n;i += threads) {
+					const RadiosityPatch& patch = patches[i];
+					int set = 2 * patch.segment + patch.side;
+					int count = useSets ? sets->offsets[set + 1] - sets->offsets[set] : segments->count;
+					for (int k = 0;k < count;k++) {
+						int wall = useSets ? sets->sets[sets->offsets[set] + k] : k;
+						if (wall == patch.segment) {
+							continue;
+						}
+						for (int j = firstPatch[wall];j < firstPatch[wall + 1];j++) {
+							float f = formFactor(snapshot, patch, patches[j]);
+							if (f > minimumFactor) {
+								columns[i].push_back(j);
+								factors[i].push_back(f);
+							}
+						}
+					}
+
+					// sampled visibility of partly hidden pairs may add up to more than all power leaving
+					float sum = std::accumulate(factors[i].begin(), factors[i].end(), 0.0f);
+					if (sum > 1) {
+						for (int k = 0;k < factors[i].size();k++) {
+							factors[i][k] /= sum;
+						}
+					}
+				}
+			}));
+		}
+		for (int t = 0;t < threads;t++) {
+			workers[t].join();
+		}
+
+		rowStart.resize(n + 1);
+		column.clear();
+		factor.clear();
+		for (int i = 0;i < n;i++) {
+			rowStart[i] = (int)column.size();
+			column.insert(column.end(), columns[i].begin(), columns[i].end());
+			factor.insert(factor.end(), factors[i].begin(), factors[i].end());
+		}
+		rowStart[n] = (int)column.size();
+		direct.assign(n, 0);
+		radiosity.assign(n, 0);
+		irradiance.assign(n, 0);
+		buildTime = timer.GetMilliseconds();
+	}
+
+	// direct irradiance of fan rays, specular part of every reflection goes on
+	void illuminate(const SceneSnapshot* snapshot, RayFan fan, int rays) {
+		int n = (int)patches.size();
+		float power = (fan.end - fan.start).Length() / rays;
+		std::vector<std::vector<float>> partial(threads, std::vector<float>(n, 0));
+		std::vector<std::thread> workers;
+		for (int t = 0;t < threads;t++) {
+			workers.push_back(std::thread([&, t]() {
+				for (int i = t;i < rays;i += threads) {
+					b2Vec2 point = fan.start + ((i + 0.5f) / rays) * (fan.end - fan.start);
+					path(snapshot, point, b2Vec2(cos(fan.angle), sin(fan.angle)), power, partial[t].data());
+				}
+			}));
+		}
+		for (int t = 0;t < threads;t++) {
+			workers[t].join();
+		}
+
+		direct.assign(n, 0);
+		for (int t = 0;t < threads;t++) {
+			for (int i = 0;i < n;i++) {
+				direct[i] += partial[t][i];
+			}
+		}
+	}
+
+	void solve() {
+		b2Timer timer;
+		int n = (int)patches.size();
+		std::vector<float> emitted(n);
+		for (int i = 0;i < n;i++) {
+			emitted[i] = patches[i].albedo * direct[i];
+		}
+		radiosity = emitted;
+		std::vector<float> next(n);
+
+		for (sweeps = 0;sweeps < maximumSweeps;) {
+			float change = 0;
+			if (gaussSeidel) {
+				for (int i = 0;i < n;i++) {
+					float b = emitted[i] + patches[i].albedo * gather(i, radiosity);
+					change = b2Max(change, fabsf(b - radiosity[i]));
+					radiosity[i] = b;
+				}
+			}
+			else {
+				// contiguous rows per thread, every thread reads the previous sweep only
+				std::vector<float> changes(threads, 0);
+				std::vector<std::thread> workers;
+				for (int t = 0;t < threads;t++) {
+					workers.push_back(std::thread([&, t]() {
+						for (int i = n * t / threads;i < n * (t + 1) / threads;i++) {
+							next[i] = emitted[i] + patches[i].albedo * gather(i, radiosity);
+							changes[t] = b2Max(changes[t], fabsf(next[i] - radiosity[i]));
+						}
+					}));
+				}
+				for (int t = 0;t < threads;t++) {
+					workers[t].join();
+					change = b2Max(change, changes[t]);
+				}
+				radiosity.swap(next);
+			}
+			sweeps++;
+
+			float largest = 0;
+			for (int i = 0;i < n;i++) {
+				largest = b2Max(largest, radiosity[i]);
+			}
+			residual = largest > 0 ? change / largest : 0;
+			if (residual <= tolerance) {
+				break;
+			}
+		}
+
+		for (int i = 0;i < n;i++) {
+			irradiance[i] = direct[i] + gather(i, radiosity);
+		}
+		solveTime = timer.GetMilliseconds();
+	}
+
+	int nonZeros() const {
+		return (int)factor.size();
+	}
+
+	// part of diffuse power leaving patch i which reaches other patches, 1 for closed rooms
+	float rowSum(int i) const {
+		float sum = 0;
+		for (int k = rowStart[i];k < rowStart[i + 1];k++) {
+			sum += factor[k];
+		}
+		return sum;
+	}
+
+	float largestIrradiance() const {
+		float largest = 0;
+		for (int i = 0;i < irradiance.size();i++) {
+			largest = b2Max(largest, irradiance[i]);
+		}
+		return largest;
+	}
+
+	// patch of segment hit at point from side of source, -1 for walls without patches
+	int patchAt(const SegmentTable* segments, int segment, b2Vec2 point, b2Vec2 source) const {
+		int pieces = (firstPatch[segment + 1] - firstPatch[segment]) / 2;
+		if (pieces == 0) {
+			return -1;
+		}
+		b2Vec2 d = segments->end(segment) - segments->start(segment);
+		float u = b2Dot(point - segments->start(segment), d) / d.LengthSquared();
+		int piece = b2Clamp((int)(u * pieces), 0, pieces - 1);
+		int side = b2Cross(d, source - segments->start(segment)) > 0 ? 0 : 1;
+		return firstPatch[segment] + 2 * piece + side;
+	}
+
+private:
+	float scatter(int material) const {
+		return b2Max(diffuse, materials[material].diffuse);
+	}
+
+	// irradiance of patch i from radiosity b of all patches it sees
+	float gather(int i, const std::vector<float>& b) const {
+		float sum = 0;
+		for (int k = rowStart[i];k < rowStart[i + 1];k++) {
+			sum += factor[k] * b[column[k]];
+		}
+		return sum;
+	}
+
+	static b2Vec2 normal(const RadiosityPatch& patch) {
+		b2Vec2 d = patch.end - patch.start;
+		b2Vec2 n = b2Vec2(-d.y, d.x);
+		n.Normalize();
+		return patch.side == 0 ? n : -n;
+	}
+
+	// part of segment a0 a1 strictly in front of plane through origin with normal n, false if none
+	static bool clipFront(b2Vec2* a0, b2Vec2* a1, b2Vec2 origin, b2Vec2 n) {
+		float d0 = b2Dot(*a0 - origin, n);
+		float d1 = b2Dot(*a1 - origin, n);
+		if (d0 <= 0 && d1 <= 0) {
+			return false;
+		}
+		if (d0 < 0) {
+			*a0 = *a0 + (d0 / (d0 - d1)) * (*a1 - *a0);
+		}
+		if (d1 < 0) {
+			*a1 = *a0 + (d0 / (d0 - d1)) * (*a1 - *a0);
+		}
+		return true;
+	}
+
+	// part of diffuse power leaving patch i which reaches patch j
+	float formFactor(const SceneSnapshot* snapshot, const RadiosityPatch& i, const RadiosityPatch& j) const {
+		b2Vec2 ni = normal(i);
+		b2Vec2 nj = normal(j);
+		b2Vec2 a0 = i.start;
+		b2Vec2 a1 = i.end;
+		b2Vec2 b0 = j.start;
+		b2Vec2 b1 = j.end;
+		if (!clipFront(&b0, &b1, i.start, ni) || !clipFront(&a0, &a1, j.start, nj)) {
+			return 0;
+		}
+
+		// crossed strings are longer than uncrossed ones
+		float crossed = b2Distance(a0, b1) + b2Distance(a1, b0);
+		float uncrossed = b2Distance(a0, b0) + b2Distance(a1, b1);
+		float f = fabsf(crossed - uncrossed) / (2 * b2Distance(i.start, i.end));
+		if (f <= minimumFactor) {
+			return 0;
+		}
+
+		int free = 0;
+		for (int u = 0;u < samples;u++) {
+			b2Vec2 p = a0 + ((u + 0.5f) / samples) * (a1 - a0) + 0.0001f * ni;
+			for (int v = 0;v < samples;v++) {
+				b2Vec2 q = b0 + ((v + 0.5f) / samples) * (b1 - b0) + 0.0001f * nj;
+				bool blocked = snapshot->bruteForce ?
+					snapshot->segments.occluded(p, q, 1.0f, -1) :
+					snapshot->tree.occluded(&snapshot->segments, p, q, 1.0f, -1);
+				free += !blocked;
+			}
+		}
+		return f * free / (samples * samples);
+	}
+
+	void path(const SceneSnapshot* snapshot, b2Vec2 point, b2Vec2 direction, float power, float* deposit) const {
+		b2Vec2 source = point + 0.01f * direction;
+		for (int bounce = 0;bounce <= maximumReflections && power > 0;bounce++) {
+			RayCastClosestCallback callback = RayCastClosestCallback();
+			rayCastClosest(snapshot, &callback, source, source + 100 * direction);
+			if (!callback.m_hit) {
+				return;
+			}
+
+			int patch = patchAt(&snapshot->segments, callback.m_childIndex, callback.m_point, source);
+			if (patch >= 0) {
+				deposit[patch] += power / b2Distance(patches[patch].start, patches[patch].end);
+			}
+			const Material& material = materials[callback.m_material];
+			if (material.absorb) {
+				return;
+			}
+			power *= material.reflectance() * (1 - scatter(callback.m_material));
+			direction = reflect(direction, callback.m_normal);
+			source = callback.m_point + 0.0001f * direction;
+		}
+	}
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <thread>
+#include <cstdint>
+
+#include "trace.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Path crossing the receiver line, distance is whole optical path from fan start
+class ReceiverCrossing {
+public:
+	int bin;
+	double distance;
+};
+
+// sin and cos of 2*PI*t for 8 values of t, polynomials after reduction to [-PI/4, PI/4]
+inline void sinCosCycles8(const float* t, float* s, float* co) {
+#if defined(__AVX2__)
+	__m256 x = _mm256_loadu_ps(t);
+	__m256 q = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(4)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_mul_ps(_mm256_sub_ps(x, _mm256_mul_ps(q, _mm256_set1_ps(0.25f))), _mm256_set1_ps(2 * PI));
+	__m256 r2 = _mm256_mul_ps(r, r);
+
+	__m256 sp = _mm256_fmadd_ps(r2, _mm256_set1_ps(-1.0f / 5040), _mm256_set1_ps(1.0f / 120));
+	sp = _mm256_fmadd_ps(r2, sp, _mm256_set1_ps(-1.0f / 6));
+	sp = _mm256_fmadd_ps(r2, sp, _mm256_set1_ps(1));
+	sp = _mm256_mul_ps(r, sp);
+
+	__m256 cp = _mm256_fmadd_ps(r2, _mm256_set1_ps(1.0f / 40320), _mm256_set1_ps(-1.0f / 720));
+	cp = _mm256_fmadd_ps(r2, cp, _mm256_set1_ps(1.0f / 24));
+	cp = _mm256_fmadd_ps(r2, cp, _mm256_set1_ps(-0.5f));
+	cp = _mm256_fmadd_ps(r2, cp, _mm256_set1_ps(1));
+
+	// quadrant rotation: odd quadrants swap sin and cos, quadrants 2 and 3 negate sin, 1 and 2 negate cos
+	__m256i quadrant = _mm256_and_si256(_mm256_cvtps_epi32(q), _mm256_set1_epi32(3));
+	__m256 odd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+	__m256 sinValue = _mm256_blendv_ps(sp, cp, odd);
+	__m256 cosValue = _mm256_blendv_ps(cp, sp, odd);
+
+	__m256i sinSign = _mm256_slli_epi32(_mm256_srli_epi32(quadrant, 1), 31);
+	__m256i cosSign = _mm256_slli_epi32(_mm256_srli_epi32(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), 1), 31);
+	_mm256_storeu_ps(s, _mm256_xor_ps(sinValue, _mm256_castsi256_ps(sinSign)));
+	_mm256_storeu_ps(co, _mm256_xor_ps(cosValue, _mm256_castsi256_ps(cosSign)));
+#else
+	for (int j = 0;j < 8;j++) {
+		float q = nearbyintf(4 * t[j]);
+		float r = (t[j] - q / 4) * 2 * PI;
+		float r2 = r * r;
+		float sp = r * (1 + r2 * (-1.0f / 6 + r2 * (1.0f / 120 - r2 / 5040)));
+		float cp = 1 + r2 * (-0.5f + r2 * (1.0f / 24 + r2 * (-1.0f / 720 + r2 / 40320)));
+
+		switch ((int)q & 3) {
+		case 0: s[j] = sp; co[j] = cp; break;
+		case 1: s[j] = cp; co[j] = -sp; break;
+		case 2: s[j] = -sp; co[j] = -cp; break;
+		default: s[j] = -cp; co[j] = sp; break;
+		}
+	}
+#endif
+}
+
+// Coherent accumulator on receiver line a-b. Every ray crossing the line adds unit complex amplitude
+// exp(i * 2 * PI * distance / wavelength) into its bin for every wavelength. Work per crossing does
+// not depend on number of bins, only profile() walks all bins.
+class Receiver {
+public:
+	b2Vec2 a;
+	b2Vec2 b;
+	int bins;
+	std::vector<float> wavelengths;
+
+	std::vector<float> re;         // re[wavelength * bins + bin]
+	std::vector<float> im;
+	int64_t crossings = 0;
+	int64_t paths = 0;
+
+	int threads = 1;
+
+	Receiver(b2Vec2 _a, b2Vec2 _b, int _bins, const std::vector<float>& _wavelengths) {
+		a = _a;
+		b = _b;
+		bins = b2Max(1, _bins);
+		wavelengths = _wavelengths;
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+		clear();
+	}
+
+	void clear() {
+		re.assign(wavelengths.size() * bins, 0.0f);
+		im.assign(wavelengths.size() * bins, 0.0f);
+		crossings = 0;
+		paths = 0;
+	}
+
+	// traces fan on all threads, each thread sums into its own arrays which are added at the end
+	template <typename World>
+	void traceFan(World m_world, RayFan fan, int rays, int maximumReflections) {
+		std::vector<std::vector<float>> partialRe(threads, std::vector<float>(re.size(), 0.0f));
+		std::vector<std::vector<float>> partialIm(threads, std::vector<float>(im.size(), 0.0f));
+		std::vector<int64_t> partialCrossings(threads, 0);
+		std::vector<std::thread> workers;
+
+		for (int k = 0;k < threads;k++) {
+			workers.push_back(std::thread([&, k]() {
+				std::vector<ReceiverCrossing> pending;
+
+				for (int i = k;i < rays;i += threads) {
+					b2Vec2 point = fan.start + ((i + 0.5f) / rays) * (fan.end - fan.start);
+					double distance = 0;
+
+					traceRay(m_world, Ray(point, 100, fan.angle, maximumReflections), [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+						ReceiverCrossing crossing;
+						if (cross(source, callback.m_point, distance, &crossing)) {
+							pending.push_back(crossing);
+						}
+						distance += (callback.m_point - source).Length();
+					});
+
+					if (pending.size() >= 4096) {
+						partialCrossings[k] += pending.size();
+						accumulate(pending, partialRe[k].data(), partialIm[k].data());
+						pending.clear();
+					}
+				}
+				partialCrossings[k] += pending.size();
+				accumulate(pending, partialRe[k].data(), partialIm[k].data());
+			}));
+		}
+		for (int k = 0;k < threads;k++) {
+			workers[k].join();
+		}
+
+		for (int k = 0;k < threads;k++) {
+			for (int i = 0;i < re.size();i++) {
+				re[i] += partialRe[k][i];
+				im[i] += partialIm[k][i];
+			}
+			crossings += partialCrossings[k];
+		}
+		paths += rays;
+	}
+
+	// finds where path segment source-point crosses receiver, distance is path length at source
+	bool cross(b2Vec2 source, b2Vec2 point, double distance, ReceiverCrossing* crossing) const {
+		b2Vec2 r = point - source;
+		b2Vec2 e = b - a;
+		float denominator = b2Cross(r, e);
+		if (denominator == 0) {
+			return false;
+		}
+		b2Vec2 d = a - source;
+		float s = b2Cross(d, e) / denominator;      // along path segment
+		float u = b2Cross(d, r) / denominator;      // along receiver
+		if (s < 0 || s > 1 || u < 0 || u >= 1) {
+			return false;
+		}
+		crossing->bin = b2Min(bins - 1, (int)(u * bins));
+		crossing->distance = distance + s * (double)r.Length();
+		return true;
+	}
+
+	// phase is reduced in double to cycles fraction, so short wavelengths keep precision over long paths
+	void accumulate(const std::vector<ReceiverCrossing>& pending, float* sumRe, float* sumIm) const {
+		float t[8], s[8], co[8];
+
+		for (int w = 0;w < wavelengths.size();w++) {
+			double inverse = 1.0 / wavelengths[w];
+			float* wRe = sumRe + w * bins;
+			float* wIm = sumIm + w * bins;
+
+			for (int i = 0;i < pending.size();i += 8) {
+				int n = b2Min(8, (int)pending.size() - i);
+				for (int j = 0;j < 8;j++) {
+					double cycles = j < n ? pending[i + j].distance * inverse : 0;
+					t[j] = (float)(cycles - floor(cycles));
+				}
+				sinCosCycles8(t, s, co);
+				for (int j = 0;j < n;j++) {
+					wRe[pending[i + j].bin] += co[j];
+					wIm[pending[i + j].bin] += s[j];
+				}
+			}
+		}
+	}
+
+	float intensity(int wavelength, int bin) const {
+		int i = wavelength * bins + bin;
+		return re[i] * re[i] + im[i] * im[i];
+	}
+
+	// intensity of every bin averaged over wavelengths and normalized by traced paths
+	std::vector<float> profile() const {
+		std::vector<float> result(bins, 0.0f);
+		if (paths == 0 || wavelengths.empty()) {
+			return result;
+		}
+		float norm = 1.0f / ((float)paths * wavelengths.size());
+		for (int w = 0;w < wavelengths.size();w++) {
+			for (int bin = 0;bin < bins;bin++) {
+				result[bin] += intensity(w, bin) * norm;
+			}
+		}
+		return result;
+	}
+};
@@ -0,0 +1,19 @@
+# render example.spec, then ffmpeg -framerate 30 -i frames/ascending.%06d.ppm -pix_fmt yuv420p ascending.mp4
+output = frames/ascending
+frames = 300
+width = 1280
+height = 720
+
+rays = 300
+maximumReflections = 30
+rayIntensity = 0.15
+inputFan = 1
+queenFan = 1
+
+# view = left bottom right top in meters, whole pyramid when omitted
+
+# name = value  or  name = first last (interpolated over frames)
+ascendingAngle = 0.4529 0.4878
+queenAngle = 0.5236
+galleryBeamsMode = 2               # Transparent, Reflect, Absorb
+limestoneWalls = 0                 # 1 for rough limestone gallery and Queen chamber mirrors
@@ -0,0 +1,478 @@
+// Headless frame renderer for parameter animations.
+// Not a testbed test: build it as separate executable linked with Box2D only, e.g.
+//   g++ -O2 -std=c++17 -I<box2d>/include render/main.cpp <box2d library>
+//
+//   render <spec> [threads]          renders frames missing in output, rerun resumes
+//
+// Every frame builds the model with parameters interpolated between their first and last frame
+// values, traces the fans and rasterizes walls and ray paths in software into <output>.NNNNNN.ppm.
+// Frames are independent and taken by worker threads in order, a frame is written to temporary
+// file and renamed so a killed run never leaves a broken frame. Every worker keeps wall sequences of
+// the rays of its previous frame as hints (coherence.h), frames stay the same as without them.
+// Make a video with e.g.
+//   ffmpeg -framerate 30 -i <output>.%06d.ppm -pix_fmt yuv420p animation.mp4
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+
+#include "../model.h"
+#include "../segments.h"
+#include "../coherence.h"
+
+// model parameter interpolated from first to last frame
+class FrameParameter {
+public:
+	const char* name;
+	float from;
+	float to;
+
+	float value(int frame, int frames) const {
+		return frames > 1 ? from + (to - from) * frame / (frames - 1) : from;
+	}
+};
+
+class RenderSpec {
+public:
+	std::string output = "frame";
+	int frames = 1;
+	int width = 1280;
+	int height = 720;
+	int rays = 300;
+	int maximumReflections = 30;
+	float rayIntensity = 0.15f;      // added to pixel by every ray crossing it
+	bool inputFan = true;
+	bool queenFan = true;
+	bool autoView = true;            // fit walls of the first frame
+	b2Vec2 viewLower = b2Vec2(0, 0);
+	b2Vec2 viewUpper = b2Vec2(0, 0);
+
+	// order of this table is used by apply()
+	std::vector<FrameParameter> parameters = {
+		{ "ascendingAngle", defaultAscendingAngle, defaultAscendingAngle },
+		{ "descendingAngle", defaultDescendingAngle, defaultDescendingAngle },
+		{ "galleryCeilingOffset", 1, 1 },
+		{ "ceilingParallelToFloor", 1, 1 },
+		{ "leftGalleryWallMode", Horizontal, Horizontal },
+		{ "rightGalleryWallMode", Parallel, Parallel },
+		{ "galleryBeamsMode", Absorb, Absorb },
+		{ "queenAngle", PI / 6, PI / 6 },
+		{ "limestoneWalls", 0, 0 }
+	};
+
+	// lines are "name = value" or "name = first last", # starts comment
+	bool load(const char* path) {
+		FILE* file = fopen(path, "r");
+		if (!file) {
+			fprintf(stderr, "can not open spec %s\n", path);
+			return false;
+		}
+
+		char line[1024];
+		bool valid = true;
+		while (valid && fgets(line, sizeof(line), file)) {
+			char* comment = strchr(line, '#');
+			if (comment) {
+				*comment = 0;
+			}
+
+			char name[64];
+			char value[512];
+			if (sscanf(line, " %63[^= \t] = %511[^\n]", name, value) != 2) {
+				continue;
+			}
+			valid = set(name, value);
+		}
+		fclose(file);
+		return valid;
+	}
+
+	bool set(const char* name, const char* value) {
+		if (!strcmp(name, "output")) {
+			char text[512];
+			sscanf(value, "%511s", text);
+			output = text;
+			return true;
+		}
+		if (!strcmp(name, "view")) {
+			if (sscanf(value, "%f %f %f %f", &viewLower.x, &viewLower.y, &viewUpper.x, &viewUpper.y) != 4 || viewLower.x >= viewUpper.x || viewLower.y >= viewUpper.y) {
+				fprintf(stderr, "view must be \"left bottom right top\"\n");
+				return false;
+			}
+			autoView = false;
+			return true;
+		}
+
+		struct { const char* name; int* value; int minimum; } integers[] = {
+			{ "frames", &frames, 1 },
+			{ "width", &width, 16 },
+			{ "height", &height, 16 },
+			{ "rays", &rays, 0 },
+			{ "maximumReflections", &maximumReflections, 0 }
+		};
+		for (int i = 0;i < sizeof(integers) / sizeof(integers[0]);i++) {
+			if (!strcmp(name, integers[i].name)) {
+				*integers[i].value = b2Max(integers[i].minimum, atoi(value));
+				return true;
+			}
+		}
+		if (!strcmp(name, "rayIntensity")) {
+			rayIntensity = (float)atof(value);
+			return true;
+		}
+		if (!strcmp(name, "inputFan")) {
+			inputFan = atoi(value) != 0;
+			return true;
+		}
+		if (!strcmp(name, "queenFan")) {
+			queenFan = atoi(value) != 0;
+			return true;
+		}
+
+		FrameParameter* parameter = find(name);
+		if (!parameter) {
+			fprintf(stderr, "unknown spec parameter %s\n", name);
+			return false;
+		}
+
+		float from, to;
+		int fields = sscanf(value, "%f %f", &from, &to);
+		if (fields == 1) {
+			parameter->from = parameter->to = from;
+		}
+		else if (fields == 2) {
+			parameter->from = from;
+			parameter->to = to;
+		}
+		else {
+			fprintf(stderr, "%s must be \"value\" or \"first last\"\n", name);
+			return false;
+		}
+		return true;
+	}
+
+	FrameParameter* find(const char* name) {
+		for (int i = 0;i < parameters.size();i++) {
+			if (!strcmp(parameters[i].name, name)) {
+				return &parameters[i];
+			}
+		}
+		return nullptr;
+	}
+
+	// sets model parameters of frame, returns queen fan angle
+	float apply(int frame, PyramidModel* model) const {
+		std::vector<float> values(parameters.size());
+		for (int i = 0;i < parameters.size();i++) {
+			values[i] = parameters[i].value(frame, frames);
+		}
+		model->ascendingAngle = values[0];
+		model->descendingAngle = values[1];
+		model->galleryCeilingOffset = values[2];
+		model->ceilingParallelToFloor = values[3] != 0;
+		model->leftGalleryWallMode = (int)roundf(values[4]);
+		model->rightGalleryWallMode = (int)roundf(values[5]);
+		model->galleryBeamsMode = (int)roundf(values[6]);
+		model->limestoneWalls = values[8] != 0;
+		return values[7];
+	}
+
+	std::string framePath(int frame) const {
+		char suffix[64];
+		snprintf(suffix, sizeof(suffix), ".%06d.ppm", frame);
+		return output + suffix;
+	}
+
+	// directories of output, e.g. frames/ of frames/ascending, true when they exist
+	bool createOutputDirectory() const {
+		std::filesystem::path directory = std::filesystem::path(output).parent_path();
+		std::error_code error;
+		if (!directory.empty() && !std::filesystem::create_directories(directory, error) && error) {
+			fprintf(stderr, "can not create %s\n", directory.string().c_str());
+			return false;
+		}
+		return true;
+	}
+};
+
+// Linear RGB accumulation buffer, rays add light and walls are painted over them
+class Image {
+public:
+	int width = 0;
+	int height = 0;
+	std::vector<float> pixels;       // rgb rows from top
+	b2Vec2 lower;                    // world window
+	b2Vec2 upper;
+
+	void reset(int imageWidth, int imageHeight, b2Vec2 viewLower, b2Vec2 viewUpper) {
+		width = imageWidth;
+		height = imageHeight;
+		lower = viewLower;
+		upper = viewUpper;
+		pixels.assign(width * height * 3, 0.0f);
+	}
+
+	b2Vec2 toPixels(b2Vec2 point) const {
+		return b2Vec2(
+			(point.x - lower.x) / (upper.x - lower.x) * width,
+			(upper.y - point.y) / (upper.y - lower.y) * height
+		);
+	}
+
+	// world segment with one sample per pixel along its major axis, add blends or replaces pixels
+	void line(b2Vec2 p1, b2Vec2 p2, b2Color color, bool add) {
+		b2Vec2 a = toPixels(p1);
+		b2Vec2 b = toPixels(p2);
+		if (!clip(&a, &b)) {
+			return;
+		}
+
+		// painted colors are stored so that write() maps them back to themselves
+		if (!add) {
+			color = b2Color(-logf(1 - b2Min(color.r, 0.996f)), -logf(1 - b2Min(color.g, 0.996f)), -logf(1 - b2Min(color.b, 0.996f)));
+		}
+
+		b2Vec2 d = b - a;
+		int steps = (int)ceilf(b2Max(fabsf(d.x), fabsf(d.y)));
+		for (int i = 0;i <= steps;i++) {
+			float t = steps > 0 ? (float)i / steps : 0;
+			int x = (int)(a.x + t * d.x);
+			int y = (int)(a.y + t * d.y);
+			if (x < 0 || y < 0 || x >= width || y >= height) {
+				continue;
+			}
+			float* pixel = &pixels[(y * width + x) * 3];
+			if (add) {
+				pixel[0] += color.r;
+				pixel[1] += color.g;
+				pixel[2] += color.b;
+			}
+			else {
+				pixel[0] = color.r;
+				pixel[1] = color.g;
+				pixel[2] = color.b;
+			}
+		}
+	}
+
+	// binary ppm, accumulated light is tone mapped by 1 - exp(-light)
+	bool write(const char* path) const {
+		FILE* file = fopen(path, "wb");
+		if (!file) {
+			return false;
+		}
+		fprintf(file, "P6\n%d %d\n255\n", width, height);
+		std::vector<unsigned char> row(width * 3);
+		for (int y = 0;y < height;y++) {
+			for (int i = 0;i < width * 3;i++) {
+				row[i] = (unsigned char)(255.0f * (1.0f - expf(-pixels[y * width * 3 + i])) + 0.5f);
+			}
+			fwrite(row.data(), 1, row.size(), file);
+		}
+		return fclose(file) == 0;
+	}
+
+private:
+	// Liang-Barsky clipping to image rectangle
+	bool clip(b2Vec2* a, b2Vec2* b) const {
+		float t0 = 0;
+		float t1 = 1;
+		b2Vec2 d = *b - *a;
+		float p[4] = { -d.x, d.x, -d.y, d.y };
+		float q[4] = { a->x, width - a->x, a->y, height - a->y };
+		for (int i = 0;i < 4;i++) {
+			if (p[i] == 0) {
+				if (q[i] < 0) {
+					return false;
+				}
+				continue;
+			}
+			float t = q[i] / p[i];
+			if (p[i] < 0) {
+				t0 = b2Max(t0, t);
+			}
+			else {
+				t1 = b2Min(t1, t);
+			}
+			if (t0 > t1) {
+				return false;
+			}
+		}
+		b2Vec2 start = *a + t0 * d;
+		*b = *a + t1 * d;
+		*a = start;
+		return true;
+	}
+};
+
+// by WallMaterial
+const b2Color wallColors[] = {
+	b2Color(0.9f, 0.9f, 0.9f),       // reflect
+	b2Color(1.0f, 0.2f, 0.2f),       // absorb
+	b2Color(0.8f, 0.45f, 0.35f),     // granite
+	b2Color(0.5f, 0.8f, 1.0f),       // glass
+	b2Color(0.85f, 0.8f, 0.65f)      // limestone
+};
+static_assert(sizeof(wallColors) / sizeof(wallColors[0]) == WallMaterialsCount, "wallColors needs a color for every WallMaterial");
+
+// every ray leg adds intensity * color, rays which leave the scene are drawn up to their length
+inline void drawFan(Image* image, const SegmentTable* segments, CoherenceHints* hints, RayFan fan, int rays, int maximumReflections, b2Color color, float intensity) {
+	b2Color light = b2Color(intensity * color.r, intensity * color.g, intensity * color.b);
+	hints->prepare(rays, maximumReflections, segments->count);
+	for (int i = 0;i < rays;i++) {
+		Ray ray = Ray(fan.start + ((i + 0.5f) / rays) * (fan.end - fan.start), 100, fan.angle, maximumReflections);
+		b2Vec2 from = ray.from;
+		b2Vec2 direction = b2Vec2(cos(ray.angle), sin(ray.angle));
+		int hits = 0;
+		bool absorbed = false;
+
+		HintedScene hinted = hints->scene(segments, nullptr, i);
+		traceRay(&hinted, ray, [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			image->line(source, callback.m_point, light, true);
+			from = callback.m_point;
+			direction = reflect(callback.m_point - source, callback.m_normal);
+			direction.Normalize();
+			hits++;
+			absorbed = materials[callback.m_material].absorb;
+		});
+
+		if (!absorbed && hits <= maximumReflections) {
+			image->line(from, from + ray.length * direction, light, true);
+		}
+	}
+}
+
+class FrameRenderer {
+public:
+	const RenderSpec* spec;
+	Image image;
+	SegmentTable segments;
+	PyramidModel model;
+	CoherenceHints hints[2];         // input and Queen fan of the previous frame of this worker
+
+	// builds walls of frame, returns queen fan angle
+	float build(int frame) {
+		model = PyramidModel();
+		float queenAngle = spec->apply(frame, &model);
+		segments.clear();
+		model.build(&segments);
+		segments.pad();
+		return queenAngle;
+	}
+
+	bool render(int frame, b2Vec2 lower, b2Vec2 upper) {
+		float queenAngle = build(frame);
+		image.reset(spec->width, spec->height, lower, upper);
+
+		if (spec->inputFan) {
+			drawFan(&image, &segments, &hints[0], model.inputFan(), spec->rays, spec->maximumReflections, b2Color(1.0f, 0.8f, 0.3f), spec->rayIntensity);
+		}
+		if (spec->queenFan) {
+			drawFan(&image, &segments, &hints[1], model.queenFan(queenAngle), spec->rays, spec->maximumReflections, b2Color(0.3f, 0.7f, 1.0f), spec->rayIntensity);
+		}
+		for (int i = 0;i < segments.count;i++) {
+			image.line(segments.start(i), segments.end(i), wallColors[segments.material[i]], false);
+		}
+
+		std::string path = spec->framePath(frame);
+		std::string temporary = path + ".tmp";
+		if (!image.write(temporary.c_str())) {
+			fprintf(stderr, "can not write %s\n", temporary.c_str());
+			return false;
+		}
+		return std::rename(temporary.c_str(), path.c_str()) == 0;
+	}
+};
+
+// bounds of first frame walls with margin, widened to image aspect ratio
+inline void fitView(const RenderSpec& spec, b2Vec2* lower, b2Vec2* upper) {
+	FrameRenderer renderer;
+	renderer.spec = &spec;
+	renderer.build(0);
+
+	*lower = b2Vec2(b2_maxFloat, b2_maxFloat);
+	*upper = b2Vec2(-b2_maxFloat, -b2_maxFloat);
+	for (int i = 0;i < renderer.segments.count;i++) {
+		*lower = b2Min(*lower, b2Min(renderer.segments.start(i), renderer.segments.end(i)));
+		*upper = b2Max(*upper, b2Max(renderer.segments.start(i), renderer.segments.end(i)));
+	}
+
+	b2Vec2 center = 0.5f * (*lower + *upper);
+	b2Vec2 half = 0.52f * (*upper - *lower);
+	float aspect = (float)spec.width / spec.height;
+	if (half.x < half.y * aspect) {
+		half.x = half.y * aspect;
+	}
+	else {
+		half.y = half.x / aspect;
+	}
+	*lower = center - half;
+	*upper = center + half;
+}
+
+inline bool exists(const std::string& path) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file) {
+		fclose(file);
+	}
+	return file != nullptr;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: render <spec> [threads]\n");
+		return 1;
+	}
+
+	RenderSpec spec;
+	if (!spec.load(argv[1]) || !spec.createOutputDirectory()) {
+		return 1;
+	}
+	int threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+	threads = b2Max(1, threads);
+
+	// one view for all frames, so walls do not jump in video
+	b2Vec2 lower = spec.viewLower;
+	b2Vec2 upper = spec.viewUpper;
+	if (spec.autoView) {
+		fitView(spec, &lower, &upper);
+	}
+
+	std::atomic<int> next{ 0 };
+	std::atomic<int> rendered{ 0 };
+	std::atomic<int> skipped{ 0 };
+	std::atomic<int> failed{ 0 };
+	std::vector<std::thread> workers;
+
+	for (int k = 0;k < threads;k++) {
+		workers.push_back(std::thread([&]() {
+			FrameRenderer renderer;
+			renderer.spec = &spec;
+			for (int frame = next++;frame < spec.frames;frame = next++) {
+				if (exists(spec.framePath(frame))) {
+					skipped++;
+					continue;
+				}
+				if (renderer.render(frame, lower, upper)) {
+					rendered++;
+				}
+				else {
+					failed++;
+				}
+			}
+		}));
+	}
+	for (int k = 0;k < threads;k++) {
+		workers[k].join();
+	}
+
+	printf("%d frames rendered, %d resumed, %d failed\n", rendered.load(), skipped.load(), failed.load());
+	return failed ? 1 : 0;
+}
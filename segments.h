@@ -0,0 +1,411 @@
+#pragma once
+
+#include "trace.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Scenes up to this number of segments are ray casted by brute force over SegmentTable,
+// bigger ones go through b2World broad-phase tree
+#define BRUTE_FORCE_SEGMENTS_LIMIT 1024
+
+// Flat structure-of-arrays copy of static walls.
+// Hot arrays are padded by pad() to multiple of 8 with zero length segments which never hit.
+class SegmentTable {
+public:
+	std::vector<float> x0;
+	std::vector<float> y0;
+	std::vector<float> dx;
+	std::vector<float> dy;
+	std::vector<uint8> material;
+
+	// cold data, fixture and chain child every segment came from
+	std::vector<b2Fixture*> fixture;
+	std::vector<int32> childIndex;
+
+	int count = 0;
+	std::vector<int> bodyFirst;      // first segment of every body given to build()
+
+	void clear() {
+		x0.clear();
+		y0.clear();
+		dx.clear();
+		dy.clear();
+		material.clear();
+		fixture.clear();
+		childIndex.clear();
+		count = 0;
+	}
+
+	void add(b2Vec2 v1, b2Vec2 v2, int segmentMaterial, b2Fixture* segmentFixture, int32 segmentChildIndex) {
+		x0.push_back(v1.x);
+		y0.push_back(v1.y);
+		dx.push_back(v2.x - v1.x);
+		dy.push_back(v2.y - v1.y);
+		material.push_back((uint8)segmentMaterial);
+		fixture.push_back(segmentFixture);
+		childIndex.push_back(segmentChildIndex);
+		count++;
+	}
+
+	// call after the last add()
+	void pad() {
+		int padded = (count + 7) & ~7;
+		x0.resize(padded, 0);
+		y0.resize(padded, 0);
+		dx.resize(padded, 0);
+		dy.resize(padded, 0);
+		material.resize(padded, ReflectWall);
+	}
+
+	b2Vec2 start(int i) const {
+		return b2Vec2(x0[i], y0[i]);
+	}
+
+	b2Vec2 end(int i) const {
+		return b2Vec2(x0[i] + dx[i], y0[i] + dy[i]);
+	}
+
+	// exports all edge and chain fixtures of body in world coordinates
+	void build(b2Body* body) {
+		build(std::vector<b2Body*>(1, body));
+	}
+
+	// walls of every body one after another, segments of bodies[k] start at bodyFirst[k]
+	void build(const std::vector<b2Body*>& bodies) {
+		clear();
+		bodyFirst.clear();
+		for (int k = 0;k < bodies.size();k++) {
+			bodyFirst.push_back(count);
+			edges(bodies[k], [&](b2Vec2 v1, b2Vec2 v2, b2Fixture* f, int32 child) {
+				add(v1, v2, materialOf(f), f, child);
+			});
+		}
+		pad();
+	}
+
+	// moves segments of bodies[from ..] to current transforms and shapes of their bodies, order and
+	// everything else stays. False when some body has other number of segments than at build().
+	bool refit(const std::vector<b2Body*>& bodies, int from) {
+		if (bodies.size() != bodyFirst.size()) {
+			return false;
+		}
+		for (int k = from;k < bodies.size();k++) {
+			int last = k + 1 < bodyFirst.size() ? bodyFirst[k + 1] : count;
+			int edgesCount = 0;
+			edges(bodies[k], [&](b2Vec2 v1, b2Vec2 v2, b2Fixture* f, int32 child) {
+				edgesCount++;
+			});
+			if (edgesCount != last - bodyFirst[k]) {
+				return false;
+			}
+
+			int i = bodyFirst[k];
+			edges(bodies[k], [&](b2Vec2 v1, b2Vec2 v2, b2Fixture* f, int32 child) {
+				x0[i] = v1.x;
+				y0[i] = v1.y;
+				dx[i] = v2.x - v1.x;
+				dy[i] = v2.y - v1.y;
+				if (fixture[i]) {        // snapshots keep null fixtures and own indices
+					fixture[i] = f;
+					childIndex[i] = child;
+				}
+				i++;
+			});
+		}
+		return true;
+	}
+
+	// calls visit(v1, v2, fixture, child) for every edge and chain child of body in world coordinates
+	template <typename Visitor>
+	static void edges(b2Body* body, Visitor visit) {
+		const b2Transform& xf = body->GetTransform();
+
+		for (b2Fixture* f = body->GetFixtureList();f;f = f->GetNext()) {
+			if (f->GetType() == b2Shape::e_edge) {
+				b2EdgeShape* edge = (b2EdgeShape*)f->GetShape();
+				visit(b2Mul(xf, edge->m_vertex1), b2Mul(xf, edge->m_vertex2), f, 0);
+			}
+			if (f->GetType() == b2Shape::e_chain) {
+				b2ChainShape* chain = (b2ChainShape*)f->GetShape();
+				for (int32 i = 0;i < chain->GetChildCount();i++) {
+					b2EdgeShape edge;
+					chain->GetChildEdge(&edge, i);
+					visit(b2Mul(xf, edge.m_vertex1), b2Mul(xf, edge.m_vertex2), f, i);
+				}
+			}
+		}
+	}
+
+	// closest segment crossed by p1->p2 within maxFraction, returns -1 if nothing is hit
+	int rayCast(b2Vec2 p1, b2Vec2 p2, float maxFraction, float* fraction) const {
+		return rayCast(p1, p2, maxFraction, fraction, 0, count);
+	}
+
+	// same over segments first .. last, last must be padded to multiple of 8 past first
+	int rayCast(b2Vec2 p1, b2Vec2 p2, float maxFraction, float* fraction, int first, int last) const {
+		b2Vec2 r = p2 - p1;
+		float best = maxFraction;
+		int bestIndex = -1;
+
+#if defined(__AVX2__)
+		// 8 segments per iteration, every lane keeps its own closest hit
+		__m256 px = _mm256_set1_ps(p1.x);
+		__m256 py = _mm256_set1_ps(p1.y);
+		__m256 rx = _mm256_set1_ps(r.x);
+		__m256 ry = _mm256_set1_ps(r.y);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 one = _mm256_set1_ps(1.0f);
+
+		__m256 laneBest = _mm256_set1_ps(maxFraction);
+		__m256i laneIndex = _mm256_set1_epi32(-1);
+		__m256i index = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		__m256i eight = _mm256_set1_epi32(8);
+
+		for (int i = first;i < last;i += 8) {
+			__m256 wx = _mm256_sub_ps(_mm256_loadu_ps(&x0[i]), px);
+			__m256 wy = _mm256_sub_ps(_mm256_loadu_ps(&y0[i]), py);
+			__m256 sx = _mm256_loadu_ps(&dx[i]);
+			__m256 sy = _mm256_loadu_ps(&dy[i]);
+
+			__m256 denominator = _mm256_sub_ps(_mm256_mul_ps(rx, sy), _mm256_mul_ps(ry, sx));
+			__m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(wx, sy), _mm256_mul_ps(wy, sx)), denominator);
+			__m256 u = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(wx, ry), _mm256_mul_ps(wy, rx)), denominator);
+
+			__m256 mask = _mm256_cmp_ps(denominator, zero, _CMP_NEQ_OQ);
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, laneBest, _CMP_LT_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+
+			laneBest = _mm256_blendv_ps(laneBest, t, mask);
+			laneIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(laneIndex), _mm256_castsi256_ps(index), mask));
+			index = _mm256_add_epi32(index, eight);
+		}
+
+		float lanes[8];
+		int32 indices[8];
+		_mm256_storeu_ps(lanes, laneBest);
+		_mm256_storeu_si256((__m256i*)indices, laneIndex);
+
+		for (int i = 0;i < 8;i++) {
+			if (indices[i] >= 0 && lanes[i] < best) {
+				best = lanes[i];
+				bestIndex = indices[i];
+			}
+		}
+#else
+		for (int i = first;i < last;i++) {
+			if (rayCastSegment(i, p1, r, &best)) {
+				bestIndex = i;
+			}
+		}
+#endif
+
+		*fraction = best;
+		return bestIndex;
+	}
+
+	// any segment other than skip crossing p1->p2 at fraction up to maxFraction, equal hits included.
+	// Without divisions: t and u are compared as numerators against denominator turned positive.
+	bool occluded(b2Vec2 p1, b2Vec2 p2, float maxFraction, int skip) const {
+		b2Vec2 r = p2 - p1;
+		float limit = maxFraction * (1 + b2_epsilon);
+
+#if defined(__AVX2__)
+		__m256 px = _mm256_set1_ps(p1.x);
+		__m256 py = _mm256_set1_ps(p1.y);
+		__m256 rx = _mm256_set1_ps(r.x);
+		__m256 ry = _mm256_set1_ps(r.y);
+		__m256 maximum = _mm256_set1_ps(limit);
+		__m256i skipIndex = _mm256_set1_epi32(skip);
+		__m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		__m256i eight = _mm256_set1_epi32(8);
+
+		// two blocks per branch
+		for (int i = 0;i < count;i += 16) {
+			__m256 hit = _mm256_or_ps(crosses8(i, px, py, rx, ry, maximum, index, skipIndex),
+				i + 8 < count ? crosses8(i + 8, px, py, rx, ry, maximum, _mm256_add_epi32(index, eight), skipIndex) : _mm256_setzero_ps());
+			if (_mm256_movemask_ps(hit)) {
+				return true;
+			}
+			index = _mm256_add_epi32(index, _mm256_add_epi32(eight, eight));
+		}
+		return false;
+#else
+		for (int i = 0;i < count;i++) {
+			float best = limit;
+			if (i != skip && rayCastSegment(i, p1, r, &best)) {
+				return true;
+			}
+		}
+		return false;
+#endif
+	}
+
+	// true when p1->p2 crosses segment i at fraction below 1, with the arithmetic of rayCast() lanes
+	// so that a single segment test and the full query agree bit for bit
+	bool rayCastOne(int i, b2Vec2 p1, b2Vec2 p2, float* fraction) const {
+		b2Vec2 r = p2 - p1;
+#if defined(__AVX2__)
+		int block = i & ~7;
+		__m256 rx = _mm256_set1_ps(r.x);
+		__m256 ry = _mm256_set1_ps(r.y);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 wx = _mm256_sub_ps(_mm256_loadu_ps(&x0[block]), _mm256_set1_ps(p1.x));
+		__m256 wy = _mm256_sub_ps(_mm256_loadu_ps(&y0[block]), _mm256_set1_ps(p1.y));
+		__m256 sx = _mm256_loadu_ps(&dx[block]);
+		__m256 sy = _mm256_loadu_ps(&dy[block]);
+
+		__m256 denominator = _mm256_sub_ps(_mm256_mul_ps(rx, sy), _mm256_mul_ps(ry, sx));
+		__m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(wx, sy), _mm256_mul_ps(wy, sx)), denominator);
+		__m256 u = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(wx, ry), _mm256_mul_ps(wy, rx)), denominator);
+
+		__m256 mask = _mm256_cmp_ps(denominator, zero, _CMP_NEQ_OQ);
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, one, _CMP_LT_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+
+		float lanes[8];
+		_mm256_storeu_ps(lanes, t);
+		*fraction = lanes[i - block];
+		return (_mm256_movemask_ps(mask) >> (i - block)) & 1;
+#else
+		*fraction = 1.0f;
+		return rayCastSegment(i, p1, r, fraction);
+#endif
+	}
+
+#if defined(__AVX2__)
+	// lanes of segments i..i+7 crossed at fraction below maximum, for occluded()
+	__m256 crosses8(int i, __m256 px, __m256 py, __m256 rx, __m256 ry, __m256 maximum, __m256i index, __m256i skipIndex) const {
+		__m256 zero = _mm256_setzero_ps();
+		__m256 wx = _mm256_sub_ps(_mm256_loadu_ps(&x0[i]), px);
+		__m256 wy = _mm256_sub_ps(_mm256_loadu_ps(&y0[i]), py);
+		__m256 sx = _mm256_loadu_ps(&dx[i]);
+		__m256 sy = _mm256_loadu_ps(&dy[i]);
+
+		__m256 denominator = _mm256_sub_ps(_mm256_mul_ps(rx, sy), _mm256_mul_ps(ry, sx));
+		__m256 flip = _mm256_and_ps(denominator, _mm256_set1_ps(-0.0f));
+		__m256 d = _mm256_xor_ps(denominator, flip);
+		__m256 t = _mm256_xor_ps(_mm256_sub_ps(_mm256_mul_ps(wx, sy), _mm256_mul_ps(wy, sx)), flip);
+		__m256 u = _mm256_xor_ps(_mm256_sub_ps(_mm256_mul_ps(wx, ry), _mm256_mul_ps(wy, rx)), flip);
+
+		__m256 mask = _mm256_cmp_ps(d, zero, _CMP_GT_OQ);
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_mul_ps(maximum, d), _CMP_LT_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, d, _CMP_LE_OQ));
+		return _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(index, skipIndex)), mask);
+	}
+#endif
+
+	// true when p1 + t * r crosses segment i with t < best, best is then set to t
+	bool rayCastSegment(int i, b2Vec2 p1, b2Vec2 r, float* best) const {
+		float denominator = r.x * dy[i] - r.y * dx[i];
+		if (denominator == 0) {
+			return false;
+		}
+
+		float wx = x0[i] - p1.x;
+		float wy = y0[i] - p1.y;
+		float t = (wx * dy[i] - wy * dx[i]) / denominator;
+		float u = (wx * r.y - wy * r.x) / denominator;
+
+		if (t >= 0 && t < *best && u >= 0 && u <= 1) {
+			*best = t;
+			return true;
+		}
+		return false;
+	}
+
+	// normal of segment i facing the ray direction origin side, like b2EdgeShape::RayCast
+	b2Vec2 normal(int i, b2Vec2 direction) const {
+		b2Vec2 n = b2Vec2(dy[i], -dx[i]);
+		n.Normalize();
+		if (b2Dot(n, direction) > 0) {
+			return -n;
+		}
+		return n;
+	}
+};
+
+// same walls as drawChain(b2Body*, ...) added straight to table, without fixtures and heap allocations
+// once table capacity is reached. Returns number of added segments, call pad() after the last chain.
+inline int drawChain(SegmentTable* segments, const b2Vec2* vertices, int count, int material) {
+	int added = 0;
+	b2Vec2 previous = vertices[0];
+	for (int i = 1;i < count;i++) {
+		if (b2DistanceSquared(previous, vertices[i]) > b2_linearSlop * b2_linearSlop) {
+			segments->add(previous, vertices[i], material, nullptr, segments->count);
+			previous = vertices[i];
+			added++;
+		}
+	}
+	return added;
+}
+
+// table walls are two sided already
+inline int drawEdges(SegmentTable* segments, const b2Vec2* vertices, int count, int material) {
+	return drawChain(segments, vertices, count, material);
+}
+
+// Ray cast backend used by traceRay, switches to brute force for small scenes
+class Scene {
+public:
+	b2World* world = nullptr;
+	SegmentTable segments;
+	bool bruteForce = false;
+
+	// call after every rebuild of body
+	void update(b2World* sceneWorld, b2Body* body) {
+		update(sceneWorld, std::vector<b2Body*>(1, body));
+	}
+
+	// static body first, then moving parts
+	void update(b2World* sceneWorld, const std::vector<b2Body*>& bodies) {
+		world = sceneWorld;
+		segments.build(bodies);
+		bruteForce = segments.count <= BRUTE_FORCE_SEGMENTS_LIMIT;
+	}
+
+	// call after moving parts moved, b2World refits its own tree in SetTransform(). False when
+	// a part changed its number of segments and update() is needed.
+	bool refit(const std::vector<b2Body*>& bodies) {
+		return segments.refit(bodies, 1);
+	}
+
+	const char* backendName() const {
+		return bruteForce ? "brute force" : "broad-phase";
+	}
+};
+
+// fills callback with hit of segment i at fraction of point1 -> point2
+inline void reportSegment(const SegmentTable* segments, int i, float fraction, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	callback->m_hit = true;
+	callback->m_point = point1 + fraction * (point2 - point1);
+	callback->m_normal = segments->normal(i, point2 - point1);
+	callback->m_fixture = segments->fixture[i];
+	callback->m_childIndex = segments->childIndex[i];
+	callback->m_material = segments->material[i];
+}
+
+inline void rayCastClosest(const SegmentTable* segments, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	float fraction;
+	int i = segments->rayCast(point1, point2, 1.0f, &fraction);
+	if (i >= 0) {
+		reportSegment(segments, i, fraction, callback, point1, point2);
+	}
+}
+
+inline void rayCastClosest(const Scene* scene, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	if (scene->bruteForce) {
+		rayCastClosest(&scene->segments, callback, point1, point2);
+	}
+	else {
+		rayCastClosest(scene->world, callback, point1, point2);
+	}
+}
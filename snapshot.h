@@ -0,0 +1,325 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <numeric>
+#include <algorithm>
+
+#include "segments.h"
+
+// Bounding volume hierarchy over SegmentTable, nodes split at median segment center along the longer axis
+class SegmentTree {
+public:
+	class Node {
+	public:
+		b2AABB box;
+		int left = -1;       // children of inner node
+		int right = -1;
+		int first = 0;       // order[first .. first + count) of leaf, count is 0 for inner nodes
+		int count = 0;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<int> order;  // segment indices, every leaf owns a continuous range
+
+	void build(const SegmentTable* segments) {
+		nodes.clear();
+		order.resize(segments->count);
+		std::iota(order.begin(), order.end(), 0);
+		if (segments->count == 0) {
+			return;
+		}
+
+		centers.resize(segments->count);
+		for (int i = 0;i < segments->count;i++) {
+			centers[i] = segments->start(i) + 0.5f * b2Vec2(segments->dx[i], segments->dy[i]);
+		}
+		nodes.reserve(2 * segments->count / leafSize + 1);
+		split(segments, 0, segments->count);
+		centers.clear();
+	}
+
+	// boxes grown or shrunk around moved segments, bottom up in O(n). Nodes keep their segments, so
+	// the tree gets looser as parts move far from where it was built.
+	void refit(const SegmentTable* segments) {
+		// children are always after their parent
+		for (int k = (int)nodes.size() - 1;k >= 0;k--) {
+			Node& node = nodes[k];
+			if (node.count > 0) {
+				node.box.lowerBound = b2Vec2(b2_maxFloat, b2_maxFloat);
+				node.box.upperBound = b2Vec2(-b2_maxFloat, -b2_maxFloat);
+				for (int j = node.first;j < node.first + node.count;j++) {
+					int i = order[j];
+					node.box.lowerBound = b2Min(node.box.lowerBound, b2Min(segments->start(i), segments->end(i)));
+					node.box.upperBound = b2Max(node.box.upperBound, b2Max(segments->start(i), segments->end(i)));
+				}
+			}
+			else {
+				node.box.Combine(nodes[node.left].box, nodes[node.right].box);
+			}
+		}
+	}
+
+	// closest segment crossed by p1->p2 within maxFraction, returns -1 if nothing is hit
+	int rayCast(const SegmentTable* segments, b2Vec2 p1, b2Vec2 p2, float maxFraction, float* fraction) const {
+		b2Vec2 r = p2 - p1;
+		float best = maxFraction;
+		int bestIndex = -1;
+
+		int stack[64];
+		int top = 0;
+		if (!nodes.empty()) {
+			stack[top++] = 0;
+		}
+
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			if (!crossesBox(node.box, p1, r, best)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (int j = node.first;j < node.first + node.count;j++) {
+					if (segments->rayCastSegment(order[j], p1, r, &best)) {
+						bestIndex = order[j];
+					}
+				}
+			}
+			else {
+				stack[top++] = node.right;
+				stack[top++] = node.left;
+			}
+		}
+
+		*fraction = best;
+		return bestIndex;
+	}
+
+	// any segment other than skip crossing p1->p2 at fraction up to maxFraction, stops at the first one.
+	// Boxes are cut by maxFraction from the start, so a short leg visits few nodes.
+	bool occluded(const SegmentTable* segments, b2Vec2 p1, b2Vec2 p2, float maxFraction, int skip) const {
+		b2Vec2 r = p2 - p1;
+		float limit = maxFraction * (1 + b2_epsilon);         // equal hits are occluders too
+
+		int stack[64];
+		int top = 0;
+		if (!nodes.empty()) {
+			stack[top++] = 0;
+		}
+
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			if (!crossesBox(node.box, p1, r, limit)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (int j = node.first;j < node.first + node.count;j++) {
+					float best = limit;
+					if (order[j] != skip && segments->rayCastSegment(order[j], p1, r, &best)) {
+						return true;
+					}
+				}
+			}
+			else {
+				stack[top++] = node.right;
+				stack[top++] = node.left;
+			}
+		}
+		return false;
+	}
+
+	// calls visit(i) for every segment whose leaf box overlaps box, some of them outside of it
+	template <typename Visitor>
+	void query(const b2AABB& box, Visitor visit) const {
+		int stack[64];
+		int top = 0;
+		if (!nodes.empty()) {
+			stack[top++] = 0;
+		}
+
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			if (!b2TestOverlap(node.box, box)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (int j = node.first;j < node.first + node.count;j++) {
+					visit(order[j]);
+				}
+			}
+			else {
+				stack[top++] = node.right;
+				stack[top++] = node.left;
+			}
+		}
+	}
+
+	// slab test of p1 + t * r for t in [0, maxFraction]
+	static bool crossesBox(const b2AABB& box, b2Vec2 p1, b2Vec2 r, float maxFraction) {
+		float t0 = 0;
+		float t1 = maxFraction;
+		for (int axis = 0;axis < 2;axis++) {
+			float origin = axis == 0 ? p1.x : p1.y;
+			float direction = axis == 0 ? r.x : r.y;
+			float lower = axis == 0 ? box.lowerBound.x : box.lowerBound.y;
+			float upper = axis == 0 ? box.upperBound.x : box.upperBound.y;
+
+			if (direction == 0) {
+				if (origin < lower || origin > upper) {
+					return false;
+				}
+				continue;
+			}
+			float inverse = 1 / direction;
+			float near = (lower - origin) * inverse;
+			float far = (upper - origin) * inverse;
+			if (near > far) {
+				std::swap(near, far);
+			}
+			t0 = b2Max(t0, near);
+			t1 = b2Min(t1, far);
+			if (t0 > t1) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	const int leafSize = 4;
+	std::vector<b2Vec2> centers;
+
+	int split(const SegmentTable* segments, int first, int count) {
+		int index = (int)nodes.size();
+		nodes.push_back(Node());
+
+		b2AABB box;
+		box.lowerBound = b2Vec2(b2_maxFloat, b2_maxFloat);
+		box.upperBound = b2Vec2(-b2_maxFloat, -b2_maxFloat);
+		b2Vec2 lower = box.lowerBound;
+		b2Vec2 upper = box.upperBound;
+		for (int j = first;j < first + count;j++) {
+			int i = order[j];
+			box.lowerBound = b2Min(box.lowerBound, b2Min(segments->start(i), segments->end(i)));
+			box.upperBound = b2Max(box.upperBound, b2Max(segments->start(i), segments->end(i)));
+			lower = b2Min(lower, centers[i]);
+			upper = b2Max(upper, centers[i]);
+		}
+		nodes[index].box = box;
+
+		if (count <= leafSize) {
+			nodes[index].first = first;
+			nodes[index].count = count;
+			return index;
+		}
+
+		bool alongX = upper.x - lower.x >= upper.y - lower.y;
+		int half = count / 2;
+		std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, [&](int a, int b) {
+			return alongX ? centers[a].x < centers[b].x : centers[a].y < centers[b].y;
+		});
+
+		int left = split(segments, first, half);
+		int right = split(segments, first + half, count - half);
+		nodes[index].left = left;
+		nodes[index].right = right;
+		return index;
+	}
+};
+
+// Immutable copy of static walls with its own acceleration structure, safe to trace from any number of
+// threads. Fixtures die with the body on rebuild, so the copy keeps no fixture pointers: hits report
+// null m_fixture and segment index as m_childIndex.
+class SceneSnapshot {
+public:
+	SegmentTable segments;
+	SegmentTree tree;
+	bool bruteForce = false;
+	uint32 version = 0;
+
+	bool refitted = false;   // made from previous snapshot by refit, see SnapshotSlot::refit()
+
+	SceneSnapshot(b2Body* body, uint32 _version) : SceneSnapshot(std::vector<b2Body*>(1, body), _version) {
+	}
+
+	// static body first, then moving parts
+	SceneSnapshot(const std::vector<b2Body*>& bodies, uint32 _version) {
+		version = _version;
+		build(bodies);
+	}
+
+	// previous walls with moving parts at current transforms, tree refitted instead of built.
+	// Rebuilds when some part changed its number of segments.
+	SceneSnapshot(const SceneSnapshot& previous, const std::vector<b2Body*>& bodies, uint32 _version) : segments(previous.segments), tree(previous.tree) {
+		version = _version;
+		bruteForce = previous.bruteForce;
+		if (segments.refit(bodies, 1)) {
+			tree.refit(&segments);
+			refitted = true;
+		}
+		else {
+			build(bodies);
+		}
+	}
+
+	const char* backendName() const {
+		return bruteForce ? "brute force" : "segment tree";
+	}
+
+private:
+	void build(const std::vector<b2Body*>& bodies) {
+		segments.build(bodies);
+		for (int i = 0;i < segments.count;i++) {
+			segments.fixture[i] = nullptr;
+			segments.childIndex[i] = i;
+		}
+		tree.build(&segments);
+		bruteForce = segments.count <= BRUTE_FORCE_SEGMENTS_LIMIT;
+	}
+};
+
+inline void rayCastClosest(const SceneSnapshot* snapshot, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	float fraction;
+	int i = snapshot->bruteForce ?
+		snapshot->segments.rayCast(point1, point2, 1.0f, &fraction) :
+		snapshot->tree.rayCast(&snapshot->segments, point1, point2, 1.0f, &fraction);
+	if (i >= 0) {
+		reportSegment(&snapshot->segments, i, fraction, callback, point1, point2);
+	}
+}
+
+// Latest snapshot of the scene. Tracing threads acquire() a reference and keep using it while the UI
+// publishes a new one after rebuild, the old snapshot is freed when its last reader drops it.
+class SnapshotSlot {
+public:
+	std::shared_ptr<const SceneSnapshot> acquire() const {
+		return std::atomic_load(&current);
+	}
+
+	// call after every rebuild of body
+	std::shared_ptr<const SceneSnapshot> publish(b2Body* body) {
+		std::shared_ptr<const SceneSnapshot> snapshot = std::make_shared<const SceneSnapshot>(body, ++version);
+		std::atomic_store(&current, snapshot);
+		return snapshot;
+	}
+
+	std::shared_ptr<const SceneSnapshot> publish(const std::vector<b2Body*>& bodies) {
+		std::shared_ptr<const SceneSnapshot> snapshot = std::make_shared<const SceneSnapshot>(bodies, ++version);
+		std::atomic_store(&current, snapshot);
+		return snapshot;
+	}
+
+	// call after moving parts of bodies moved, readers of the previous snapshot still see old positions
+	std::shared_ptr<const SceneSnapshot> refit(const std::vector<b2Body*>& bodies) {
+		std::shared_ptr<const SceneSnapshot> previous = acquire();
+		if (!previous) {
+			return publish(bodies);
+		}
+		std::shared_ptr<const SceneSnapshot> snapshot = std::make_shared<const SceneSnapshot>(*previous, bodies, ++version);
+		std::atomic_store(&current, snapshot);
+		return snapshot;
+	}
+
+private:
+	std::shared_ptr<const SceneSnapshot> current;
+	std::atomic<uint32> version{ 0 };
+};
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <thread>
+#include <cstdint>
+
+#include "trace.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// wavelengths carried by one bundle, multiple of 8
+#define SPECTRAL_LANES 16
+
+// Rays sharing one path for a set of wavelengths, weight[lane] is energy left in every wavelength
+class SpectralBundle {
+public:
+	b2Vec2 source;
+	b2Vec2 direction;
+	float weight[SPECTRAL_LANES];
+	uint32 lanes;            // bit mask of wavelengths following this path
+	bool inside;             // in glass
+	int bounce;
+};
+
+// refraction of unit direction d at unit normal n facing incident side for 8 relative indices
+// eta = n1 / n2, tir[lane] is 1 where light is totally reflected instead
+inline void refract8(const float* eta, b2Vec2 d, b2Vec2 n, float* x, float* y, float* tir) {
+	float cosI = -b2Dot(d, n);
+#if defined(__AVX2__)
+	__m256 e = _mm256_loadu_ps(eta);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 sin2 = _mm256_mul_ps(_mm256_mul_ps(e, e), _mm256_set1_ps(1 - cosI * cosI));
+	__m256 total = _mm256_cmp_ps(sin2, one, _CMP_GT_OQ);
+	__m256 cosT = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(one, sin2)));
+	__m256 k = _mm256_sub_ps(_mm256_mul_ps(e, _mm256_set1_ps(cosI)), cosT);
+	_mm256_storeu_ps(x, _mm256_fmadd_ps(k, _mm256_set1_ps(n.x), _mm256_mul_ps(e, _mm256_set1_ps(d.x))));
+	_mm256_storeu_ps(y, _mm256_fmadd_ps(k, _mm256_set1_ps(n.y), _mm256_mul_ps(e, _mm256_set1_ps(d.y))));
+	_mm256_storeu_ps(tir, _mm256_and_ps(total, one));
+#else
+	for (int j = 0;j < 8;j++) {
+		float sin2 = eta[j] * eta[j] * (1 - cosI * cosI);
+		float k = eta[j] * cosI - sqrtf(b2Max(0.0f, 1 - sin2));
+		x[j] = eta[j] * d.x + k * n.x;
+		y[j] = eta[j] * d.y + k * n.y;
+		tir[j] = sin2 > 1 ? 1.0f : 0.0f;
+	}
+#endif
+}
+
+// weight *= factor and lost += weight * (1 - factor) for 8 lanes
+inline void attenuate8(float* weight, const float* factor, float* lost) {
+#if defined(__AVX2__)
+	__m256 w = _mm256_loadu_ps(weight);
+	__m256 reflected = _mm256_mul_ps(w, _mm256_loadu_ps(factor));
+	_mm256_storeu_ps(lost, _mm256_add_ps(_mm256_loadu_ps(lost), _mm256_sub_ps(w, reflected)));
+	_mm256_storeu_ps(weight, reflected);
+#else
+	for (int j = 0;j < 8;j++) {
+		lost[j] += weight[j] * (1 - factor[j]);
+		weight[j] *= factor[j];
+	}
+#endif
+}
+
+// Traces all wavelengths of a ray as one bundle, so ray casts do not grow with number of wavelengths.
+// Reflectance is applied lane-wise; a bundle splits only at glass, where lanes leaving in different
+// directions continue as separate bundles. Glass refracts or totally reflects, Fresnel reflection
+// is ignored. Glass solids must not contain other walls, a ray toggles inside/outside on every glass hit.
+class SpectralTracer {
+public:
+	std::vector<float> wavelengths;          // micrometers, up to SPECTRAL_LANES
+	std::vector<AbsorbContainer> containers;
+	int maximumReflections = 300;
+	float length = 100;
+	int threads = 1;
+
+	// part of fan energy per wavelength, contained is [container * wavelengths + wavelength]
+	std::vector<double> contained;
+	std::vector<double> absorbed;            // by absorbing walls outside containers
+	std::vector<double> escaped;             // left the scene
+	std::vector<double> dissipated;          // lost in walls with reflectance below 1
+	std::vector<double> unfinished;          // still travelling after maximumReflections
+	int64_t rayCasts = 0;
+	int64_t bundles = 0;
+	int64_t splits = 0;
+
+	SpectralTracer() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	// no wavelengths trace nothing and leave all results empty
+	template <typename World>
+	void traceFan(World m_world, RayFan fan, int rays) {
+		int count = b2Min((int)wavelengths.size(), SPECTRAL_LANES);
+		if (count == 0) {
+			contained.clear();
+			absorbed.clear();
+			escaped.clear();
+			dissipated.clear();
+			unfinished.clear();
+			rayCasts = 0;
+			bundles = 0;
+			splits = 0;
+			return;
+		}
+		prepare(count);
+
+		std::vector<Partial> partial(threads);
+		std::vector<std::thread> workers;
+
+		for (int k = 0;k < threads;k++) {
+			workers.push_back(std::thread([&, k]() {
+				Partial& result = partial[k];
+				result.contained.assign(containers.size() * SPECTRAL_LANES, 0.0);
+				std::vector<SpectralBundle> stack;
+
+				for (int i = k;i < rays;i += threads) {
+					SpectralBundle bundle;
+					b2Vec2 point = fan.start + ((i + 0.5f) / rays) * (fan.end - fan.start);
+					bundle.direction = b2Vec2(cos(fan.angle), sin(fan.angle));
+					bundle.source = point + 0.01f * bundle.direction;
+					for (int j = 0;j < SPECTRAL_LANES;j++) {
+						bundle.weight[j] = j < count ? 1.0f : 0.0f;
+					}
+					bundle.lanes = (uint32)((1ull << count) - 1);
+					bundle.inside = false;
+					bundle.bounce = 0;
+
+					stack.push_back(bundle);
+					while (!stack.empty()) {
+						bundle = stack.back();
+						stack.pop_back();
+						result.bundles++;
+						follow(m_world, bundle, stack, &result);
+					}
+					for (int j = 0;j < SPECTRAL_LANES;j++) {
+						result.dissipated[j] += result.rayDissipated[j];
+						result.rayDissipated[j] = 0;
+					}
+				}
+			}));
+		}
+		for (int k = 0;k < threads;k++) {
+			workers[k].join();
+		}
+
+		contained.assign(containers.size() * count, 0.0);
+		absorbed.assign(count, 0.0);
+		escaped.assign(count, 0.0);
+		dissipated.assign(count, 0.0);
+		unfinished.assign(count, 0.0);
+		rayCasts = 0;
+		bundles = 0;
+		splits = 0;
+
+		for (int k = 0;k < threads;k++) {
+			for (int w = 0;w < count;w++) {
+				for (int j = 0;j < containers.size();j++) {
+					contained[j * count + w] += partial[k].contained[j * SPECTRAL_LANES + w] / rays;
+				}
+				absorbed[w] += partial[k].absorbed[w] / rays;
+				escaped[w] += partial[k].escaped[w] / rays;
+				dissipated[w] += partial[k].dissipated[w] / rays;
+				unfinished[w] += partial[k].unfinished[w] / rays;
+			}
+			rayCasts += partial[k].rayCasts;
+			bundles += partial[k].bundles;
+			splits += partial[k].splits;
+		}
+	}
+
+private:
+	// sums of one thread, dissipation of current ray goes to float lanes first
+	class Partial {
+	public:
+		std::vector<double> contained;
+		double absorbed[SPECTRAL_LANES] = {};
+		double escaped[SPECTRAL_LANES] = {};
+		double dissipated[SPECTRAL_LANES] = {};
+		double unfinished[SPECTRAL_LANES] = {};
+		float rayDissipated[SPECTRAL_LANES] = {};
+		int64_t rayCasts = 0;
+		int64_t bundles = 0;
+		int64_t splits = 0;
+	};
+
+	float reflectance[WallMaterialsCount][SPECTRAL_LANES];
+	float index[WallMaterialsCount][SPECTRAL_LANES];
+
+	void prepare(int count) {
+		for (int m = 0;m < WallMaterialsCount;m++) {
+			for (int j = 0;j < SPECTRAL_LANES;j++) {
+				float wavelength = j < count ? wavelengths[j] : 0.55f;
+				float t = b2Clamp((wavelength - 0.4f) / 0.3f, 0.0f, 1.0f);
+				reflectance[m][j] = materials[m].reflectanceBlue + t * (materials[m].reflectanceRed - materials[m].reflectanceBlue);
+				index[m][j] = materials[m].cauchyA + materials[m].cauchyB / (wavelength * wavelength);
+			}
+		}
+	}
+
+	int containerAt(b2Vec2 point) const {
+		for (int i = 0;i < containers.size();i++) {
+			if (containers[i].contains(point)) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	static void add(double* sum, const SpectralBundle& bundle) {
+		for (int j = 0;j < SPECTRAL_LANES;j++) {
+			sum[j] += bundle.weight[j];
+		}
+	}
+
+	template <typename World>
+	void follow(World m_world, SpectralBundle& bundle, std::vector<SpectralBundle>& stack, Partial* result) const {
+		for (;bundle.bounce <= maximumReflections;bundle.bounce++) {
+			RayCastClosestCallback callback = RayCastClosestCallback();
+			rayCastClosest(m_world, &callback, bundle.source, bundle.source + length * bundle.direction);
+			result->rayCasts++;
+
+			if (!callback.m_hit) {
+				add(result->escaped, bundle);
+				return;
+			}
+
+			b2Vec2 x = callback.m_point;
+			int material = callback.m_material;
+			if (materials[material].absorb) {
+				int container = containerAt(x);
+				add(container >= 0 ? &result->contained[container * SPECTRAL_LANES] : result->absorbed, bundle);
+				return;
+			}
+
+			b2Vec2 n = callback.m_normal;
+			if (b2Dot(n, bundle.direction) > 0) {
+				n = -n;
+			}
+
+			if (materials[material].cauchyA > 0) {
+				refract(bundle, x, n, material, stack, result);
+			}
+			else {
+				for (int j = 0;j < SPECTRAL_LANES;j += 8) {
+					attenuate8(bundle.weight + j, reflectance[material] + j, result->rayDissipated + j);
+				}
+				bundle.direction = reflect(bundle.direction, n);
+			}
+			bundle.source = x + 0.0001f * bundle.direction;
+		}
+		add(result->unfinished, bundle);
+	}
+
+	// bundle continues with the first direction group, other groups are pushed to stack
+	void refract(SpectralBundle& bundle, b2Vec2 x, b2Vec2 n, int material, std::vector<SpectralBundle>& stack, Partial* result) const {
+		float eta[SPECTRAL_LANES];
+		float dx[SPECTRAL_LANES];
+		float dy[SPECTRAL_LANES];
+		float tir[SPECTRAL_LANES];
+		for (int j = 0;j < SPECTRAL_LANES;j++) {
+			eta[j] = bundle.inside ? index[material][j] : 1 / index[material][j];
+		}
+		for (int j = 0;j < SPECTRAL_LANES;j += 8) {
+			refract8(eta + j, bundle.direction, n, dx + j, dy + j, tir + j);
+		}
+
+		b2Vec2 mirrored = reflect(bundle.direction, n);
+		SpectralBundle groups[SPECTRAL_LANES];
+		int count = 0;
+
+		for (int j = 0;j < SPECTRAL_LANES;j++) {
+			if (!(bundle.lanes & (1u << j))) {
+				continue;
+			}
+			b2Vec2 direction = tir[j] > 0 ? mirrored : b2Vec2(dx[j], dy[j]);
+			bool inside = tir[j] > 0 ? bundle.inside : !bundle.inside;
+
+			int g = 0;
+			while (g < count && !(groups[g].inside == inside && fabsf(groups[g].direction.x - direction.x) < 1e-6f && fabsf(groups[g].direction.y - direction.y) < 1e-6f)) {
+				g++;
+			}
+			if (g == count) {
+				groups[g] = bundle;
+				groups[g].direction = direction;
+				groups[g].inside = inside;
+				groups[g].lanes = 0;
+				for (int i = 0;i < SPECTRAL_LANES;i++) {
+					groups[g].weight[i] = 0;
+				}
+				count++;
+			}
+			groups[g].lanes |= 1u << j;
+			groups[g].weight[j] = bundle.weight[j];
+		}
+
+		for (int g = 1;g < count;g++) {
+			groups[g].source = x + 0.0001f * groups[g].direction;
+			groups[g].bounce = bundle.bounce + 1;
+			stack.push_back(groups[g]);
+		}
+		result->splits += count - 1;
+		bundle = groups[0];
+	}
+};
@@ -0,0 +1,15 @@
+# sweep run example.spec <shard> on every host, then sweep merge example.spec
+output = results/example
+shards = 8
+
+rays = 1000
+maximumReflections = 300
+validate = 1                       # points with gaps or crossing walls are not traced
+
+# name = value  or  name = from to count
+ascendingAngle = 0.4529 0.4878 8
+descendingAngle = 0.4441 0.4790 8
+galleryCeilingOffset = 0 2 5
+leftGalleryWallMode = 0 1 2        # Horizontal, Parallel
+rightGalleryWallMode = 0 1 2
+galleryBeamsMode = 0 2 3           # Transparent, Reflect, Absorb
@@ -0,0 +1,573 @@
+// Headless parameter sweep over the pyramid model.
+// Not a testbed test: build it as separate executable linked with Box2D only, e.g.
+//   g++ -O2 -std=c++17 -I<box2d>/include sweep/main.cpp <box2d library>
+//
+//   sweep run <spec> <shard>        traces one shard, rerun resumes its partial file
+//   sweep local <spec> [processes]  runs all shards as local processes and merges them
+//   sweep merge <spec>              merges shard files into <output>.csv, lists incomplete shards
+//   sweep families <spec> <index>   prints path families of both fans at one parameter point
+//   sweep hits <spec> <index> <wall>...  prints every ray of both fans touching the walls (segment indices)
+//
+// Parameter points are numbered in fixed order and point i belongs to shard i % shards, so
+// every process (on this host or another one sharing the filesystem) computes the same split.
+// Walls of every point are checked by GeometryValidator first, points with gaps or crossing walls
+// get valid = 0 and empty fan columns instead of tracing rays through leaking geometry.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <filesystem>
+
+#include "../model.h"
+#include "../segments.h"
+#include "../validation.h"
+#include "../families.h"
+#include "../hits.h"
+
+// value range of one model parameter, count values from..to inclusive
+class SweepParameter {
+public:
+	const char* name;
+	float from;
+	float to;
+	int count;
+
+	float value(int i) const {
+		return count > 1 ? from + (to - from) * i / (count - 1) : from;
+	}
+};
+
+class SweepSpec {
+public:
+	std::string output = "sweep";
+	int shards = 1;
+	int rays = 1000;
+	int maximumReflections = 300;
+	bool validate = true;
+	uint64_t hash = 14695981039346656037ull;     // FNV-1a of spec text, shard files of other specs are rejected
+
+	// order of this table defines point numbering
+	std::vector<SweepParameter> parameters = {
+		{ "ascendingAngle", defaultAscendingAngle, defaultAscendingAngle, 1 },
+		{ "descendingAngle", defaultDescendingAngle, defaultDescendingAngle, 1 },
+		{ "galleryCeilingOffset", 1, 1, 1 },
+		{ "ceilingParallelToFloor", 1, 1, 1 },
+		{ "leftGalleryWallMode", Horizontal, Horizontal, 1 },
+		{ "rightGalleryWallMode", Parallel, Parallel, 1 },
+		{ "galleryBeamsMode", Absorb, Absorb, 1 },
+		{ "queenAngle", PI / 6, PI / 6, 1 }
+	};
+
+	// lines are "name = value" or "name = from to count", # starts comment
+	bool load(const char* path) {
+		FILE* file = fopen(path, "r");
+		if (!file) {
+			fprintf(stderr, "can not open spec %s\n", path);
+			return false;
+		}
+
+		char line[1024];
+		while (fgets(line, sizeof(line), file)) {
+			for (char* s = line;*s;s++) {
+				hash = (hash ^ (unsigned char)*s) * 1099511628211ull;
+			}
+
+			char* comment = strchr(line, '#');
+			if (comment) {
+				*comment = 0;
+			}
+
+			char name[64];
+			char value[512];
+			if (sscanf(line, " %63[^= \t] = %511[^\n]", name, value) != 2) {
+				continue;
+			}
+
+			if (!strcmp(name, "output")) {
+				char text[512];
+				sscanf(value, "%511s", text);
+				output = text;
+				continue;
+			}
+			if (!strcmp(name, "shards")) {
+				shards = b2Max(1, atoi(value));
+				continue;
+			}
+			if (!strcmp(name, "rays")) {
+				rays = b2Max(1, atoi(value));
+				continue;
+			}
+			if (!strcmp(name, "maximumReflections")) {
+				maximumReflections = atoi(value);
+				continue;
+			}
+			if (!strcmp(name, "validate")) {
+				validate = atoi(value) != 0;
+				continue;
+			}
+
+			SweepParameter* parameter = find(name);
+			if (!parameter) {
+				fprintf(stderr, "unknown spec parameter %s\n", name);
+				fclose(file);
+				return false;
+			}
+
+			float from, to;
+			int count;
+			int fields = sscanf(value, "%f %f %d", &from, &to, &count);
+			if (fields == 1) {
+				parameter->from = parameter->to = from;
+				parameter->count = 1;
+			}
+			else if (fields == 3 && count > 0) {
+				parameter->from = from;
+				parameter->to = to;
+				parameter->count = count;
+			}
+			else {
+				fprintf(stderr, "%s must be \"value\" or \"from to count\"\n", name);
+				fclose(file);
+				return false;
+			}
+		}
+		fclose(file);
+		return true;
+	}
+
+	SweepParameter* find(const char* name) {
+		for (int i = 0;i < parameters.size();i++) {
+			if (!strcmp(parameters[i].name, name)) {
+				return &parameters[i];
+			}
+		}
+		return nullptr;
+	}
+
+	int64_t points() const {
+		int64_t count = 1;
+		for (int i = 0;i < parameters.size();i++) {
+			count *= parameters[i].count;
+		}
+		return count;
+	}
+
+	// mixed radix decoding of point index, first parameter changes slowest
+	std::vector<float> point(int64_t index) const {
+		std::vector<float> values(parameters.size());
+		for (int i = (int)parameters.size() - 1;i >= 0;i--) {
+			values[i] = parameters[i].value((int)(index % parameters[i].count));
+			index /= parameters[i].count;
+		}
+		return values;
+	}
+
+	std::string shardPath(int shard) const {
+		char suffix[64];
+		snprintf(suffix, sizeof(suffix), ".%d-of-%d.csv", shard, shards);
+		return output + suffix;
+	}
+
+	// directories of output, e.g. results/ of results/example, true when they exist
+	bool createOutputDirectory() const {
+		std::filesystem::path directory = std::filesystem::path(output).parent_path();
+		std::error_code error;
+		if (!directory.empty() && !std::filesystem::create_directories(directory, error) && error) {
+			fprintf(stderr, "can not create %s\n", directory.string().c_str());
+			return false;
+		}
+		return true;
+	}
+};
+
+// how rays of one fan ended
+class FanResult {
+public:
+	float absorbed = 0;      // fractions of rays
+	float escaped = 0;
+	float trapped = 0;       // still reflecting after maximumReflections
+	float reflections = 0;   // mean
+	float distance = 0;      // mean
+};
+
+inline FanResult traceFan(const Scene* scene, RayFan fan, int rays, int maximumReflections) {
+	FanResult result;
+	for (int i = 0;i < rays;i++) {
+		b2Vec2 point = fan.start + ((i + 0.5f) / rays) * (fan.end - fan.start);
+		int hits = 0;
+		bool absorbed = false;
+
+		result.distance += traceRay(scene, Ray(point, 100, fan.angle, maximumReflections), [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			hits++;
+			absorbed = materials[callback.m_material].absorb;
+		});
+
+		if (absorbed) {
+			result.absorbed++;
+		}
+		else if (hits > maximumReflections) {
+			result.trapped++;
+		}
+		else {
+			result.escaped++;
+		}
+		result.reflections += b2Max(0, hits - 1);
+	}
+
+	result.absorbed /= rays;
+	result.escaped /= rays;
+	result.trapped /= rays;
+	result.reflections /= rays;
+	result.distance /= rays;
+	return result;
+}
+
+const char* fanNames[] = { "input", "queen" };
+
+inline std::string header(const SweepSpec& spec) {
+	std::string text = "index";
+	for (int i = 0;i < spec.parameters.size();i++) {
+		text += std::string(",") + spec.parameters[i].name;
+	}
+	text += ",valid";
+	for (int i = 0;i < 2;i++) {
+		std::string fan = fanNames[i];
+		text += "," + fan + "Absorbed," + fan + "Escaped," + fan + "Trapped," + fan + "Reflections," + fan + "Distance";
+	}
+	return text + "\n";
+}
+
+// model of one parameter point, values in order of SweepSpec::parameters
+inline void configure(PyramidModel* model, float* queenAngle, const std::vector<float>& values) {
+	model->ascendingAngle = values[0];
+	model->descendingAngle = values[1];
+	model->galleryCeilingOffset = values[2];
+	model->ceilingParallelToFloor = values[3] != 0;
+	model->leftGalleryWallMode = (int)values[4];
+	model->rightGalleryWallMode = (int)values[5];
+	model->galleryBeamsMode = (int)values[6];
+	*queenAngle = values[7];
+}
+
+inline std::string evaluate(const SweepSpec& spec, int64_t index) {
+	std::vector<float> values = spec.point(index);
+
+	PyramidModel model;
+	float queenAngle;
+	configure(&model, &queenAngle, values);
+
+	b2World world(b2Vec2(0, 0));
+	b2BodyDef bd;
+	b2Body* body = world.CreateBody(&bd);
+	model.build(body);
+
+	Scene scene;
+	scene.update(&world, body);
+
+	char text[128];
+	snprintf(text, sizeof(text), "%lld", (long long)index);
+	std::string row = text;
+	for (int i = 0;i < values.size();i++) {
+		snprintf(text, sizeof(text), ",%.9g", values[i]);
+		row += text;
+	}
+
+	GeometryValidator validator;
+	if (spec.validate && !validator.validate(&scene.segments)) {
+		return row + ",0,,,,,,,,,,\n";
+	}
+	row += ",1";
+
+	FanResult results[2] = {
+		traceFan(&scene, model.inputFan(), spec.rays, spec.maximumReflections),
+		traceFan(&scene, model.queenFan(queenAngle), spec.rays, spec.maximumReflections)
+	};
+	for (int i = 0;i < 2;i++) {
+		snprintf(text, sizeof(text), ",%.6f,%.6f,%.6f,%.3f,%.3f",
+			results[i].absorbed, results[i].escaped, results[i].trapped, results[i].reflections, results[i].distance);
+		row += text;
+	}
+	return row + "\n";
+}
+
+// complete rows of a shard file by index, a row cut by killed process is dropped
+inline bool readShard(const SweepSpec& spec, int shard, std::map<int64_t, std::string>* rows) {
+	FILE* file = fopen(spec.shardPath(shard).c_str(), "r");
+	if (!file) {
+		return true;
+	}
+
+	int columns = 1 + (int)spec.parameters.size() + 1 + 2 * 5;
+	char line[4096];
+	bool first = true;
+	bool valid = true;
+
+	while (fgets(line, sizeof(line), file)) {
+		if (first) {
+			first = false;
+			unsigned long long hash = 0;
+			if (sscanf(line, "# spec %llx", &hash) != 1 || hash != spec.hash) {
+				fprintf(stderr, "%s was written for another spec\n", spec.shardPath(shard).c_str());
+				valid = false;
+				break;
+			}
+			continue;
+		}
+
+		int length = (int)strlen(line);
+		if (length == 0 || line[length - 1] != '\n' || line[0] == 'i') {
+			continue;
+		}
+
+		int commas = 0;
+		for (int i = 0;i < length;i++) {
+			commas += line[i] == ',';
+		}
+		long long index;
+		if (commas != columns - 1 || sscanf(line, "%lld", &index) != 1 || index % spec.shards != shard) {
+			continue;
+		}
+		(*rows)[index] = line;
+	}
+	fclose(file);
+	return valid;
+}
+
+inline int run(const SweepSpec& spec, int shard) {
+	if (shard < 0 || shard >= spec.shards) {
+		fprintf(stderr, "shard must be in 0..%d\n", spec.shards - 1);
+		return 1;
+	}
+
+	std::map<int64_t, std::string> rows;
+	if (!spec.createOutputDirectory() || !readShard(spec, shard, &rows)) {
+		return 1;
+	}
+
+	// rewrite kept rows so that a partial last line does not stay in the file
+	std::string path = spec.shardPath(shard);
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) {
+		fprintf(stderr, "can not write %s\n", path.c_str());
+		return 1;
+	}
+	fprintf(file, "# spec %llx\n%s", (unsigned long long)spec.hash, header(spec).c_str());
+	for (auto it = rows.begin();it != rows.end();it++) {
+		fputs(it->second.c_str(), file);
+	}
+	fflush(file);
+
+	int64_t done = 0;
+	for (int64_t index = shard;index < spec.points();index += spec.shards) {
+		if (rows.count(index)) {
+			continue;
+		}
+		fputs(evaluate(spec, index).c_str(), file);
+		fflush(file);
+		done++;
+	}
+	fclose(file);
+
+	printf("shard %d: %lld points traced, %lld resumed\n", shard, (long long)done, (long long)rows.size());
+	return 0;
+}
+
+inline int merge(const SweepSpec& spec) {
+	std::map<int64_t, std::string> rows;
+	std::vector<int> incomplete;
+
+	for (int shard = 0;shard < spec.shards;shard++) {
+		std::map<int64_t, std::string> shardRows;
+		if (!readShard(spec, shard, &shardRows)) {
+			return 1;
+		}
+		int64_t expected = (spec.points() - shard + spec.shards - 1) / spec.shards;
+		if (shardRows.size() < expected) {
+			incomplete.push_back(shard);
+		}
+		rows.insert(shardRows.begin(), shardRows.end());
+	}
+
+	std::string path = spec.output + ".csv";
+	if (!spec.createOutputDirectory()) {
+		return 1;
+	}
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) {
+		fprintf(stderr, "can not write %s\n", path.c_str());
+		return 1;
+	}
+	fputs(header(spec).c_str(), file);
+	for (auto it = rows.begin();it != rows.end();it++) {
+		fputs(it->second.c_str(), file);
+	}
+	fclose(file);
+
+	printf("%s: %lld of %lld points\n", path.c_str(), (long long)rows.size(), (long long)spec.points());
+	for (int i = 0;i < incomplete.size();i++) {
+		printf("incomplete shard %d, resume with: sweep run <spec> %d\n", incomplete[i], incomplete[i]);
+	}
+	return incomplete.empty() ? 0 : 2;
+}
+
+// every shard is own process, so a crash loses at most one row
+inline int local(const char* program, const char* specPath, const SweepSpec& spec, int processes) {
+	std::mutex mutex;
+	int next = 0;
+	int failed = 0;
+	std::vector<std::thread> workers;
+
+	for (int k = 0;k < processes;k++) {
+		workers.push_back(std::thread([&]() {
+			while (true) {
+				int shard;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (next >= spec.shards) {
+						return;
+					}
+					shard = next++;
+				}
+				std::string command = std::string("\"") + program + "\" run \"" + specPath + "\" " + std::to_string(shard);
+				if (std::system(command.c_str()) != 0) {
+					std::lock_guard<std::mutex> lock(mutex);
+					failed++;
+				}
+			}
+		}));
+	}
+	for (int k = 0;k < processes;k++) {
+		workers[k].join();
+	}
+
+	if (failed) {
+		fprintf(stderr, "%d shards failed\n", failed);
+	}
+	return merge(spec);
+}
+
+// one line per family of both fans, largest first: fan, rays, fraction, fan range, outcome, walls
+inline int families(const SweepSpec& spec, int64_t index) {
+	if (index < 0 || index >= spec.points()) {
+		fprintf(stderr, "point must be in 0..%lld\n", (long long)spec.points() - 1);
+		return 1;
+	}
+
+	PyramidModel model;
+	float queenAngle;
+	configure(&model, &queenAngle, spec.point(index));
+
+	b2World world(b2Vec2(0, 0));
+	b2BodyDef bd;
+	b2Body* body = world.CreateBody(&bd);
+	model.build(body);
+	SceneSnapshot snapshot(body, 1);
+
+	RayFan fans[2] = { model.inputFan(), model.queenFan(queenAngle) };
+	printf("fan,rays,fraction,first,last,outcome,walls\n");
+	for (int i = 0;i < 2;i++) {
+		PathFamilies pathFamilies;
+		pathFamilies.maximumReflections = spec.maximumReflections;
+		pathFamilies.traceFan(&snapshot, fans[i], spec.rays);
+		std::vector<const PathFamily*> list = pathFamilies.sorted();
+		for (int k = 0;k < list.size();k++) {
+			const PathFamily* family = list[k];
+			printf("%s,%lld,%.6f,%.6f,%.6f,%s,", fanNames[i], (long long)family->count, (double)family->count / spec.rays,
+				family->firstT, family->lastT, pathFamilies.outcome(family));
+			for (int j = 0;j < family->walls.size();j++) {
+				printf(j > 0 ? " %d" : "%d", family->walls[j]);
+			}
+			printf("\n");
+		}
+	}
+	return 0;
+}
+
+// fans are traced once into HitIndex, then every wall is answered from its own records:
+// wall, fan, ray, position along fan, bounce, path length
+inline int hits(const SweepSpec& spec, int64_t index, const std::vector<int>& walls) {
+	if (index < 0 || index >= spec.points()) {
+		fprintf(stderr, "point must be in 0..%lld\n", (long long)spec.points() - 1);
+		return 1;
+	}
+
+	PyramidModel model;
+	float queenAngle;
+	configure(&model, &queenAngle, spec.point(index));
+
+	b2World world(b2Vec2(0, 0));
+	b2BodyDef bd;
+	b2Body* body = world.CreateBody(&bd);
+	model.build(body);
+	SceneSnapshot snapshot(body, 1);
+
+	RayFan fans[2] = { model.inputFan(), model.queenFan(queenAngle) };
+	HitIndex hitIndex;
+	for (int i = 0;i < 2;i++) {
+		for (int k = 0;k < spec.rays;k++) {
+			b2Vec2 point = fans[i].start + ((k + 0.5f) / spec.rays) * (fans[i].end - fans[i].start);
+			hitIndex.trace(&snapshot, Ray(point, 100, fans[i].angle, spec.maximumReflections), [](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			});
+		}
+	}
+
+	printf("wall,fan,ray,t,bounce,path\n");
+	for (int w = 0;w < walls.size();w++) {
+		if (walls[w] < 0 || walls[w] >= snapshot.segments.count) {
+			fprintf(stderr, "wall must be in 0..%d\n", snapshot.segments.count - 1);
+			return 1;
+		}
+		// snapshot hits have null fixture and segment index as child
+		const std::vector<HitRecord>& records = hitIndex.hitsOf(nullptr, walls[w]);
+		for (int i = 0;i < records.size();i++) {
+			int fan = records[i].ray / spec.rays;
+			int ray = records[i].ray % spec.rays;
+			printf("%d,%s,%d,%.6f,%d,%.3f\n", walls[w], fanNames[fan], ray, (ray + 0.5) / spec.rays, records[i].bounce, records[i].pathLength);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: sweep run <spec> <shard> | sweep local <spec> [processes] | sweep merge <spec> | sweep families <spec> <index> | sweep hits <spec> <index> <wall>...\n");
+		return 1;
+	}
+
+	SweepSpec spec;
+	if (!spec.load(argv[2])) {
+		return 1;
+	}
+
+	if (!strcmp(argv[1], "run") && argc > 3) {
+		return run(spec, atoi(argv[3]));
+	}
+	if (!strcmp(argv[1], "local")) {
+		int processes = argc > 3 ? atoi(argv[3]) : (int)std::thread::hardware_concurrency();
+		return local(argv[0], argv[2], spec, b2Max(1, processes));
+	}
+	if (!strcmp(argv[1], "merge")) {
+		return merge(spec);
+	}
+	if (!strcmp(argv[1], "families") && argc > 3) {
+		return families(spec, atoll(argv[3]));
+	}
+	if (!strcmp(argv[1], "hits") && argc > 4) {
+		std::vector<int> walls;
+		for (int i = 4;i < argc;i++) {
+			walls.push_back(atoi(argv[i]));
+		}
+		return hits(spec, atoll(argv[3]), walls);
+	}
+
+	fprintf(stderr, "unknown command %s\n", argv[1]);
+	return 1;
+}
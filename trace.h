@@ -0,0 +1,554 @@
+#pragma once
+
+// Headless part of the tools: materials, ray casting, tracing and wall construction.
+// Depends on Box2D only, so it can be used outside of the testbed.
+#include "box2d/box2d.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+
+#define PI 3.14159265f
+#define c 299792458                                                          // Speed of light in vacuum
+constexpr auto cubit = PI / 6;
+
+// Wall material is stored as id in fixture userData, nullptr userData is ReflectWall
+enum WallMaterial
+{
+	ReflectWall,
+	AbsorbWall,
+	GraniteWall,
+	GlassWall,
+	DiffuseWall,
+	WallMaterialsCount
+};
+
+// Spectral properties are used by SpectralTracer only and diffuse part by ContainerEstimator and
+// RadiositySolver only, other tracers see every non absorbing material as a perfect mirror
+class Material {
+public:
+	const char* name;
+	bool absorb;
+	float reflectanceBlue;      // reflected part of energy at 0.4 um
+	float reflectanceRed;       // at 0.7 um, linear in between
+	float cauchyA;              // refractive index A + B / wavelength^2 (wavelength in um), 0 for opaque walls
+	float cauchyB;
+	float diffuse;              // part of reflection scattered by Lambert's cosine law, the rest is mirrored
+
+	float reflectance() const {
+		return 0.5f * (reflectanceBlue + reflectanceRed);
+	}
+};
+
+const Material materials[WallMaterialsCount] = {
+	{ "reflect", false, 1, 1, 0, 0, 0 },
+	{ "absorb", true, 0, 0, 0, 0, 0 },
+	{ "granite", false, 0.25f, 0.4f, 0, 0, 0 },        // red Aswan granite
+	{ "glass", false, 1, 1, 1.5046f, 0.0042f, 0 },     // BK7 crown glass
+	{ "limestone", false, 0.55f, 0.7f, 0, 0, 1 }       // rough Tura limestone
+};
+
+inline void* materialUserData(int material) {
+	return (void*)(intptr_t)material;
+}
+
+inline int materialOf(const b2Fixture* fixture) {
+	return (int)(intptr_t)fixture->GetUserData();
+}
+
+class RayCastClosestCallback : public b2RayCastCallback
+{
+public:
+	RayCastClosestCallback()
+	{
+		m_hit = false;
+		m_childIndex = 0;
+		m_material = ReflectWall;
+	}
+
+	float ReportFixture(b2Fixture* fixture, const b2Vec2& point, const b2Vec2& normal, float fraction) override
+	{
+		m_fixture = fixture;
+		b2Body* body = fixture->GetBody();
+		void* userData = body->GetUserData();
+		if (userData)
+		{
+			int32 index = *(int32*)userData;
+			if (index == 0)
+			{
+				// By returning -1, we instruct the calling code to ignore this fixture and
+				// continue the ray-cast to the next fixture.
+				return -1.0f;
+			}
+		}
+
+		m_hit = true;
+		m_point = point;
+		m_normal = normal;
+		m_material = materialOf(fixture);
+
+		// By returning the current fraction, we instruct the calling code to clip the ray and
+		// continue the ray-cast to the next fixture. WARNING: do not assume that fixtures
+		// are reported in order. However, by clipping, we can always get the closest fixture.
+		return fraction;
+	}
+
+	// same as ReportFixture but also remembers which edge of a chain was hit
+	float ReportChild(b2Fixture* fixture, int32 childIndex, const b2Vec2& point, const b2Vec2& normal, float fraction)
+	{
+		float value = ReportFixture(fixture, point, normal, fraction);
+		if (value == fraction) {
+			m_childIndex = childIndex;
+		}
+		return value;
+	}
+
+	bool m_hit;
+	b2Vec2 m_point;
+	b2Vec2 m_normal;
+	b2Fixture* m_fixture;
+	int32 m_childIndex;
+	int m_material;
+};
+
+// b2World::RayCast does not pass chain child index to the callback,
+// so broad-phase is queried directly the same way b2World does it
+class ChildRayCastWrapper {
+public:
+	float RayCastCallback(const b2RayCastInput& input, int32 proxyId) {
+		b2FixtureProxy* proxy = (b2FixtureProxy*)broadPhase->GetUserData(proxyId);
+		b2Fixture* fixture = proxy->fixture;
+		b2RayCastOutput output;
+		if (fixture->RayCast(&output, input, proxy->childIndex)) {
+			float fraction = output.fraction;
+			b2Vec2 point = (1.0f - fraction) * input.p1 + fraction * input.p2;
+			return callback->ReportChild(fixture, proxy->childIndex, point, output.normal, fraction);
+		}
+		return input.maxFraction;
+	}
+
+	const b2BroadPhase* broadPhase;
+	RayCastClosestCallback* callback;
+};
+
+inline void rayCastClosest(b2World* m_world, RayCastClosestCallback* callback, b2Vec2 point1, b2Vec2 point2) {
+	ChildRayCastWrapper wrapper;
+	wrapper.broadPhase = &m_world->GetContactManager().m_broadPhase;
+	wrapper.callback = callback;
+
+	b2RayCastInput input;
+	input.maxFraction = 1.0f;
+	input.p1 = point1;
+	input.p2 = point2;
+	wrapper.broadPhase->RayCast(&wrapper, input);
+}
+
+class NextTo {
+public:
+	b2Vec2 v;
+	NextTo(b2Vec2 _v) {
+		v = b2Vec2(_v.x, _v.y);
+	}
+};
+
+class Ray {
+public:
+	b2Vec2 from;
+	float length;
+	float angle;
+	int maximumReflections = 300;
+
+	Ray(b2Vec2 _from, float _length, float _angle) {
+		from = b2Vec2(_from.x, _from.y);
+		length = _length;
+		angle = _angle;
+	}
+
+	Ray(b2Vec2 _from, float _length, float _angle, int _maxReflections) {
+		from = b2Vec2(_from.x, _from.y);
+		length = _length;
+		angle = _angle;
+		maximumReflections = _maxReflections;
+	}
+};
+
+// parallel rays starting between start and end
+class RayFan {
+public:
+	b2Vec2 start;
+	b2Vec2 end;
+	float angle;
+};
+
+inline void angle2minutesAndSeconds(char *buffer,int size, char *prefix,float angle) {
+	float a = 180 * angle / PI;
+	
+	int degrees = floor(a);
+	int minutes = 60.f * (a - floor(a));
+	int seconds = floor((a-floor(a) - (float)minutes/60.f)*3600.f);
+
+	snprintf(buffer, size, "%s %d.%d'%d\"", prefix,degrees,minutes,seconds);
+}
+
+inline b2Vec2 reflect(b2Vec2 vector, b2Vec2 normal) {
+	float num2 = vector.x * normal.x + vector.y * normal.y;
+	return b2Vec2(vector.x - 2.0f * num2 * normal.x, vector.y - 2.0f * num2 * normal.y);
+}
+// traces the ray without drawing it, visit(source, callback, reflection) is called for every traced segment.
+// m_world is b2World* or any scene with rayCastClosest() overload
+template <typename World, typename Visitor>
+inline float traceRay(World m_world, Ray ray, Visitor visit) {
+	float distance = 0;
+	// initial source is little bit different to start raycasting from corner
+
+	b2Vec2 source = b2Vec2(ray.from.x + 0.01f * cos(ray.angle), ray.from.y + 0.01f * sin(ray.angle));
+
+
+	b2Vec2 destination = b2Vec2(ray.from.x + ray.length * cos(ray.angle), ray.from.y + ray.length * sin(ray.angle));
+
+	for (int i = 0;i < ray.maximumReflections + 1;i++) {
+		RayCastClosestCallback callback = RayCastClosestCallback();
+
+		if ((destination - source).Length() > 0) {
+
+			rayCastClosest(m_world, &callback, source, destination);
+
+			if (!callback.m_hit) {
+				break;
+			}
+			else {
+				visit(source, callback, i);
+				distance += sqrt((callback.m_point - source).LengthSquared());
+
+				destination = callback.m_point + ray.length * reflect(callback.m_point - source, callback.m_normal);
+
+				b2Vec2 direction = destination - callback.m_point;
+				source = callback.m_point + 0.0001f * b2Vec2(direction.x / direction.Length(), direction.y / direction.Length());
+
+				if (materials[callback.m_material].absorb) {
+					break;
+				}
+
+			}
+		}
+		else {
+			break;
+		}
+	}
+	return distance;
+}
+
+// traceRay() step with bounce limit known at compile time, the chain of casts is unrolled by the
+// compiler and the last one skips reflection. Same hits and distances as traceRay().
+template <int Bounces>
+class BounceKernel {
+public:
+	template <typename World, typename Visitor>
+	static float trace(World m_world, b2Vec2 source, b2Vec2 destination, float length, int reflection, Visitor& visit) {
+		RayCastClosestCallback callback = RayCastClosestCallback();
+		rayCastClosest(m_world, &callback, source, destination);
+		if (!callback.m_hit) {
+			return 0;
+		}
+		visit(source, callback, reflection);
+		float distance = (callback.m_point - source).Length();
+
+		if (Bounces == 0 || materials[callback.m_material].absorb) {
+			return distance;
+		}
+
+		b2Vec2 next = callback.m_point + length * reflect(callback.m_point - source, callback.m_normal);
+		b2Vec2 direction = next - callback.m_point;
+		if (direction.Length() == 0) {
+			return distance;
+		}
+		b2Vec2 nextSource = callback.m_point + 0.0001f * b2Vec2(direction.x / direction.Length(), direction.y / direction.Length());
+		return distance + BounceKernel<(Bounces > 0 ? Bounces - 1 : 0)>::trace(m_world, nextSource, next, length, reflection + 1, visit);
+	}
+};
+
+// traceRay() for short rays, Bounces replaces ray.maximumReflections
+template <int Bounces, typename World, typename Visitor>
+inline float traceBounces(World m_world, Ray ray, Visitor visit) {
+	b2Vec2 source = b2Vec2(ray.from.x + 0.01f * cos(ray.angle), ray.from.y + 0.01f * sin(ray.angle));
+	b2Vec2 destination = b2Vec2(ray.from.x + ray.length * cos(ray.angle), ray.from.y + ray.length * sin(ray.angle));
+	return BounceKernel<Bounces>::trace(m_world, source, destination, ray.length, 0, visit);
+}
+
+// batch of short rays, visit(ray, source, callback, reflection) and distances[ray] when distances is not null
+template <int Bounces, typename World, typename Visitor>
+inline void traceBounces(World m_world, const Ray* rays, int count, float* distances, Visitor visit) {
+	for (int i = 0;i < count;i++) {
+		float distance = traceBounces<Bounces>(m_world, rays[i], [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+			visit(i, source, callback, reflection);
+		});
+		if (distances) {
+			distances[i] = distance;
+		}
+	}
+}
+
+inline b2Vec2 drawLine(b2Body* body, b2Vec2 startPoint, b2Vec2 endPoint) {
+	b2EdgeShape shape;
+	b2FixtureDef fd;
+	fd.shape = &shape;
+	fd.density = 0.0f;
+	fd.friction = 0.6f;
+	shape.SetTwoSided(startPoint, endPoint);
+	body->CreateFixture(&fd);
+	return endPoint;
+};
+inline b2Vec2 drawAbsorbLine(b2Body* body, b2Vec2 startPoint, b2Vec2 endPoint) {
+	b2EdgeShape shape;
+	b2FixtureDef fd;
+	fd.shape = &shape;
+	fd.density = 0.0f;
+	fd.friction = 0.6f;
+	fd.userData = materialUserData(AbsorbWall);
+	shape.SetTwoSided(startPoint, endPoint);
+	body->CreateFixture(&fd);
+	return endPoint;
+};
+// two sided edges between vertices, for closed solids which rays enter and leave
+inline int drawEdges(b2Body* body, const b2Vec2* vertices, int count, int material) {
+	for (int i = 0;i + 1 < count;i++) {
+		b2EdgeShape shape;
+		b2FixtureDef fd;
+		fd.shape = &shape;
+		fd.density = 0.0f;
+		fd.friction = 0.6f;
+		fd.userData = materialUserData(material);
+		shape.SetTwoSided(vertices[i], vertices[i + 1]);
+		body->CreateFixture(&fd);
+	}
+	return count - 1;
+}
+constexpr auto absorbContainerDepth = 0.4f;
+
+// opening of absorb container, pocket lies on the right side of start -> end
+class AbsorbContainer {
+public:
+	b2Vec2 start;
+	b2Vec2 end;
+
+	// unit normal of the opening pointing out of the pocket
+	b2Vec2 normal() const {
+		b2Vec2 e = end - start;
+		return (1.0f / e.Length()) * b2Vec2(-e.y, e.x);
+	}
+
+	// point lies inside the pocket (or on its walls)
+	bool contains(b2Vec2 point) const {
+		b2Vec2 e = end - start;
+		float u = b2Dot(point - start, e) / b2Dot(e, e);
+		float depth = -b2Dot(point - start, normal());
+		return u > -0.001f && u < 1.001f && depth > -0.001f && depth < absorbContainerDepth + 0.001f;
+	}
+};
+
+inline void absorbContainerPoints(b2Vec2 startPoint, b2Vec2 endPoint, b2Vec2* p1, b2Vec2* p2) {
+
+	float angle = atan2(endPoint.y - startPoint.y, endPoint.x - startPoint.x) - PI / 2;
+
+	*p1 = startPoint + absorbContainerDepth * b2Vec2(cos(angle), sin(angle));
+	*p2 = endPoint + absorbContainerDepth * b2Vec2(cos(angle), sin(angle));
+}
+
+// creates one chain fixture, vertices closer than b2_linearSlop are merged and closed paths become loops.
+// Returns number of created edges, 0 when everything merged into one point.
+inline int drawChain(b2Body* body, const b2Vec2* vertices, int count, int material) {
+	std::vector<b2Vec2> v;
+	v.reserve(count);
+	for (int i = 0;i < count;i++) {
+		if (v.empty() || b2DistanceSquared(v.back(), vertices[i]) > b2_linearSlop * b2_linearSlop) {
+			v.push_back(vertices[i]);
+		}
+	}
+
+	if (v.size() < 2) {
+		return 0;
+	}
+
+	b2ChainShape shape;
+	int edges = (int)v.size() - 1;
+	if (v.size() > 3 && b2DistanceSquared(v.front(), v.back()) <= b2_linearSlop * b2_linearSlop) {
+		v.pop_back();
+		shape.CreateLoop(v.data(), (int32)v.size());
+	}
+	else {
+		b2Vec2 first = v[0];
+		b2Vec2 last = v[v.size() - 1];
+		shape.CreateChain(v.data(), (int32)v.size(), first + (first - v[1]), last + (last - v[v.size() - 2]));
+	}
+
+	b2FixtureDef fd;
+	fd.shape = &shape;
+	fd.density = 0.0f;
+	fd.friction = 0.6f;
+	fd.userData = materialUserData(material);
+	body->CreateFixture(&fd);
+	return edges;
+}
+
+// Collects vertices of one connected wall and creates them as a single chain.
+// Box2D keeps one userData per fixture, so a new chain starts only where edge material changes.
+class ChainPath {
+public:
+	// edges [firstEdge, firstEdge + local.size() * times) are copies of one shape, copy k starts at
+	// vertices[firstEdge] + k * period and its vertices are local[] relative to that start
+	class Repeat {
+	public:
+		int firstEdge;
+		int times;
+		b2Vec2 period;
+		std::vector<b2Vec2> local;       // local[j] is end of edge j of a copy
+		std::vector<int> edgeMaterials;
+	};
+
+	std::vector<b2Vec2> vertices;
+	std::vector<int> edgeMaterials;        // edgeMaterials[i] is material of edge vertices[i] -> vertices[i + 1]
+	std::vector<AbsorbContainer> containers;
+	std::vector<Repeat> repeats;
+
+	ChainPath(b2Vec2 start) {
+		vertices.push_back(start);
+	}
+
+	b2Vec2 current() const {
+		return vertices.back();
+	}
+
+	b2Vec2 lineTo(b2Vec2 point, int material = ReflectWall) {
+		vertices.push_back(point);
+		edgeMaterials.push_back(material);
+		return point;
+	}
+
+	b2Vec2 absorbLineTo(b2Vec2 point) {
+		return lineTo(point, AbsorbWall);
+	}
+
+	// every edge of material from gets material to, including repeated copies
+	void replaceMaterial(int from, int to) {
+		for (int i = 0;i < edgeMaterials.size();i++) {
+			if (edgeMaterials[i] == from) {
+				edgeMaterials[i] = to;
+			}
+		}
+		for (int k = 0;k < repeats.size();k++) {
+			for (int j = 0;j < repeats[k].edgeMaterials.size();j++) {
+				if (repeats[k].edgeMaterials[j] == from) {
+					repeats[k].edgeMaterials[j] = to;
+				}
+			}
+		}
+	}
+
+	// follows NextTo offsets until zero terminator
+	b2Vec2 pathTo(NextTo* path, int material = ReflectWall) {
+		int i = 0;
+		do {
+			lineTo(current() + path[i].v, material);
+			i++;
+		} while (!((path[i].v.x == 0) && (path[i].v.y == 0)));
+		return current();
+	}
+
+	// walks NextTo offsets backwards, starting from the path end point
+	b2Vec2 pathBack(NextTo* path) {
+		int count = 1;
+		while (!((path[count].v.x == 0) && (path[count].v.y == 0))) {
+			count++;
+		}
+		for (int i = count - 1;i >= 0;i--) {
+			lineTo(current() - path[i].v);
+		}
+		return current();
+	}
+
+	// appends times copies of count edges given by offsets (and runMaterials, ReflectWall when null),
+	// targets with instancing store the shape once
+	b2Vec2 repeat(const b2Vec2* offsets, const int* runMaterials, int count, int times) {
+		Repeat run;
+		run.firstEdge = (int)edgeMaterials.size();
+		run.times = times;
+		run.period = b2Vec2(0, 0);
+		for (int j = 0;j < count;j++) {
+			run.period += offsets[j];
+			run.local.push_back(run.period);
+			run.edgeMaterials.push_back(runMaterials ? runMaterials[j] : ReflectWall);
+		}
+
+		b2Vec2 start = current();
+		for (int k = 0;k < times;k++) {
+			b2Vec2 copy = start + (float)k * run.period;
+			for (int j = 0;j < count;j++) {
+				lineTo(copy + run.local[j], run.edgeMaterials[j]);
+			}
+		}
+		if (times > 0) {
+			repeats.push_back(run);
+		}
+		return current();
+	}
+
+	// same walls as drawAbsorbContainer(body, current(), endPoint)
+	b2Vec2 absorbContainerTo(b2Vec2 endPoint) {
+		AbsorbContainer container;
+		container.start = current();
+		container.end = endPoint;
+		containers.push_back(container);
+
+		b2Vec2 p1, p2;
+		absorbContainerPoints(current(), endPoint, &p1, &p2);
+		absorbLineTo(p1);
+		absorbLineTo(p2);
+		return absorbLineTo(endPoint);
+	}
+
+	// creates chains on body (b2Body* or any target with drawChain() overload), returns number of created
+	// edges, less than edges of the path when some were shorter than b2_linearSlop
+	template <typename Body>
+	int draw(Body* body) const {
+		int edges = 0;
+		int start = 0;
+		for (int i = 1;i <= edgeMaterials.size();i++) {
+			if (i == edgeMaterials.size() || edgeMaterials[i] != edgeMaterials[start]) {
+				edges += drawChain(body, &vertices[start], i - start + 1, edgeMaterials[start]);
+				start = i;
+			}
+		}
+		return edges;
+	}
+};
+
+template <typename Body>
+inline b2Vec2 drawPath(Body* body, b2Vec2 startPoint, NextTo* path) {
+	ChainPath chain = ChainPath(startPoint);
+	chain.pathTo(path);
+	chain.draw(body);
+	return chain.current();
+};
+// chain of local vertices moved by xf, targets with instancing store the shape once.
+// Longer shapes are split into pieces of INSTANCE_MAX_VERTICES sharing their end vertices.
+#define INSTANCE_MAX_VERTICES 16
+template <typename Body>
+inline int drawInstance(Body* body, const b2Vec2* vertices, int count, int material, const b2Transform& xf) {
+	int edges = 0;
+	for (int first = 0;first + 1 < count;first += INSTANCE_MAX_VERTICES - 1) {
+		int pieceCount = b2Min(count - first, INSTANCE_MAX_VERTICES);
+		b2Vec2 moved[INSTANCE_MAX_VERTICES];
+		for (int i = 0;i < pieceCount;i++) {
+			moved[i] = b2Mul(xf, vertices[first + i]);
+		}
+		edges += drawChain(body, moved, pieceCount, material);
+	}
+	return edges;
+}
+inline AbsorbContainer drawAbsorbContainer(b2Body* body, b2Vec2 startPoint, b2Vec2 endPoint) {
+	ChainPath chain = ChainPath(startPoint);
+	chain.absorbContainerTo(endPoint);
+	chain.draw(body);
+	return chain.containers[0];
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+
+#include "model.h"
+#include "segments.h"
+#include "validation.h"
+
+enum UncertaintyOutcome
+{
+	InputContained,      // part of input fan ending in an absorb container
+	InputEscaped,        // part of input fan leaving the pyramid
+	QueenContained,
+	QueenEscaped,
+	UncertaintyOutcomeCount
+};
+
+inline const char* uncertaintyOutcomeName(int outcome) {
+	static const char* names[UncertaintyOutcomeCount] = { "input contained", "input escaped", "Queen contained", "Queen escaped" };
+	return names[outcome];
+}
+
+// distribution of one outcome over all variants
+class OutcomeStatistics {
+public:
+	double mean = 0;
+	double deviation = 0;
+	float minimum = 0;
+	float percentile5 = 0;
+	float median = 0;
+	float percentile95 = 0;
+	float maximum = 0;
+	std::vector<float> histogram;
+
+	void compute(std::vector<float> values, int bins) {
+		histogram.assign(bins, 0.0f);
+		if (values.empty()) {
+			return;
+		}
+
+		double sum = 0;
+		double sumSquares = 0;
+		for (int i = 0;i < values.size();i++) {
+			sum += values[i];
+			sumSquares += (double)values[i] * values[i];
+		}
+		mean = sum / values.size();
+		deviation = sqrt(b2Max(0.0, sumSquares / values.size() - mean * mean));
+
+		std::sort(values.begin(), values.end());
+		minimum = values.front();
+		maximum = values.back();
+		percentile5 = values[(values.size() - 1) * 5 / 100];
+		median = values[(values.size() - 1) / 2];
+		percentile95 = values[(values.size() - 1) * 95 / 100];
+
+		float range = maximum - minimum;
+		for (int i = 0;i < values.size();i++) {
+			int bin = range > 0 ? (int)((values[i] - minimum) / range * bins) : 0;
+			histogram[b2Min(bins - 1, bin)] += 1;
+		}
+	}
+};
+
+// Monte Carlo over survey tolerances: every variant perturbs all measured sizes and both corridor
+// angles uniformly within their tolerances, builds the walls straight into a SegmentTable and traces
+// the input and Queen fans. Every thread reuses one model and one table, so after the first variant
+// a build does not allocate per wall. Variant i always gets the same sample whatever the thread count.
+// Variants with leaking or crossing walls are rejected by GeometryValidator before tracing and left
+// out of statistics.
+class UncertaintyStudy {
+public:
+	PyramidModel nominal;                    // control parameters and unperturbed measurements
+	float angleTolerance = 30 * PI / (180 * 3600);
+	float queenAngle = PI / 6;
+
+	int variants = 1000;
+	int rays = 200;
+	int maximumReflections = 100;
+	int bins = 40;
+	int threads = 1;
+	uint32_t seed = 1;
+	bool validate = true;
+
+	std::vector<float> outcomes;             // outcomes[variant * UncertaintyOutcomeCount + outcome]
+	std::vector<uint8> rejected;             // by variant, walls failed validation and were not traced
+	int rejectedCount = 0;
+	OutcomeStatistics statistics[UncertaintyOutcomeCount];
+	double buildMilliseconds = 0;            // summed over threads
+	double traceMilliseconds = 0;
+
+	UncertaintyStudy() {
+		threads = b2Max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	// nominal model perturbed for variant, walls are not built. Assignment keeps model vectors capacity.
+	void sample(int variant, PyramidModel* model) const {
+		std::mt19937 random = std::mt19937(seed * 1000003u + (uint32_t)variant);
+		std::uniform_real_distribution<float> uniform = std::uniform_real_distribution<float>(-1.0f, 1.0f);
+
+		*model = nominal;
+		model->movingParts = false;      // parts go into the same table, at their current place
+		model->measured.visit([&](const char* name, float& value, float tolerance) {
+			value += tolerance * uniform(random);
+		});
+		model->ascendingAngle += angleTolerance * uniform(random);
+		model->descendingAngle += angleTolerance * uniform(random);
+	}
+
+	void run() {
+		outcomes.assign((size_t)variants * UncertaintyOutcomeCount, 0.0f);
+		rejected.assign(variants, 0);
+		std::vector<double> build(threads, 0.0);
+		std::vector<double> trace(threads, 0.0);
+		std::vector<std::thread> workers;
+
+		for (int k = 0;k < threads;k++) {
+			workers.push_back(std::thread([&, k]() {
+				PyramidModel model;
+				SegmentTable segments;
+				GeometryValidator validator;
+
+				for (int i = k;i < variants;i += threads) {
+					b2Timer timer;
+					sample(i, &model);
+					segments.clear();
+					model.build(&segments);
+					segments.pad();
+					if (validate && !validator.validate(&segments)) {
+						rejected[i] = 1;
+					}
+					build[k] += timer.GetMilliseconds();
+					if (rejected[i]) {
+						continue;
+					}
+
+					timer.Reset();
+					float* outcome = &outcomes[(size_t)i * UncertaintyOutcomeCount];
+					traceFan(&segments, model, model.inputFan(), &outcome[InputContained], &outcome[InputEscaped]);
+					traceFan(&segments, model, model.queenFan(queenAngle), &outcome[QueenContained], &outcome[QueenEscaped]);
+					trace[k] += timer.GetMilliseconds();
+				}
+			}));
+		}
+		for (int k = 0;k < threads;k++) {
+			workers[k].join();
+		}
+
+		buildMilliseconds = 0;
+		traceMilliseconds = 0;
+		for (int k = 0;k < threads;k++) {
+			buildMilliseconds += build[k];
+			traceMilliseconds += trace[k];
+		}
+
+		rejectedCount = 0;
+		for (int i = 0;i < variants;i++) {
+			rejectedCount += rejected[i];
+		}
+
+		std::vector<float> values;
+		for (int j = 0;j < UncertaintyOutcomeCount;j++) {
+			values.clear();
+			for (int i = 0;i < variants;i++) {
+				if (!rejected[i]) {
+					values.push_back(outcomes[(size_t)i * UncertaintyOutcomeCount + j]);
+				}
+			}
+			statistics[j].compute(values, bins);
+		}
+	}
+
+private:
+	// parts of fan rays ending in one of model containers and leaving without hitting any wall
+	void traceFan(const SegmentTable* segments, const PyramidModel& model, RayFan fan, float* contained, float* escaped) const {
+		int containedRays = 0;
+		int escapedRays = 0;
+
+		for (int i = 0;i < rays;i++) {
+			b2Vec2 point = fan.start + ((i + 0.5f) / rays) * (fan.end - fan.start);
+			int hits = 0;
+			bool absorbed = false;
+			b2Vec2 last;
+
+			traceRay(segments, Ray(point, 100, fan.angle, maximumReflections), [&](b2Vec2 source, const RayCastClosestCallback& callback, int reflection) {
+				hits++;
+				absorbed = materials[callback.m_material].absorb;
+				last = callback.m_point;
+			});
+
+			if (absorbed) {
+				for (int j = 0;j < model.containers.size();j++) {
+					if (model.containers[j].contains(last)) {
+						containedRays++;
+						break;
+					}
+				}
+			}
+			else if (hits <= maximumReflections) {
+				escapedRays++;
+			}
+		}
+
+		*contained = (float)containedRays / rays;
+		*escaped = (float)escapedRays / rays;
+	}
+};
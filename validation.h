@@ -0,0 +1,427 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "segments.h"
+
+enum GeometryIssueType
+{
+	GeometryGap,             // wall end falls short of another wall or wall end, rays leak through
+	GeometryTJunction,       // wall end touches interior of another wall instead of its end
+	GeometryDuplicate,       // two walls overlap along a common line
+	GeometryCrossing,        // interiors of two walls cross
+	GeometryIssueTypeCount
+};
+
+inline const char* geometryIssueName(int type) {
+	static const char* names[GeometryIssueTypeCount] = { "gap", "T-junction", "duplicate", "crossing" };
+	return names[type];
+}
+
+class GeometryIssue {
+public:
+	int type;
+	int segment;             // in validated table
+	int other;
+	b2Vec2 point;
+	float distance;          // size of gap, length of overlap
+};
+
+// Checks walls after every rebuild. Endpoints are hashed to a grid of gapDistance cells (sorted by cell
+// with open addressing table of cell starts, no allocation after the first table of the same size):
+// ends closer than weldDistance are joined, free ends closer than gapDistance to another end are gaps.
+// Pairs of walls whose boxes (grown by gapDistance) overlap come from a sweep over x. Active walls are
+// kept in two segment trees over y, one of y extents for walls covering the lower end of the new wall and
+// one of lower ends inside its extent, so every wall costs O(log n) plus O(log n) per reported pair and
+// walls left behind by the sweep are dropped when a query meets them: O((n + pairs) log n) in total,
+// however many walls overlap in x. A free end which misses every other wall is counted in openEnds,
+// not as an issue.
+//   GeometryValidator validator;
+//   if (!validator.validate(&segments)) { reject variant }
+class GeometryValidator {
+public:
+	float weldDistance = 0.001f;
+	float gapDistance = 0.05f;
+	int maximumIssues = 1000;                // counts go on after issues is full
+
+	std::vector<GeometryIssue> issues;
+	int counts[GeometryIssueTypeCount] = {};
+	int openEnds = 0;
+	int64_t pairs = 0;                       // wall pairs tested by sweep
+
+	// true when no gaps and no crossings are found, T-junctions and duplicates do not leak
+	bool validate(const SegmentTable* segments) {
+		table = segments;
+		issues.clear();
+		for (int j = 0;j < GeometryIssueTypeCount;j++) {
+			counts[j] = 0;
+		}
+		openEnds = 0;
+		pairs = 0;
+
+		hashEndpoints();
+		sweep();
+
+		for (int i = 0;i < 2 * table->count;i++) {
+			if (!(state[i] & (Joined | Reported)) && length(i / 2) > weldDistance) {
+				openEnds++;
+			}
+		}
+		return valid();
+	}
+
+	bool valid() const {
+		return counts[GeometryGap] == 0 && counts[GeometryCrossing] == 0;
+	}
+
+	int issueCount() const {
+		int sum = 0;
+		for (int j = 0;j < GeometryIssueTypeCount;j++) {
+			sum += counts[j];
+		}
+		return sum;
+	}
+
+private:
+	enum EndpointState
+	{
+		Joined = 1,              // another wall ends here
+		Reported = 2             // already part of gap or T-junction
+	};
+
+	class Endpoint {
+	public:
+		uint64_t cell;
+		int id;                  // 2 * segment + end
+
+		bool operator<(const Endpoint& other) const {
+			return cell < other.cell || (cell == other.cell && id < other.id);
+		}
+	};
+
+	const SegmentTable* table = nullptr;
+	std::vector<Endpoint> endpoints;
+	std::vector<int> buckets;                // first endpoint of cell, -1 is empty
+	int bucketShift = 0;
+	std::vector<uint8> state;
+	std::vector<int> order;
+	std::vector<float> coords;               // sorted y of grown extents and lower ends of walls
+	int coordLeaves = 1;
+	std::vector<std::vector<int>> covering;  // segment tree over coords, sweep positions of active walls covering whole node
+	std::vector<int> lowOrder;               // sweep positions by lower end of grown extent
+	std::vector<float> lows;
+	std::vector<int> lowPosition;            // in lowOrder by sweep position
+	int lowLeaves = 1;
+	std::vector<int> lowCount;               // segment tree over lowOrder, active walls under node
+	std::vector<int> found;                  // sweep positions of walls overlapping current wall
+
+	b2Vec2 point(int id) const {
+		return id & 1 ? table->end(id / 2) : table->start(id / 2);
+	}
+
+	float length(int i) const {
+		return sqrtf(table->dx[i] * table->dx[i] + table->dy[i] * table->dy[i]);
+	}
+
+	uint64_t cellKey(int64_t x, int64_t y) const {
+		return ((uint64_t)(x + 0x80000000ll) << 32) | (uint64_t)(uint32_t)(y + 0x80000000ll);
+	}
+
+	uint64_t cellOf(b2Vec2 p, int dx = 0, int dy = 0) const {
+		return cellKey((int64_t)floorf(p.x / gapDistance) + dx, (int64_t)floorf(p.y / gapDistance) + dy);
+	}
+
+	int bucket(uint64_t cell) const {
+		return (int)((cell * 0x9E3779B97F4A7C15ull) >> bucketShift);
+	}
+
+	// index of first endpoint in cell, or endpoints.size()
+	int find(uint64_t cell) const {
+		for (int b = bucket(cell);buckets[b] >= 0;b = (b + 1) & (int)(buckets.size() - 1)) {
+			if (endpoints[buckets[b]].cell == cell) {
+				return buckets[b];
+			}
+		}
+		return (int)endpoints.size();
+	}
+
+	void report(int type, int segment, int other, b2Vec2 at, float distance) {
+		counts[type]++;
+		if (issues.size() < maximumIssues) {
+			GeometryIssue issue;
+			issue.type = type;
+			issue.segment = segment;
+			issue.other = other;
+			issue.point = at;
+			issue.distance = distance;
+			issues.push_back(issue);
+		}
+	}
+
+	// joins ends of different walls and reports free ends close to each other
+	void hashEndpoints() {
+		int n = 2 * table->count;
+		endpoints.resize(n);
+		state.assign(n, 0);
+		for (int i = 0;i < n;i++) {
+			endpoints[i].cell = cellOf(point(i));
+			endpoints[i].id = i;
+		}
+		std::sort(endpoints.begin(), endpoints.end());
+
+		int bits = 1;
+		while ((1 << bits) < 2 * n) {
+			bits++;
+		}
+		bucketShift = 64 - bits;
+		buckets.assign((size_t)1 << bits, -1);
+		for (int i = 0;i < n;i++) {
+			if (i == 0 || endpoints[i].cell != endpoints[i - 1].cell) {
+				int b = bucket(endpoints[i].cell);
+				while (buckets[b] >= 0) {
+					b = (b + 1) & (int)(buckets.size() - 1);
+				}
+				buckets[b] = i;
+			}
+		}
+
+		for (int pass = 0;pass < 2;pass++) {
+			for (int i = 0;i < n;i++) {
+				if (length(i / 2) <= weldDistance || (pass == 1 && (state[i] & (Joined | Reported)))) {
+					continue;
+				}
+				b2Vec2 p = point(i);
+				for (int dx = -1;dx <= 1;dx++) {
+					for (int dy = -1;dy <= 1;dy++) {
+						uint64_t cell = cellOf(p, dx, dy);
+						for (int e = find(cell);e < n && endpoints[e].cell == cell;e++) {
+							int j = endpoints[e].id;
+							if (j / 2 == i / 2 || length(j / 2) <= weldDistance) {
+								continue;
+							}
+							float distance = b2Distance(p, point(j));
+							if (pass == 0 && distance <= weldDistance) {
+								state[i] |= Joined;
+							}
+							// second pass sees free ends only, every pair once
+							if (pass == 1 && j > i && !(state[j] & (Joined | Reported)) && distance < gapDistance) {
+								state[i] |= Reported;
+								state[j] |= Reported;
+								report(GeometryGap, i / 2, j / 2, 0.5f * (p + point(j)), distance);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void sweep() {
+		order.clear();
+		coords.clear();
+		for (int i = 0;i < table->count;i++) {
+			if (length(i) > weldDistance) {
+				order.push_back(i);
+				coords.push_back(lowY(i));
+				coords.push_back(highY(i));
+				coords.push_back(minY(i));
+			}
+		}
+		std::sort(order.begin(), order.end(), [&](int a, int b) {
+			return minX(a) < minX(b);
+		});
+		std::sort(coords.begin(), coords.end());
+		coords.erase(std::unique(coords.begin(), coords.end()), coords.end());
+
+		coordLeaves = 1;
+		while (coordLeaves < coords.size()) {
+			coordLeaves *= 2;
+		}
+		covering.resize(2 * coordLeaves);
+		for (int i = 0;i < covering.size();i++) {
+			covering[i].clear();
+		}
+
+		lowOrder.resize(order.size());
+		for (int k = 0;k < order.size();k++) {
+			lowOrder[k] = k;
+		}
+		std::sort(lowOrder.begin(), lowOrder.end(), [&](int a, int b) {
+			return lowY(order[a]) < lowY(order[b]);
+		});
+		lows.resize(lowOrder.size());
+		lowPosition.resize(order.size());
+		for (int k = 0;k < lowOrder.size();k++) {
+			lows[k] = lowY(order[lowOrder[k]]);
+			lowPosition[lowOrder[k]] = k;
+		}
+		lowLeaves = 1;
+		while (lowLeaves < lowOrder.size()) {
+			lowLeaves *= 2;
+		}
+		lowCount.assign(2 * lowLeaves, 0);
+
+		for (int k = 0;k < order.size();k++) {
+			int b = order[k];
+			float from = minX(b) - gapDistance;
+
+			// grown extent contains lower end of b
+			found.clear();
+			for (int node = coordLeaves + coordIndex(minY(b));node >= 1;node /= 2) {
+				std::vector<int>& walls = covering[node];
+				for (int j = 0;j < walls.size();) {
+					if (maxX(order[walls[j]]) < from) {
+						walls[j] = walls.back();
+						walls.pop_back();
+						continue;
+					}
+					found.push_back(walls[j]);
+					j++;
+				}
+			}
+
+			// grown extent starts above lower end of b, within b
+			int first = (int)(std::upper_bound(lows.begin(), lows.end(), minY(b)) - lows.begin());
+			int last = (int)(std::upper_bound(lows.begin(), lows.end(), maxY(b)) - lows.begin());
+			findLows(1, 0, lowLeaves, first, last, from);
+
+			// in sweep order, endpoint states make results depend on it
+			std::sort(found.begin(), found.end());
+			for (int j = 0;j < found.size();j++) {
+				pairs++;
+				test(order[found[j]], b);
+			}
+
+			insertCovering(1, 0, coordLeaves, coordIndex(lowY(b)), coordIndex(highY(b)) + 1, k);
+			for (int node = lowLeaves + lowPosition[k];node >= 1;node /= 2) {
+				lowCount[node]++;
+			}
+		}
+	}
+
+	int coordIndex(float y) const {
+		return (int)(std::lower_bound(coords.begin(), coords.end(), y) - coords.begin());
+	}
+
+	// adds sweep position to nodes exactly covering leaves [first, last)
+	void insertCovering(int node, int nodeFirst, int nodeLast, int first, int last, int wall) {
+		if (last <= nodeFirst || nodeLast <= first) {
+			return;
+		}
+		if (first <= nodeFirst && nodeLast <= last) {
+			covering[node].push_back(wall);
+			return;
+		}
+		int middle = (nodeFirst + nodeLast) / 2;
+		insertCovering(2 * node, nodeFirst, middle, first, last, wall);
+		insertCovering(2 * node + 1, middle, nodeLast, first, last, wall);
+	}
+
+	// finds active walls at lowOrder positions [first, last), drops walls behind the sweep
+	void findLows(int node, int nodeFirst, int nodeLast, int first, int last, float from) {
+		if (lowCount[node] == 0 || last <= nodeFirst || nodeLast <= first) {
+			return;
+		}
+		if (nodeLast - nodeFirst == 1) {
+			if (maxX(order[lowOrder[nodeFirst]]) < from) {
+				for (int k = node;k >= 1;k /= 2) {
+					lowCount[k]--;
+				}
+				return;
+			}
+			found.push_back(lowOrder[nodeFirst]);
+			return;
+		}
+		int middle = (nodeFirst + nodeLast) / 2;
+		findLows(2 * node, nodeFirst, middle, first, last, from);
+		findLows(2 * node + 1, middle, nodeLast, first, last, from);
+	}
+
+	float minX(int i) const {
+		return b2Min(table->x0[i], table->x0[i] + table->dx[i]);
+	}
+
+	float maxX(int i) const {
+		return b2Max(table->x0[i], table->x0[i] + table->dx[i]);
+	}
+
+	float minY(int i) const {
+		return b2Min(table->y0[i], table->y0[i] + table->dy[i]);
+	}
+
+	float maxY(int i) const {
+		return b2Max(table->y0[i], table->y0[i] + table->dy[i]);
+	}
+
+	// y extent grown by gapDistance
+	float lowY(int i) const {
+		return minY(i) - gapDistance;
+	}
+
+	float highY(int i) const {
+		return maxY(i) + gapDistance;
+	}
+
+	// free end of wall close to interior of other wall, true when reported
+	bool endNearWall(int id, int other) {
+		if (state[id] & (Joined | Reported)) {
+			return false;
+		}
+		b2Vec2 p = point(id);
+		b2Vec2 s = table->start(other);
+		b2Vec2 d = table->end(other) - s;
+		float u = b2Dot(p - s, d) / d.LengthSquared();
+		float guard = weldDistance / d.Length();
+		if (u <= guard || u >= 1 - guard) {
+			return false;
+		}
+		float distance = b2Distance(p, s + u * d);
+		if (distance >= gapDistance) {
+			return false;
+		}
+		state[id] |= Reported;
+		report(distance <= weldDistance ? GeometryTJunction : GeometryGap, id / 2, other, p, distance);
+		return true;
+	}
+
+	void test(int a, int b) {
+		b2Vec2 pa = table->start(a);
+		b2Vec2 ra = table->end(a) - pa;
+		b2Vec2 pb = table->start(b);
+		b2Vec2 rb = table->end(b) - pb;
+		float la = ra.Length();
+		float lb = rb.Length();
+
+		// both ends of b on line of a: overlap along common line
+		float side0 = b2Cross(ra, pb - pa) / la;
+		float side1 = b2Cross(ra, pb + rb - pa) / la;
+		if (fabsf(side0) <= weldDistance && fabsf(side1) <= weldDistance) {
+			float u0 = b2Dot(pb - pa, ra) / la;
+			float u1 = b2Dot(pb + rb - pa, ra) / la;
+			float overlap = b2Min(la, b2Max(u0, u1)) - b2Max(0.0f, b2Min(u0, u1));
+			if (overlap > weldDistance) {
+				report(GeometryDuplicate, a, b, pb + 0.5f * rb, overlap);
+			}
+			return;
+		}
+
+		float denominator = b2Cross(ra, rb);
+		if (denominator != 0) {
+			b2Vec2 w = pb - pa;
+			float t = b2Cross(w, rb) / denominator;
+			float u = b2Cross(w, ra) / denominator;
+			float ta = weldDistance / la;
+			float tb = weldDistance / lb;
+			if (t > ta && t < 1 - ta && u > tb && u < 1 - tb) {
+				report(GeometryCrossing, a, b, pa + t * ra, 0);
+				return;
+			}
+		}
+
+		for (int end = 0;end < 2;end++) {
+			endNearWall(2 * a + end, b);
+			endNearWall(2 * b + end, a);
+		}
+	}
+};
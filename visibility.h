@@ -0,0 +1,239 @@
+#pragma once
+
+#include <set>
+#include <algorithm>
+
+#include "trace.h"
+#include "segments.h"
+
+// Part of wall i seen from the query point, u0 and u1 are parameters along the segment
+class VisibleInterval {
+public:
+	int segment;
+	float u0;
+	float u1;
+};
+
+// Exact visibility from one point by angular sweep over SegmentTable, O(n log n) in segments.
+// Walls must not cross each other (they may share endpoints). Segments passing through the
+// origin itself have no angular extent and are skipped.
+class Visibility {
+public:
+	const SegmentTable* segments;
+	float radius = 100;                      // polygon vertex distance in directions where nothing is hit
+
+	b2Vec2 origin;
+	std::vector<VisibleInterval> intervals;  // in counterclockwise order
+	std::vector<b2Vec2> polygon;             // visibility polygon around origin, counterclockwise
+
+	Visibility(const SegmentTable* _segments) {
+		segments = _segments;
+	}
+
+	void compute(b2Vec2 _origin) {
+		origin = _origin;
+		intervals.clear();
+		polygon.clear();
+
+		// segment endpoints oriented counterclockwise as seen from origin
+		start.resize(segments->count);
+		end.resize(segments->count);
+
+		std::vector<Event> events;
+		std::multiset<int, Closer> active = std::multiset<int, Closer>(Closer(this));
+		std::vector<std::multiset<int, Closer>::iterator> position(segments->count, active.end());
+
+		for (int i = 0;i < segments->count;i++) {
+			b2Vec2 p1 = segments->start(i) - origin;
+			b2Vec2 p2 = segments->end(i) - origin;
+			float side = b2Cross(p1, p2);
+			if (fabsf(side) <= epsilon * (p1 - p2).Length()) {
+				continue;
+			}
+			if (side < 0) {
+				std::swap(p1, p2);
+			}
+			start[i] = p1;
+			end[i] = p2;
+
+			float a1 = atan2f(p1.y, p1.x);
+			float a2 = atan2f(p2.y, p2.x);
+			events.push_back(Event(a1, true, i));
+			events.push_back(Event(a2, false, i));
+
+			// segment crosses the sweep start direction -PI
+			if (a1 > a2) {
+				position[i] = active.insert(i);
+			}
+		}
+
+		std::sort(events.begin(), events.end());
+
+		float angle = -PI;
+		int closest = active.empty() ? -1 : *active.begin();
+
+		for (int k = 0;k <= events.size();k++) {
+			float next = k < events.size() ? events[k].angle : PI;
+
+			if (next > angle) {
+				emit(closest, angle, next);
+				angle = next;
+			}
+
+			if (k < events.size()) {
+				int i = events[k].segment;
+				if (events[k].insert) {
+					position[i] = active.insert(i);
+				}
+				else if (position[i] != active.end()) {
+					active.erase(position[i]);
+					position[i] = active.end();
+				}
+				// all events at one angle are applied before the next emit
+				closest = active.empty() ? -1 : *active.begin();
+			}
+		}
+
+		mergeIntervals();
+	}
+
+	// sum of visible length of segment
+	float visibleLength(int segment) const {
+		float length = 0;
+		b2Vec2 v = segments->end(segment) - segments->start(segment);
+		for (int i = 0;i < intervals.size();i++) {
+			if (intervals[i].segment == segment) {
+				length += fabsf(intervals[i].u1 - intervals[i].u0) * v.Length();
+			}
+		}
+		return length;
+	}
+
+private:
+	class Event {
+	public:
+		float angle;
+		bool insert;
+		int segment;
+
+		Event(float _angle, bool _insert, int _segment) {
+			angle = _angle;
+			insert = _insert;
+			segment = _segment;
+		}
+
+		// removals before insertions at the same angle, so walls meeting in a vertex do not overlap
+		bool operator<(const Event& other) const {
+			if (angle != other.angle) {
+				return angle < other.angle;
+			}
+			return !insert && other.insert;
+		}
+	};
+
+	// orders segments crossing the current sweep ray by distance from origin. For non crossing
+	// segments it does not depend on the ray angle, so the set never needs reordering.
+	class Closer {
+	public:
+		const Visibility* visibility;
+
+		Closer(const Visibility* _visibility) {
+			visibility = _visibility;
+		}
+
+		bool operator()(int a, int b) const {
+			if (a == b) {
+				return false;
+			}
+			int front = visibility->inFront(a, b);
+			if (front != 0) {
+				return front > 0;
+			}
+			return visibility->inFront(b, a) < 0;
+		}
+	};
+
+	const float epsilon = 0.000001f;
+	std::vector<b2Vec2> start;               // relative to origin
+	std::vector<b2Vec2> end;
+
+	// 1 when a lies on origin side of b line, -1 on the other side, 0 when a straddles it
+	int inFront(int a, int b) const {
+		b2Vec2 e = end[b] - start[b];
+		float scale = epsilon * e.Length();
+		float s1 = b2Cross(e, start[a] - start[b]);
+		float s2 = b2Cross(e, end[a] - start[b]);
+		float so = b2Cross(e, -start[b]);
+
+		if (fabsf(s1) <= scale) {
+			s1 = s2;
+		}
+		if (fabsf(s2) <= scale) {
+			s2 = s1;
+		}
+		if ((s1 > 0) != (s2 > 0)) {
+			return 0;
+		}
+		return ((s1 > 0) == (so > 0)) ? 1 : -1;
+	}
+
+	// distance parameter along segment where ray from origin in direction angle meets it
+	float rayParameter(int segment, float angle) const {
+		b2Vec2 d = b2Vec2(cos(angle), sin(angle));
+		b2Vec2 p = segments->start(segment) - origin;
+		b2Vec2 e = segments->end(segment) - segments->start(segment);
+		float denominator = b2Cross(e, d);
+		if (denominator == 0) {
+			return 0;
+		}
+		return b2Clamp(b2Cross(d, p) / denominator, 0.0f, 1.0f);
+	}
+
+	void emit(int segment, float angle0, float angle1) {
+		if (segment < 0) {
+			polygon.push_back(origin + radius * b2Vec2(cos(angle0), sin(angle0)));
+			polygon.push_back(origin + radius * b2Vec2(cos(angle1), sin(angle1)));
+			return;
+		}
+
+		VisibleInterval interval;
+		interval.segment = segment;
+		interval.u0 = rayParameter(segment, angle0);
+		interval.u1 = rayParameter(segment, angle1);
+		intervals.push_back(interval);
+
+		b2Vec2 v = segments->end(segment) - segments->start(segment);
+		polygon.push_back(segments->start(segment) + interval.u0 * v);
+		polygon.push_back(segments->start(segment) + interval.u1 * v);
+	}
+
+	// neighbour pieces of one wall split by events of hidden walls become one interval
+	void mergeIntervals() {
+		std::vector<VisibleInterval> merged;
+		for (int i = 0;i < intervals.size();i++) {
+			if (!merged.empty() && merged.back().segment == intervals[i].segment && fabsf(merged.back().u1 - intervals[i].u0) < 0.0001f) {
+				merged.back().u1 = intervals[i].u1;
+			}
+			else {
+				merged.push_back(intervals[i]);
+			}
+		}
+		// wall crossing the sweep start direction is split into last and first piece
+		if (merged.size() > 1 && merged.back().segment == merged.front().segment && fabsf(merged.back().u1 - merged.front().u0) < 0.0001f) {
+			merged.front().u0 = merged.back().u0;
+			merged.pop_back();
+		}
+		intervals = merged;
+	}
+};
+
+// headless batch query, result[i] are visible intervals from points[i]
+inline std::vector<std::vector<VisibleInterval>> visibleIntervals(const SegmentTable* segments, const std::vector<b2Vec2>& points) {
+	std::vector<std::vector<VisibleInterval>> result;
+	Visibility visibility = Visibility(segments);
+	for (int i = 0;i < points.size();i++) {
+		visibility.compute(points[i]);
+		result.push_back(visibility.intervals);
+	}
+	return result;
+}